@@ -0,0 +1,322 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/resource.h>
+
+#include "parser.hpp"
+#include "lexer/lexer_parser.hpp"
+#include "lexer/fsa.hpp"
+#include "lexer/parallel_lexer.hpp"
+
+// Measures every phase of lexer generation: parsing the grammar, building the NFA, converting it
+// to the lexer DFA, computing the parallel states of single symbols and closing them under merging,
+// which fills in the merge table. Every phase reports its time, its heap allocations and the peak
+// heap size while it ran; every grammar reports its state counts.
+//
+// Usage: generation [-n repetitions] [--dfa-only] [--json] [grammar.lex...]
+//
+// Without grammars the suite in bench/grammars is used. --dfa-only skips the parallel lexer,
+// which is by far the most expensive part for larger grammars.
+
+namespace
+{
+    // Every allocation is prefixed with its size, so that the live heap size can be tracked.
+    constexpr const size_t HEADER_SIZE = alignof(std::max_align_t);
+
+    size_t allocations = 0;
+    size_t live_bytes = 0;
+    size_t peak_bytes = 0;
+
+    struct Options
+    {
+        size_t repetitions = 1;
+        bool dfa_only = false;
+        bool json = false;
+        std::vector<std::string> grammars;
+    };
+
+    struct Phase
+    {
+        const char *name;
+        double seconds = 0;
+        size_t allocations = 0;
+        size_t peak_bytes = 0;
+    };
+
+    struct Result
+    {
+        std::string grammar;
+        size_t lexemes = 0;
+        size_t nfa_states = 0;
+        size_t dfa_states = 0;
+        size_t dfa_transitions = 0;
+        size_t parallel_states = 0;
+        size_t merge_table_bytes = 0;
+        std::vector<Phase> phases;
+    };
+
+    std::optional<std::string> read_input(const char *filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+            return std::nullopt;
+        }
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<std::string> default_suite()
+    {
+        auto grammars = std::vector<std::string>();
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator("bench/grammars", ec))
+        {
+            if (entry.path().extension() == ".lex")
+                grammars.push_back(entry.path().string());
+        }
+
+        std::sort(grammars.begin(), grammars.end());
+        return grammars;
+    }
+
+    std::optional<Options> parse_options(int argc, char *argv[])
+    {
+        auto options = Options();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto arg = std::string_view(argv[i]);
+
+            if (arg == "-n" && i + 1 < argc)
+                options.repetitions = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "--dfa-only")
+                options.dfa_only = true;
+            else if (arg == "--json")
+                options.json = true;
+            else if (arg.size() > 0 && arg[0] == '-')
+            {
+                fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+                return std::nullopt;
+            }
+            else
+                options.grammars.push_back(argv[i]);
+        }
+
+        if (options.grammars.empty())
+            options.grammars = default_suite();
+
+        return options;
+    }
+
+    // Starts counting the heap of a phase, returning the allocations so far.
+    size_t start_heap()
+    {
+        peak_bytes = live_bytes;
+        return allocations;
+    }
+
+    void end_heap(Phase &phase, size_t start_allocations)
+    {
+        phase.allocations += allocations - start_allocations;
+        phase.peak_bytes = std::max(phase.peak_bytes, peak_bytes);
+    }
+
+    template <typename F>
+    auto measure(Phase &phase, F &&f)
+    {
+        auto start_allocations = start_heap();
+        auto start = std::chrono::steady_clock::now();
+        auto result = f();
+        phase.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        end_heap(phase, start_allocations);
+        return result;
+    }
+
+    std::optional<Result> bench_grammar(const std::string &filename, const Options &options)
+    {
+        auto src = read_input(filename.c_str());
+        if (!src.has_value())
+            return std::nullopt;
+
+        auto result = Result();
+        result.grammar = filename;
+        result.phases = {{"parse"}, {"nfa"}, {"dfa"}};
+        if (!options.dfa_only)
+            result.phases.insert(result.phases.end(), {{"parallel_states"}, {"merge_table"}});
+
+        try
+        {
+            for (size_t i = 0; i < options.repetitions; ++i)
+            {
+                auto parser = Parser(src.value());
+                auto g = measure(result.phases[0], [&] { return lexer::LexerParser(&parser).parse(); });
+                g.validate();
+
+                auto lexer_nfa = measure(result.phases[1], [&] { return lexer::FiniteStateAutomaton::build_lexer_nfa(&g); });
+                auto dfa = measure(result.phases[2], [&] { return lexer::FiniteStateAutomaton::build_lexer_dfa(&g, lexer_nfa); });
+
+                result.lexemes = g.lexemes.size();
+                result.nfa_states = lexer_nfa.nfa.num_states();
+                result.dfa_states = dfa.num_states();
+                result.dfa_transitions = dfa.edges.size();
+
+                if (options.dfa_only)
+                    continue;
+
+                // Both parallel lexer phases run in the same constructor, which times them itself and
+                // calls back between them, where the heap of the parallel states is taken.
+                auto stats = lexer::ParallelLexer::GenerationStats();
+                size_t start_allocations = 0;
+                stats.on_parallel_states_done = [&] {
+                    end_heap(result.phases[3], start_allocations);
+                    start_allocations = start_heap();
+                };
+
+                start_allocations = start_heap();
+                auto parallel_lexer = lexer::ParallelLexer(dfa, &stats);
+                end_heap(result.phases[4], start_allocations);
+
+                result.phases[3].seconds += stats.parallel_states_seconds;
+                result.phases[4].seconds += stats.merge_table_seconds;
+                result.parallel_states = stats.parallel_states;
+                result.merge_table_bytes = stats.merge_table_bytes;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            // This includes running out of memory for the merge table of a large grammar.
+            fprintf(stderr, "Failed to generate lexer for '%s': %s\n", filename.c_str(), e.what());
+            return std::nullopt;
+        }
+
+        for (auto &phase : result.phases)
+        {
+            phase.seconds /= options.repetitions;
+            phase.allocations /= options.repetitions;
+        }
+
+        return result;
+    }
+
+    void print_text(const Result &r)
+    {
+        printf("%s: %zu lexemes, %zu NFA states, %zu DFA states (%zu transitions)", r.grammar.c_str(), r.lexemes, r.nfa_states, r.dfa_states, r.dfa_transitions);
+        if (r.phases.size() > 3)
+            printf(", %zu parallel states (%.1f MiB merge table)", r.parallel_states, r.merge_table_bytes / (1024.0 * 1024.0));
+        printf("\n");
+
+        for (const auto &phase : r.phases)
+        {
+            printf("  %-16s %12.3f ms %10zu allocations %10.1f MiB peak heap\n",
+                   phase.name, phase.seconds * 1e3, phase.allocations, phase.peak_bytes / (1024.0 * 1024.0));
+        }
+    }
+
+    void print_json(const std::vector<Result> &results)
+    {
+        printf("{\n  \"results\": [");
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &r = results[i];
+            printf("%s\n    {\n", i == 0 ? "" : ",");
+            printf("      \"grammar\": \"%s\",\n", r.grammar.c_str());
+            printf("      \"lexemes\": %zu,\n", r.lexemes);
+            printf("      \"nfa_states\": %zu,\n", r.nfa_states);
+            printf("      \"dfa_states\": %zu,\n", r.dfa_states);
+            printf("      \"dfa_transitions\": %zu,\n", r.dfa_transitions);
+            if (r.phases.size() > 3)
+            {
+                printf("      \"parallel_states\": %zu,\n", r.parallel_states);
+                printf("      \"merge_table_bytes\": %zu,\n", r.merge_table_bytes);
+            }
+
+            printf("      \"phases\": {");
+            for (size_t j = 0; j < r.phases.size(); ++j)
+            {
+                const auto &phase = r.phases[j];
+                printf("%s\n        \"%s\": {\"seconds\": %.9f, \"allocations\": %zu, \"peak_heap_bytes\": %zu}",
+                       j == 0 ? "" : ",", phase.name, phase.seconds, phase.allocations, phase.peak_bytes);
+            }
+            printf("\n      }\n    }");
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        printf("\n  ],\n  \"peak_rss_bytes\": %zu\n}\n", static_cast<size_t>(usage.ru_maxrss) * 1024);
+    }
+}
+
+void *operator new(size_t size)
+{
+    auto *p = static_cast<std::byte *>(std::malloc(size + HEADER_SIZE));
+    if (!p)
+        throw std::bad_alloc();
+
+    *reinterpret_cast<size_t *>(p) = size;
+    ++allocations;
+    live_bytes += size;
+    peak_bytes = std::max(peak_bytes, live_bytes);
+    return p + HEADER_SIZE;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (!p)
+        return;
+
+    auto *base = static_cast<std::byte *>(p) - HEADER_SIZE;
+    live_bytes -= *reinterpret_cast<size_t *>(base);
+    std::free(base);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = parse_options(argc, argv);
+    if (!options.has_value())
+        return EXIT_FAILURE;
+
+    if (options->grammars.empty())
+    {
+        fprintf(stderr, "Error: No grammars\n");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+    auto results = std::vector<Result>();
+    for (const auto &filename : options->grammars)
+    {
+        auto result = bench_grammar(filename, options.value());
+        if (!result.has_value())
+        {
+            ok = false;
+            continue;
+        }
+
+        if (!options->json)
+            print_text(result.value());
+        results.push_back(std::move(result.value()));
+    }
+
+    if (options->json)
+        print_json(results);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
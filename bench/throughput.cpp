@@ -0,0 +1,656 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <functional>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "parser.hpp"
+#include "lexer/lexer_parser.hpp"
+#include "lexer/parallel_lexer.hpp"
+#include "lexer/lazy_parallel_lexer.hpp"
+#include "lexer/interpreter.hpp"
+#include "lexer/host_lexer.hpp"
+#include "lexer/shuffle_lexer.hpp"
+#include "lexer/nfa_lexer.hpp"
+#include "lexer/direct_lexer.hpp"
+#include "lexer/jit_lexer.hpp"
+#include "lexer/grammar_registry.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/number_extractor.hpp"
+#include "lexer/string_decoder.hpp"
+#include "lexer/bracket_matcher.hpp"
+#include "instrumentation.hpp"
+
+#ifdef LEXER_CUDA
+#include "lexer.cuh"
+#endif
+
+// Measures the wall time of every lexer engine over a corpus, and writes the results as JSON.
+// Each engine lexes each file a number of times after some warmup runs; the latency percentiles
+// are over those repetitions, and the throughput figures are computed from the median.
+//
+// Usage: throughput [-g grammar.lex] [-e engine]... [-w warmups] [-r repetitions] [-o results.json]
+//                   [--utf8] [--merge-cache bytes] [--layout-sample file]... [--trace-dir dir]
+//                   [--numbers lexeme] [--strings lexeme] [--brackets open:close]... [file...]
+//
+// Without files the corpus is files/test*.json. Progress is written to stderr. The host engine runs
+// the phases of the CUDA lexer on the threads of the processor, see lexer/host_lexer.hpp. The shuffle
+// engine does the same with state vectors instead of the merge table, and is only there if the DFA
+// is small enough, see lexer/shuffle_lexer.hpp. The nfa engine simulates the NFA with bit masks, see
+// lexer/nfa_lexer.hpp. The direct engine is the lexer generated as C++ from the grammar at build
+// time, if it is one of DIRECT_GRAMMARS in the Makefile. The jit engine compiles the DFA to x86-64
+// code when the grammar is loaded, see lexer/jit_lexer.hpp. The lazy engine is the interpreter with merges computed on demand, in a cache
+// of --merge-cache bytes. With --layout-sample the merge table of the other engines is laid out by
+// state frequency on the samples.
+//
+// The post-lex stages run on the tokens of every file as lexed by the interpreter, with the same
+// warmups and repetitions, and are listed separately: --numbers converts the tokens of a lexeme to
+// their values, see lexer/number_extractor.hpp, --strings decodes the tokens of a lexeme as JSON
+// strings, see lexer/string_decoder.hpp, and --brackets matches the tokens of every pair of lexemes,
+// see lexer/bracket_matcher.hpp.
+//
+// When built with LEXER_INSTRUMENTATION, every result also lists the stages of the last repetition,
+// and --trace-dir writes that repetition as a Chrome trace to <dir>/<engine>-<file>.trace.json.
+
+namespace
+{
+    struct Options
+    {
+        std::string grammar = "json.lex";
+        std::vector<std::string> engines;
+        size_t warmups = 2;
+        size_t repetitions = 10;
+        std::string output = "-";
+        bool utf8_validation = false;
+        size_t merge_cache_bytes = lexer::LazyParallelLexer::DEFAULT_CACHE_BYTES;
+        std::vector<std::string> layout_samples;
+        std::string trace_dir;
+        std::string numbers;
+        std::string strings;
+        std::vector<lexer::BracketPair> brackets;
+        std::vector<std::string> files;
+    };
+
+    struct Engine
+    {
+        std::string name;
+        std::function<void(std::string_view, lexer::TokenStream &, Profile &)> lex;
+    };
+
+    // Runs on a token stream, and returns how many tokens it processed.
+    struct PostLexStage
+    {
+        std::string name;
+        std::function<size_t(std::string_view, const lexer::TokenStream &)> run;
+    };
+
+    struct Input
+    {
+        std::string path;
+        std::string contents;
+    };
+
+    struct Result
+    {
+        std::string engine;
+        std::string file;
+        size_t bytes;
+        size_t tokens;
+        std::optional<lexer::LexError> error;
+        std::vector<double> seconds;
+        // The highest resident memory of the process during the runs of the engine on the file,
+        // including the tables and inputs which were resident before.
+        size_t peak_rss;
+        // Resident memory of the process after the last repetition, less that before the first:
+        // the buffers the engine grew for the file, and its tokens.
+        long long rss_growth;
+        Profile profile;
+    };
+
+    struct PostLexResult
+    {
+        std::string stage;
+        std::string file;
+        size_t tokens;
+        std::vector<double> seconds;
+    };
+
+    std::optional<std::string> read_input(const char *filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+            return std::nullopt;
+        }
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<std::string> default_corpus()
+    {
+        auto files = std::vector<std::string>();
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator("files", ec))
+        {
+            auto name = entry.path().filename().string();
+            if (name.rfind("test", 0) == 0 && entry.path().extension() == ".json")
+                files.push_back(entry.path().string());
+        }
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    std::optional<Options> parse_options(int argc, char *argv[])
+    {
+        auto options = Options();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto arg = std::string_view(argv[i]);
+            bool has_value = i + 1 < argc;
+
+            if (arg == "-g" && has_value)
+                options.grammar = argv[++i];
+            else if (arg == "-e" && has_value)
+                options.engines.push_back(argv[++i]);
+            else if (arg == "-w" && has_value)
+                options.warmups = std::strtoul(argv[++i], nullptr, 10);
+            else if (arg == "-r" && has_value)
+                options.repetitions = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "-o" && has_value)
+                options.output = argv[++i];
+            else if (arg == "--utf8")
+                options.utf8_validation = true;
+            else if (arg == "--merge-cache" && has_value)
+                options.merge_cache_bytes = std::strtoull(argv[++i], nullptr, 10);
+            else if (arg == "--layout-sample" && has_value)
+                options.layout_samples.push_back(argv[++i]);
+            else if (arg == "--trace-dir" && has_value)
+                options.trace_dir = argv[++i];
+            else if (arg == "--numbers" && has_value)
+                options.numbers = argv[++i];
+            else if (arg == "--strings" && has_value)
+                options.strings = argv[++i];
+            else if (arg == "--brackets" && has_value)
+            {
+                auto pair = std::string_view(argv[++i]);
+                auto colon = pair.find(':');
+                if (colon == std::string_view::npos)
+                {
+                    fprintf(stderr, "Error: Invalid bracket pair '%s', expected open:close\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.brackets.push_back({std::string(pair.substr(0, colon)), std::string(pair.substr(colon + 1))});
+            }
+            else if (arg.size() > 0 && arg[0] == '-')
+            {
+                fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+                return std::nullopt;
+            }
+            else
+                options.files.push_back(argv[i]);
+        }
+
+        if (options.files.empty())
+            options.files = default_corpus();
+
+        return options;
+    }
+
+    // Resets the high-water mark of the resident memory of the process to its current size, so that
+    // peak_rss only covers what runs after it. Returns false if the kernel does not allow that.
+    bool reset_peak_rss()
+    {
+        FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+        if (!clear_refs)
+            return false;
+
+        bool ok = fputs("5", clear_refs) >= 0;
+        return fclose(clear_refs) == 0 && ok;
+    }
+
+    // VmHWM, the high-water mark of the resident memory of the process.
+    size_t peak_rss()
+    {
+        FILE *status = fopen("/proc/self/status", "r");
+        if (!status)
+            return 0;
+
+        char line[256];
+        size_t kib = 0;
+        while (fgets(line, sizeof(line), status))
+        {
+            if (sscanf(line, "VmHWM: %zu kB", &kib) == 1)
+                break;
+        }
+        fclose(status);
+        return kib * 1024;
+    }
+
+    // Unlike peak_rss, this also goes down when memory is released.
+    long long current_rss()
+    {
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (!statm)
+            return 0;
+
+        long long size = 0, resident = 0;
+        if (fscanf(statm, "%lld %lld", &size, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    // Nearest-rank percentile of sorted samples.
+    double percentile(const std::vector<double> &sorted, double p)
+    {
+        auto rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max(rank, size_t{1})) - 1];
+    }
+
+    std::string json_string(std::string_view s)
+    {
+        auto result = std::string("\"");
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result += '\\';
+                result += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                result += escape;
+            }
+            else
+                result += c;
+        }
+        result += '"';
+        return result;
+    }
+
+    Result run(const Engine &engine, const Input &input, const Options &options)
+    {
+        auto tokens = lexer::TokenStream();
+        auto result = Result{engine.name, input.path, input.contents.size(), 0, std::nullopt, {}, 0, 0, Profile()};
+        if (!reset_peak_rss())
+            fprintf(stderr, "Warning: Failed to reset the peak RSS, it covers the whole process so far\n");
+        auto rss_before = current_rss();
+
+        for (size_t i = 0; i < options.warmups + options.repetitions; ++i)
+        {
+            tokens.clear();
+            result.profile.clear();
+            auto start = std::chrono::steady_clock::now();
+            engine.lex(input.contents, tokens, result.profile);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (i >= options.warmups)
+                result.seconds.push_back(seconds);
+        }
+
+        result.tokens = tokens.size();
+        result.error = tokens.error;
+        result.peak_rss = peak_rss();
+        result.rss_growth = current_rss() - rss_before;
+        std::sort(result.seconds.begin(), result.seconds.end());
+        return result;
+    }
+
+    PostLexResult run_post_lex(const PostLexStage &stage, const Input &input, const lexer::TokenStream &tokens, const Options &options)
+    {
+        auto result = PostLexResult{stage.name, input.path, 0, {}};
+
+        for (size_t i = 0; i < options.warmups + options.repetitions; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            result.tokens = stage.run(input.contents, tokens);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (i >= options.warmups)
+                result.seconds.push_back(seconds);
+        }
+
+        std::sort(result.seconds.begin(), result.seconds.end());
+        return result;
+    }
+
+    bool write_trace(const std::string &dir, const Result &r)
+    {
+        auto path = std::filesystem::path(dir) / (r.engine + "-" + std::filesystem::path(r.file).filename().string() + ".trace.json");
+        auto out = std::ofstream(path);
+        if (!out)
+        {
+            fprintf(stderr, "Error: Failed to open trace file '%s'\n", path.string().c_str());
+            return false;
+        }
+
+        r.profile.write_chrome_trace(out);
+        return true;
+    }
+
+    void write_results(FILE *out, const Options &options, const std::vector<Result> &results, const std::vector<PostLexResult> &post_lex)
+    {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"grammar\": %s,\n", json_string(options.grammar).c_str());
+        fprintf(out, "  \"warmups\": %zu,\n", options.warmups);
+        fprintf(out, "  \"repetitions\": %zu,\n", options.repetitions);
+        fprintf(out, "  \"utf8_validation\": %s,\n", options.utf8_validation ? "true" : "false");
+        fprintf(out, "  \"layout_samples\": %zu,\n", options.layout_samples.size());
+        fprintf(out, "  \"results\": [");
+
+        bool first = true;
+        for (const auto &r : results)
+        {
+            auto p50 = percentile(r.seconds, 0.50);
+            double mean = 0;
+            for (auto s : r.seconds)
+                mean += s;
+            mean /= r.seconds.size();
+
+            fprintf(out, "%s\n    {\n", first ? "" : ",");
+            first = false;
+
+            fprintf(out, "      \"engine\": %s,\n", json_string(r.engine).c_str());
+            fprintf(out, "      \"file\": %s,\n", json_string(r.file).c_str());
+            fprintf(out, "      \"bytes\": %zu,\n", r.bytes);
+            fprintf(out, "      \"tokens\": %zu,\n", r.tokens);
+            if (r.error.has_value())
+                fprintf(out, "      \"error_offset\": %zu,\n", r.error->offset);
+            else
+                fprintf(out, "      \"error_offset\": null,\n");
+            fprintf(out, "      \"min_s\": %.9f,\n", r.seconds.front());
+            fprintf(out, "      \"mean_s\": %.9f,\n", mean);
+            fprintf(out, "      \"p50_s\": %.9f,\n", p50);
+            fprintf(out, "      \"p99_s\": %.9f,\n", percentile(r.seconds, 0.99));
+            fprintf(out, "      \"gb_per_s\": %.6f,\n", r.bytes / p50 / 1e9);
+            fprintf(out, "      \"tokens_per_s\": %.1f,\n", r.tokens / p50);
+            fprintf(out, "      \"peak_rss_bytes\": %zu,\n", r.peak_rss);
+            fprintf(out, "      \"rss_growth_bytes\": %lld%s\n", r.rss_growth, INSTRUMENTATION_ENABLED ? "," : "");
+
+            if (INSTRUMENTATION_ENABLED)
+            {
+                auto stages = r.profile.stages();
+                fprintf(out, "      \"stages\": {");
+                for (size_t i = 0; i < stages.size(); ++i)
+                {
+                    const auto &stage = stages[i];
+                    fprintf(out, "%s\n        %s: {\"calls\": %zu, \"seconds\": %.9f, \"bytes\": %zu, \"count\": %zu}",
+                            i == 0 ? "" : ",", json_string(stage.stage).c_str(), stage.calls, stage.seconds, stage.bytes, stage.count);
+                }
+                fprintf(out, "\n      }\n");
+            }
+
+            fprintf(out, "    }");
+        }
+
+        fprintf(out, "\n  ],\n");
+        fprintf(out, "  \"post_lex\": [");
+
+        first = true;
+        for (const auto &r : post_lex)
+        {
+            auto p50 = percentile(r.seconds, 0.50);
+
+            fprintf(out, "%s\n    {\n", first ? "" : ",");
+            first = false;
+
+            fprintf(out, "      \"stage\": %s,\n", json_string(r.stage).c_str());
+            fprintf(out, "      \"file\": %s,\n", json_string(r.file).c_str());
+            fprintf(out, "      \"tokens\": %zu,\n", r.tokens);
+            fprintf(out, "      \"min_s\": %.9f,\n", r.seconds.front());
+            fprintf(out, "      \"p50_s\": %.9f,\n", p50);
+            fprintf(out, "      \"p99_s\": %.9f,\n", percentile(r.seconds, 0.99));
+            fprintf(out, "      \"tokens_per_s\": %.1f\n", r.tokens / p50);
+            fprintf(out, "    }");
+        }
+
+        fprintf(out, "\n  ]\n}\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = parse_options(argc, argv);
+    if (!options.has_value())
+        return EXIT_FAILURE;
+
+    auto inputs = std::vector<Input>();
+    for (const auto &path : options->files)
+    {
+        auto contents = read_input(path.c_str());
+        if (!contents.has_value())
+            return EXIT_FAILURE;
+        inputs.push_back({path, std::move(contents.value())});
+    }
+
+    if (inputs.empty())
+    {
+        fprintf(stderr, "Error: No input files\n");
+        return EXIT_FAILURE;
+    }
+
+    auto grammar_src = read_input(options->grammar.c_str());
+    if (!grammar_src.has_value())
+        return EXIT_FAILURE;
+
+    lexer::LexicalGrammar g;
+    std::optional<lexer::ParallelLexer> parallel_lexer;
+    std::optional<lexer::LazyParallelLexer> lazy_lexer;
+    std::optional<lexer::ShuffleTable> shuffle_table;
+    std::optional<lexer::NfaLexer> nfa_lexer;
+    std::optional<lexer::JitLexer> jit_lexer;
+    try
+    {
+        auto parser = Parser(grammar_src.value());
+        g = lexer::LexerParser(&parser).parse();
+        g.validate();
+        auto dfa = lexer::FiniteStateAutomaton::build_lexer_dfa(&g);
+        parallel_lexer.emplace(dfa);
+        lazy_lexer.emplace(dfa, options->merge_cache_bytes);
+        if (lexer::ShuffleTable::fits(dfa))
+            shuffle_table.emplace(dfa);
+        if (lexer::FiniteStateAutomaton::build_lexer_nfa(&g).nfa.num_states() <= lexer::NfaLexer::MAX_STATES)
+            nfa_lexer.emplace(&g);
+        if (lexer::JitLexer::supported())
+            jit_lexer.emplace(dfa);
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "Failed to generate lexer: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    if (!options->layout_samples.empty())
+    {
+        auto samples = std::vector<std::string>();
+        for (const auto &path : options->layout_samples)
+        {
+            auto sample = read_input(path.c_str());
+            if (!sample.has_value())
+                return EXIT_FAILURE;
+            samples.push_back(std::move(sample.value()));
+        }
+        parallel_lexer->optimize_layout(std::vector<std::string_view>(samples.begin(), samples.end()));
+    }
+
+    auto interpreter = lexer::LexerInterpreter(&parallel_lexer.value(), options->utf8_validation);
+
+    auto engines = std::vector<Engine>();
+    engines.push_back({"interpreter", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                           interpreter.lex(input, tokens, &profile);
+                       }});
+
+    auto host_lexer = lexer::HostLexer(&parallel_lexer.value(), options->utf8_validation);
+    engines.push_back({"host", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                           host_lexer.lex(input, tokens);
+                           profile = host_lexer.last_profile();
+                       }});
+
+    // Only for grammars whose DFA fits in state vectors.
+    std::optional<lexer::ShuffleLexer> shuffle_lexer;
+    if (shuffle_table)
+    {
+        shuffle_lexer.emplace(&shuffle_table.value(), options->utf8_validation);
+        engines.push_back({"shuffle", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                               shuffle_lexer->lex(input, tokens);
+                               profile = shuffle_lexer->last_profile();
+                           }});
+    }
+
+    // Only for grammars whose NFA fits in the state sets.
+    if (nfa_lexer)
+    {
+        engines.push_back({"nfa", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                               nfa_lexer->lex(input, tokens, options->utf8_validation, &profile);
+                           }});
+    }
+
+    // Only for grammars with the same source as one of the direct-coded lexers of the build.
+    if (const auto *direct_lexer = lexer::DirectLexer::find(lexer::content_hash(grammar_src.value())))
+    {
+        engines.push_back({"direct", [&, direct_lexer](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                               StageTimer timer(&profile, "lex", input.size());
+                               direct_lexer->lex(input, g, tokens, options->utf8_validation);
+                           }});
+    }
+
+    // Only on processors which the JIT compiler supports.
+    if (jit_lexer)
+    {
+        engines.push_back({"jit", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                               jit_lexer->lex(input, tokens, options->utf8_validation, &profile);
+                           }});
+    }
+
+    auto lazy_interpreter = lexer::LexerInterpreter(&lazy_lexer.value(), options->utf8_validation);
+    engines.push_back({"lazy", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                           lazy_interpreter.lex(input, tokens, &profile);
+                       }});
+
+#ifdef LEXER_CUDA
+    auto cuda_lexer = CudaLexer(parallel_lexer.value(), options->utf8_validation);
+    engines.push_back({"cuda", [&](std::string_view input, lexer::TokenStream &tokens, Profile &profile) {
+                           cuda_lexer.lex(input, tokens);
+                           profile = cuda_lexer.last_profile();
+                       }});
+#endif
+
+    auto post_lex_stages = std::vector<PostLexStage>();
+    std::optional<lexer::NumberExtractor> number_extractor;
+    std::optional<lexer::StringDecoder> string_decoder;
+    std::optional<lexer::BracketMatcher> bracket_matcher;
+    try
+    {
+        if (!options->numbers.empty())
+        {
+            number_extractor.emplace(&g, options->numbers);
+            post_lex_stages.push_back({"numbers", [&](std::string_view input, const lexer::TokenStream &tokens) {
+                                           return number_extractor->extract(input, tokens).size();
+                                       }});
+        }
+
+        if (!options->strings.empty())
+        {
+            string_decoder.emplace(&g, options->strings);
+            post_lex_stages.push_back({"strings", [&](std::string_view input, const lexer::TokenStream &tokens) {
+                                           return string_decoder->decode(input, tokens).size();
+                                       }});
+        }
+
+        if (!options->brackets.empty())
+        {
+            bracket_matcher.emplace(&g, options->brackets);
+            post_lex_stages.push_back({"brackets", [&](std::string_view, const lexer::TokenStream &tokens) {
+                                           return bracket_matcher->match(tokens).partners.size();
+                                       }});
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    auto selected = std::vector<const Engine *>();
+    for (const auto &engine : engines)
+    {
+        if (options->engines.empty() || std::find(options->engines.begin(), options->engines.end(), engine.name) != options->engines.end())
+            selected.push_back(&engine);
+    }
+
+    for (const auto &name : options->engines)
+    {
+        auto it = std::find_if(engines.begin(), engines.end(), [&](const Engine &engine) { return engine.name == name; });
+        if (it == engines.end())
+        {
+            fprintf(stderr, "Error: Unknown engine '%s'\n", name.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!options->trace_dir.empty() && !INSTRUMENTATION_ENABLED)
+        fprintf(stderr, "Warning: Built without instrumentation, traces will be empty\n");
+
+    auto results = std::vector<Result>();
+    for (const auto *engine : selected)
+    {
+        for (const auto &input : inputs)
+        {
+            fprintf(stderr, "%s: %s\n", engine->name.c_str(), input.path.c_str());
+            results.push_back(run(*engine, input, options.value()));
+
+            if (!options->trace_dir.empty() && !write_trace(options->trace_dir, results.back()))
+                return EXIT_FAILURE;
+        }
+    }
+
+    auto post_lex = std::vector<PostLexResult>();
+    for (const auto &input : inputs)
+    {
+        if (post_lex_stages.empty())
+            break;
+
+        auto tokens = lexer::TokenStream();
+        interpreter.lex(input.contents, tokens);
+        for (const auto &stage : post_lex_stages)
+        {
+            fprintf(stderr, "%s: %s\n", stage.name.c_str(), input.path.c_str());
+            post_lex.push_back(run_post_lex(stage, input, tokens, options.value()));
+        }
+    }
+
+    FILE *out = stdout;
+    if (options->output != "-")
+    {
+        out = fopen(options->output.c_str(), "w");
+        if (!out)
+        {
+            fprintf(stderr, "Error: Failed to open output file '%s'\n", options->output.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    write_results(out, options.value(), results, post_lex);
+
+    if (out != stdout)
+        fclose(out);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#ifndef _ARENA
+#define _ARENA
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+// Bump allocator which hands out memory from large blocks, all of which are released at once
+// when the arena is destroyed. Objects allocated in an arena are never destructed, so only
+// trivially destructible types may be placed in it. An arena is not thread safe; use one
+// per thread instead.
+class Arena
+{
+    constexpr const static size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte *head;
+    size_t remaining;
+    size_t used;
+
+public:
+    Arena();
+
+    Arena(Arena &&other) noexcept;
+    Arena &operator=(Arena &&other) noexcept;
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template <typename T>
+    T *allocate_array(size_t n)
+    {
+        static_assert(std::is_trivially_destructible_v<T>);
+        return static_cast<T *>(this->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>);
+        return new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    T *copy_array(const std::vector<T> &items)
+    {
+        auto *result = this->allocate_array<T>(items.size());
+        std::uninitialized_copy(items.begin(), items.end(), result);
+        return result;
+    }
+
+    // Total number of bytes handed out, not counting padding and unused space in blocks.
+    size_t bytes_used() const;
+};
+
+// Non-owning view of an array which lives in an arena.
+template <typename T>
+struct ArenaSpan
+{
+    T *items;
+    size_t count;
+
+    ArenaSpan() : items(nullptr), count(0) {}
+    ArenaSpan(T *items, size_t count) : items(items), count(count) {}
+    ArenaSpan(Arena &arena, const std::vector<T> &items) : items(arena.copy_array(items)), count(items.size()) {}
+
+    T *begin() const { return this->items; }
+    T *end() const { return this->items + this->count; }
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+    T &operator[](size_t i) const { return this->items[i]; }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _BOUNDED_QUEUE
+#define _BOUNDED_QUEUE
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <utility>
+#include <cstddef>
+
+// Queue between threads which holds at most `capacity` items: push blocks while it is full and
+// pop while it is empty, so a producer cannot run ahead of its consumer by more than that.
+// After close, push drops its item and pop returns the remaining items, then nullopt.
+template <typename T>
+class BoundedQueue
+{
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    // Returns false if the queue was closed.
+    bool push(T item)
+    {
+        auto lock = std::unique_lock(this->mutex);
+        this->not_full.wait(lock, [this]
+                            { return this->closed || this->items.size() < this->capacity; });
+        if (this->closed)
+            return false;
+
+        this->items.push_back(std::move(item));
+        this->not_empty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop()
+    {
+        auto lock = std::unique_lock(this->mutex);
+        this->not_empty.wait(lock, [this]
+                             { return this->closed || !this->items.empty(); });
+        if (this->items.empty())
+            return std::nullopt;
+
+        auto item = std::move(this->items.front());
+        this->items.pop_front();
+        this->not_full.notify_one();
+        return item;
+    }
+
+    void close()
+    {
+        auto lock = std::unique_lock(this->mutex);
+        this->closed = true;
+        this->not_empty.notify_all();
+        this->not_full.notify_all();
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _INSTRUMENTATION
+#define _INSTRUMENTATION
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <iosfwd>
+#include <cstddef>
+#include <cstdint>
+
+// Instrumentation is compiled in when LEXER_INSTRUMENTATION is defined (make INSTRUMENTATION=1).
+// Otherwise StageTimer is empty and a Profile is never written to, so instrumented code
+// compiles to the same thing as uninstrumented code.
+#ifdef LEXER_INSTRUMENTATION
+constexpr const bool INSTRUMENTATION_ENABLED = true;
+#else
+constexpr const bool INSTRUMENTATION_ENABLED = false;
+#endif
+
+// One execution of a pipeline stage. Times are relative to when the profile was last cleared.
+struct StageEvent
+{
+    const char *stage;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    size_t bytes;
+    size_t count;
+    uint32_t thread;
+};
+
+// Totals over all executions of one stage.
+struct StageStats
+{
+    const char *stage;
+    size_t calls;
+    double seconds;
+    size_t bytes;
+    size_t count;
+};
+
+// Record of the stages of a run. Stages may be recorded from several threads at once.
+class Profile
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point epoch;
+    std::vector<StageEvent> event_list;
+    mutable std::mutex mutex;
+
+public:
+    Profile();
+    Profile(const Profile &other);
+    Profile &operator=(const Profile &other);
+
+    void clear();
+    void record(const char *stage, Clock::time_point start, Clock::time_point end, size_t bytes, size_t count);
+
+    std::vector<StageEvent> events() const;
+
+    // Totals per stage, in order of the first execution of each stage.
+    std::vector<StageStats> stages() const;
+
+    // Writes the events in the Chrome trace event format, for chrome://tracing or Perfetto.
+    void write_chrome_trace(std::ostream &os) const;
+};
+
+// Records the time from its construction to its destruction as one execution of a stage,
+// together with the bytes it processed and a stage-specific count, such as tokens produced.
+// A null profile records nothing.
+class StageTimer
+{
+#ifdef LEXER_INSTRUMENTATION
+    Profile *profile;
+    const char *stage;
+    size_t bytes;
+    size_t count;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StageTimer(Profile *profile, const char *stage, size_t bytes = 0) :
+        profile(profile), stage(stage), bytes(bytes), count(0), start(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer()
+    {
+        if (this->profile)
+            this->profile->record(this->stage, this->start, std::chrono::steady_clock::now(), this->bytes, this->count);
+    }
+
+    void add_bytes(size_t n) { this->bytes += n; }
+    void add_count(size_t n) { this->count += n; }
+#else
+public:
+    StageTimer(Profile *, const char *, size_t = 0) {}
+
+    void add_bytes(size_t) {}
+    void add_count(size_t) {}
+#endif
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+};
+
+#endif
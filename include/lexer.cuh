@@ -2,39 +2,150 @@
 #define _CUDA_LEXER
 
 #include <cuda_runtime.h>
+#include <optional>
+#include <string_view>
 
 #include "lexer/lexer_parser.hpp"
 #include "lexer/parallel_lexer.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/backend.hpp"
+#include "instrumentation.hpp"
 
-__global__ void map_trans_kernel(
-    lexer::ParallelLexer::Transition *trans,
+// Composes the transitions of the bytes of every tile of tile_size bytes into aggregates[tile],
+// reading them straight from the input. If first_invalid is not null, also validates the input as
+// UTF-8 and lowers it to the offset of the first ill-formed sequence.
+__global__ void reduce_tiles_kernel(
+    lexer::ParallelLexer::Transition *aggregates,
     lexer::ParallelLexer::Transition *initial_states,
+    lexer::ParallelLexer::Transition *merge_table,
+    size_t num_states,
     char *input,
     size_t input_length,
+    size_t tile_size,
+    unsigned long long *first_invalid,
     size_t N_THREADS
 );
 
-__global__ void prefix_step_kernel(
-    lexer::ParallelLexer::Transition *start,
-    lexer::ParallelLexer::Transition *prefix,
+// Lexes every tile again, starting from the composition of all tiles before it, which aggregates
+// holds after the scan, and writes the number of tokens that end in it to counts[tile]. The last
+// token of the input, which ends at its end, is not counted.
+__global__ void count_tokens_kernel(
+    size_t *counts,
+    lexer::ParallelLexer::Transition *aggregates,
+    lexer::ParallelLexer::Transition *initial_states,
     lexer::ParallelLexer::Transition *merge_table,
     size_t num_states,
-    size_t step_size,
+    char *input,
     size_t input_length,
+    size_t tile_size,
     size_t N_THREADS
 );
 
-__global__ void extract_final_kernel(
-    lexer::ParallelLexer::Transition *trans,
+// Lexes every tile again like count_tokens_kernel, and writes the tokens that end in it from
+// offsets[tile] on: their ends and lexemes, and the begins of the tokens after them, as well as
+// begins[0]. Lowers first_rejected to the index of the first token with a null lexeme.
+__global__ void write_tokens_kernel(
+    size_t *offsets,
+    lexer::ParallelLexer::Transition *aggregates,
+    lexer::ParallelLexer::Transition *initial_states,
+    lexer::ParallelLexer::Transition *merge_table,
+    size_t num_states,
     lexer::Lexeme **final_states,
-    lexer::Lexeme **res,
-    bool *res_is_token,
+    char *input,
     size_t input_length,
+    size_t tile_size,
+    size_t *begins,
+    size_t *ends,
+    lexer::Lexeme **lexemes,
+    unsigned long long *first_rejected,
     size_t N_THREADS
 );
 
-class CudaLexer {
-    std::string input;
+// Device memory, or pinned host memory to copy it from, which only grows: a run of inputs of
+// similar size allocates it once. The contents are not kept when it grows.
+template <typename T, bool PINNED_HOST = false>
+class CudaBuffer {
+    T *ptr;
+    size_t capacity;
+
+public:
+    CudaBuffer(): ptr(nullptr), capacity(0) {}
+    ~CudaBuffer() {
+        release();
+    }
+
+    CudaBuffer(const CudaBuffer &) = delete;
+    CudaBuffer &operator=(const CudaBuffer &) = delete;
+
+    // Room for at least n elements.
+    T *reserve(size_t n) {
+        if (n > this->capacity) {
+            release();
+            if (PINNED_HOST)
+                cudaMallocHost(&this->ptr, n * sizeof(T));
+            else
+                cudaMalloc(&this->ptr, n * sizeof(T));
+            this->capacity = n;
+        }
+        return this->ptr;
+    }
+
+    void release() {
+        if (!this->ptr)
+            return;
+        if (PINNED_HOST)
+            cudaFreeHost(this->ptr);
+        else
+            cudaFree(this->ptr);
+        this->ptr = nullptr;
+        this->capacity = 0;
+    }
+
+    T *data() const {
+        return this->ptr;
+    }
+
+    size_t bytes() const {
+        return this->capacity * sizeof(T);
+    }
+};
+
+// Everything CudaLexer keeps between calls: the tables of the lexer, uploaded once, and grow-only
+// buffers for the input, the tile aggregates and token counts, and the tokens.
+struct CudaWorkspace {
+    CudaBuffer<lexer::ParallelLexer::Transition> initial_states;
+    CudaBuffer<lexer::ParallelLexer::Transition> merge_table;
+    CudaBuffer<lexer::Lexeme *> final_states;
+
+    CudaBuffer<char> input;
+    CudaBuffer<lexer::ParallelLexer::Transition> aggregates;
+    CudaBuffer<unsigned long long> first_invalid;
+    CudaBuffer<size_t> counts;
+    CudaBuffer<unsigned long long> first_rejected;
+    CudaBuffer<size_t> begins;
+    CudaBuffer<size_t> ends;
+    CudaBuffer<lexer::Lexeme *> lexemes;
+
+    CudaBuffer<lexer::ParallelLexer::Transition, true> host_aggregates;
+    CudaBuffer<size_t, true> host_counts;
+
+    // Grows the buffers for an input of input_length bytes in num_tiles tiles.
+    void reserve(size_t input_length, size_t num_tiles);
+
+    // Grows the token buffers, which are only sized once the tokens have been counted.
+    void reserve_tokens(size_t num_tokens);
+
+    // Frees the buffers, but keeps the tables.
+    void release();
+};
+
+// The three phases of LexerBackend as a reduce-then-scan over tiles of the input, one thread per
+// tile: the tile aggregates are composed on the host, so the transition of every byte is never
+// stored. Extract counts the tokens of every tile, scans the counts on the host, and has every tile
+// write its tokens to their place in the stream on the device, so only the tokens are copied back.
+// Profiles also hold the host-device copies, and the histogram of lex_cuda.
+class CudaLexer : public lexer::LexerBackend {
+    std::string_view input;
 
     std::vector<lexer::ParallelLexer::Transition> initial_states;
     std::vector<const lexer::Lexeme*> final_states;
@@ -42,20 +153,45 @@ class CudaLexer {
     lexer::ParallelLexer::Transition *merge_table;
     size_t num_states;
 
-    lexer::ParallelLexer::Transition *d_trans;
+    CudaWorkspace workspace;
+
+    size_t tile_size;
+    size_t num_tiles;
 
-    lexer::Lexeme **res;
-    bool *res_is_token;
+    bool utf8_validation;
+    std::optional<lexer::LexError> error;
+
+    void report_error(lexer::LexError::Type type, size_t offset);
 
     void map_trans();
     void compute_prefix();
 
-    void extract_results();
-    void print_token_table();
+    void extract_results(lexer::TokenStream &tokens);
+    void print_token_table(const lexer::TokenStream &tokens);
+
+    void run(std::string_view input, lexer::TokenStream &tokens);
 
 public:
-    CudaLexer(lexer::ParallelLexer &lexer);
+    CudaLexer(const lexer::ParallelLexer &lexer, bool utf8_validation = false);
+    ~CudaLexer();
+
+    CudaLexer(const CudaLexer &) = delete;
+    CudaLexer &operator=(const CudaLexer &) = delete;
+
     void lex_cuda(std::string input);
+
+    const char *name() const override;
+
+    // The tables stay on the device for the lifetime of the lexer, release only frees the buffers.
+    void reserve(size_t input_length) override;
+    void release() override;
+
+    void map(std::string_view input) override;
+    void scan() override;
+    void extract(lexer::TokenStream &tokens) override;
+
+    // The error with the lowest offset encountered during the last call to lex_cuda, if any.
+    std::optional<lexer::LexError> last_error() const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef _LEXER_BACKEND
+#define _LEXER_BACKEND
+
+#include <string_view>
+#include <cstddef>
+
+#include "lexer/token_stream.hpp"
+#include "instrumentation.hpp"
+
+namespace lexer
+{
+    // A parallel lexer in three phases: every input byte is mapped to the parallel state of its
+    // character, a prefix scan composes these states with the merge table, and the tokens are
+    // extracted where the composed states produce a lexeme. Each phase works on the results of the
+    // previous one, which the backend keeps in its own buffers, so the phases must be called in
+    // order. Backends are not thread safe.
+    class LexerBackend
+    {
+    protected:
+        Profile profile;
+
+    public:
+        virtual ~LexerBackend() = default;
+
+        virtual const char *name() const = 0;
+
+        // Allocates the buffers for inputs of up to `input_length` bytes ahead of time. Otherwise the
+        // phases allocate what they need.
+        virtual void reserve(size_t input_length) = 0;
+
+        // Frees the buffers.
+        virtual void release() = 0;
+
+        // The input must stay alive until extract returns. It may not be empty.
+        virtual void map(std::string_view input) = 0;
+        virtual void scan() = 0;
+
+        // Appends the tokens of the input to `tokens`, and reports the first error in it.
+        virtual void extract(TokenStream &tokens) = 0;
+
+        // Runs the three phases.
+        void lex(std::string_view input, TokenStream &tokens);
+
+        // The stages of the last call to lex. Empty unless built with LEXER_INSTRUMENTATION.
+        const Profile &last_profile() const;
+    };
+}
+
+#endif
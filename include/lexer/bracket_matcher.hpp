@@ -0,0 +1,59 @@
+#ifndef _LEXER_BRACKET_MATCHER
+#define _LEXER_BRACKET_MATCHER
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/token_stream.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    // Names of the lexemes which open and close a bracket, for example lbrace and rbrace in json.lex.
+    struct BracketPair
+    {
+        std::string open;
+        std::string close;
+    };
+
+    struct BracketMatches
+    {
+        constexpr const static size_t NO_MATCH = std::numeric_limits<size_t>::max();
+
+        // For every token, the index of the token holding the matching bracket. This is NO_MATCH
+        // for tokens which are not brackets, and for brackets which are unmatched or mismatched.
+        std::vector<size_t> partners;
+
+        // Index of the first bracket token which is unmatched or closes a bracket of another kind.
+        std::optional<size_t> first_error;
+
+        bool balanced() const;
+    };
+
+    // Matches the brackets in a token stream without walking it sequentially with a stack.
+    // The nesting depth of every bracket is computed with a prefix scan, after which the
+    // brackets are grouped by depth: within one depth, an opener is always directly followed
+    // by the closer that matches it.
+    class BracketMatcher
+    {
+        // Bracket kind of every lexeme, indexed by lexeme id. 0 is not a bracket, p + 1
+        // opens bracket pair p and -(p + 1) closes it.
+        std::vector<int32_t> kinds;
+        const LexicalGrammar *g;
+
+        int32_t kind(const Lexeme *lexeme) const;
+
+    public:
+        // Throws UnknownLexemeError if any of the names is not a lexeme of the grammar.
+        BracketMatcher(const LexicalGrammar *g, const std::vector<BracketPair> &pairs);
+
+        BracketMatches match(const TokenStream &tokens, ThreadPool &pool = ThreadPool::global()) const;
+    };
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _LEXER_DIRECT_LEXER
+#define _LEXER_DIRECT_LEXER
+
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/token_stream.hpp"
+
+namespace lexer
+{
+    struct Lexeme;
+    struct LexicalGrammar;
+
+    struct NoDirectLexerError : std::runtime_error
+    {
+        NoDirectLexerError(std::string_view name) : std::runtime_error("No direct-coded lexer was built for grammar '" + std::string(name) + "'") {}
+    };
+
+    // A lexer DFA compiled to C++ by generate_direct_lexer as part of the build. Every state is a
+    // labelled block which switches on the next byte and jumps to the next state, appending a token
+    // first on the transitions which produce one, so there are no tables to look up. The generated
+    // code refers to lexemes by id, and is given the lexemes of the grammar it was generated from.
+    struct DirectLexer
+    {
+        // Lexes input[0, n), which may not be empty, with lexeme id i at lexemes + i.
+        using LexFn = void (*)(const char *input, size_t n, TokenStream &tokens, const Lexeme *lexemes);
+
+        const char *name;
+        // content_hash of the grammar source, see lexer/grammar_registry.hpp.
+        uint64_t grammar_hash;
+        LexFn lex_fn;
+
+        // Appends the tokens of the input to `tokens`, like LexerInterpreter::lex. The grammar must
+        // be the one the lexer was generated from. UTF-8 is validated in a separate pass.
+        void lex(std::string_view input, const LexicalGrammar &g, TokenStream &tokens, bool utf8_validation = false) const;
+
+        // The generated lexers register themselves when the program starts.
+        struct Registration
+        {
+            Registration(const DirectLexer *lexer);
+        };
+
+        // The registered lexer generated from a grammar source with this hash, or nullptr.
+        static const DirectLexer *find(uint64_t grammar_hash);
+    };
+
+    // Writes C++ source which defines and registers a DirectLexer for the lexer DFA of g, as built
+    // by FiniteStateAutomaton::build_lexer_dfa.
+    void generate_direct_lexer(std::ostream &out, const LexicalGrammar *g, uint64_t grammar_hash, const std::string &name);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define _LEXER_FSA
 
 #include <vector>
+#include <unordered_map>
 #include <iosfwd>
 #include <optional>
 #include <limits>
@@ -18,24 +19,46 @@ namespace lexer {
 
         static constexpr const size_t MAX_SYM = std::numeric_limits<Symbol>::max();
 
+        // Symbol of epsilon-transitions, which is outside of the range of regular symbols.
+        static constexpr const uint16_t EPSILON = MAX_SYM + 1;
+
         static constexpr const StateIndex REJECT = 0;
         static constexpr const StateIndex START = 1;
 
         struct Transition {
             /**
-             * Symbol of Transition
+             * Symbol of Transition, or EPSILON.
              */
-            std::optional<uint8_t> maybe_sym;
+            uint16_t sym;
             StateIndex dst;
             bool produces_lexeme;
+
+            bool is_epsilon() const;
         };
 
-        struct State {
-            const Lexeme* lexeme;
-            std::vector<Transition> transitions;
+        struct TransitionRange {
+            const Transition* first;
+            const Transition* last;
+
+            const Transition* begin() const;
+            const Transition* end() const;
+            size_t size() const;
         };
 
-        std::vector<State> states;
+        struct PendingTransition {
+            StateIndex src;
+            Transition transition;
+        };
+
+        // Lexeme accepted in each state, or nullptr.
+        std::vector<const Lexeme*> lexemes;
+
+        // Transitions are stored in one contiguous array, grouped by source state: the transitions
+        // of state s are edges[offsets[s]] up to edges[offsets[s + 1]]. New transitions are appended
+        // to pending, and only become visible through transitions() after finalize().
+        std::vector<uint32_t> offsets;
+        std::vector<Transition> edges;
+        std::vector<PendingTransition> pending;
 
         FiniteStateAutomaton();
 
@@ -46,17 +69,32 @@ namespace lexer {
         void add_transition(StateIndex src, StateIndex dst, std::optional<uint8_t> sym, bool produces_lexeme = false);
         void add_epsilon_transition(StateIndex src, StateIndex dst, bool produces_lexeme = false);
 
-        std::optional<StateIndex> find_first_transition_dst(StateIndex src, std::optional<uint8_t> sym) const;
+        // Merges the pending transitions into the edge array. Transitions of a state keep the
+        // order in which they were added.
+        void finalize();
 
-        State& operator[](StateIndex state);
-        const State& operator[](StateIndex state) const;
+        TransitionRange transitions(StateIndex src) const;
 
-        void dump_dot(std::ostream& os) const;
+        std::optional<StateIndex> find_first_transition_dst(StateIndex src, std::optional<uint8_t> sym) const;
 
         void to_dfa(const LexicalGrammar* g, FiniteStateAutomaton& dfa, StateIndex nfa_start, StateIndex dfa_start) const;
 
+        struct LexerNfa;
+
+        // Thompson construction of the regexes of all lexemes in g, which is the first half of build_lexer_dfa.
+        static LexerNfa build_lexer_nfa(const LexicalGrammar* g);
+
         static FiniteStateAutomaton build_lexer_dfa(const LexicalGrammar* g);
+        static FiniteStateAutomaton build_lexer_dfa(const LexicalGrammar* g, const LexerNfa& lexer_nfa);
+    };
+
+    struct FiniteStateAutomaton::LexerNfa {
+        FiniteStateAutomaton nfa;
+
+        // For every lexeme which appears in a 'preceded by' list, the root state from which the
+        // lexemes that may follow it start. Lexemes without such a list start at START.
+        std::unordered_map<const Lexeme*, StateIndex> successor_roots;
     };
 }
 
-#endif
\ No newline at end of file
+#endif
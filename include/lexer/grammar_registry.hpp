@@ -0,0 +1,179 @@
+#ifndef _LEXER_GRAMMAR_REGISTRY
+#define _LEXER_GRAMMAR_REGISTRY
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <optional>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/parallel_lexer.hpp"
+#include "lexer/lazy_parallel_lexer.hpp"
+#include "lexer/interpreter.hpp"
+#include "lexer/backend.hpp"
+#include "lexer/host_lexer.hpp"
+#include "lexer/shuffle_lexer.hpp"
+#include "lexer/nfa_lexer.hpp"
+#include "lexer/direct_lexer.hpp"
+#include "lexer/jit_lexer.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    struct UnknownGrammarError : std::runtime_error
+    {
+        UnknownGrammarError(std::string_view name) : std::runtime_error("Unknown grammar '" + std::string(name) + "'") {}
+    };
+
+    struct GrammarConflictError : std::runtime_error
+    {
+        GrammarConflictError(std::string_view name) : std::runtime_error("Grammar '" + std::string(name) + "' is already registered differently") {}
+    };
+
+    // FNV-1a of a grammar source. Unlike std::hash it is the same across platforms and runs.
+    uint64_t content_hash(std::string_view source);
+
+    struct CompileOptions
+    {
+        // Compute merges on demand instead of generating the merge table, see LazyParallelLexer. The
+        // memory budget of a registry counts such a lexer as its cache and the states known when built.
+        bool lazy = false;
+        size_t merge_cache_bytes = LazyParallelLexer::DEFAULT_CACHE_BYTES;
+
+        // Typical input, by which the states of a generated merge table are laid out, see
+        // ParallelLexer::optimize_layout. A lazy lexer already numbers states in the order of use.
+        std::vector<std::string> layout_samples;
+
+        // Only build the bit-parallel NfaLexer, which needs neither the DFA nor the merge table.
+        bool nfa = false;
+
+        // Only look up the DirectLexer generated from the grammar at build time, and build nothing.
+        bool direct = false;
+
+        // Only compile the DFA to native code with JitLexer, where that is supported. Elsewhere the
+        // tables are built as without it, for the interpreter to fall back to.
+        bool jit = false;
+
+        // Only build what host_backend runs: if the DFA fits in state vectors just the ShuffleTable,
+        // whose merge table would never be read. Otherwise the tables are built as without it.
+        bool host = false;
+    };
+
+    // A grammar together with its generated parallel lexer. The lexer refers to the lexemes of the
+    // grammar, so a compiled lexer is never moved.
+    struct CompiledLexer
+    {
+        std::string name;
+        LexicalGrammar grammar;
+
+        // Exactly one of these is set, depending on CompileOptions::lazy, CompileOptions::nfa and
+        // CompileOptions::jit, unless CompileOptions::direct is set or CompileOptions::host is set
+        // and there is a shuffle_table.
+        std::optional<ParallelLexer> parallel_lexer;
+        std::optional<LazyParallelLexer> lazy_lexer;
+        std::optional<NfaLexer> nfa_lexer;
+        std::optional<JitLexer> jit_lexer;
+
+        // The lexer generated from the same source at build time, if any.
+        const DirectLexer *direct_lexer;
+
+        // Set when the DFA is small enough for state vectors, see ShuffleTable.
+        std::optional<ShuffleTable> shuffle_table;
+
+        // Throws the errors of parsing, validating and generating the lexer.
+        CompiledLexer(std::string name, std::string_view source, const CompileOptions &options = {});
+
+        CompiledLexer(const CompiledLexer &) = delete;
+        CompiledLexer &operator=(const CompiledLexer &) = delete;
+
+        // Not available for an NFA-only, direct-only, JIT-only or shuffle-only lexer.
+        LexerInterpreter interpreter(bool utf8_validation = false) const;
+
+        // The parallel engine on the threads of the pool: a ShuffleLexer if the DFA fits in state
+        // vectors, and otherwise a HostLexer on the merge table, which must then not be lazy.
+        std::unique_ptr<LexerBackend> host_backend(bool utf8_validation, ThreadPool &pool) const;
+
+        size_t memory_bytes() const;
+    };
+
+    // Grammars by name, compiled on first use and kept resident within a memory budget.
+    //
+    // Lookups of registered grammars do not take the registry mutex: the name table is an immutable
+    // snapshot which is replaced on registration, and the compiled lexer of every entry is an atomic
+    // shared pointer. That is not lock-free in libstdc++, which guards it with a short internal lock.
+    // Lexers are reference counted, so one that is evicted stays alive until its last user drops it;
+    // the least recently used ones are evicted when building another one exceeds the budget.
+    class GrammarRegistry
+    {
+        struct Entry
+        {
+            std::string name;
+            // Either the source itself, or the path it is read from when compiled.
+            std::string source;
+            bool is_path;
+
+            std::atomic<std::shared_ptr<const CompiledLexer>> compiled;
+            // Milliseconds of a steady clock, only written when that changed, so that concurrent
+            // lookups of one grammar do not keep writing the same cache line.
+            std::atomic<uint64_t> last_used;
+
+            // Serializes compiling, so that concurrent first users wait for one build.
+            std::mutex build_mutex;
+
+            // Guarded by the registry mutex.
+            size_t resident_bytes = 0;
+        };
+
+        using Table = std::map<std::string, Entry *, std::less<>>;
+
+        std::atomic<const Table *> table;
+
+        // Everything below is guarded by mutex. Replaced tables are kept until the registry is
+        // destroyed, as lookups may still be reading them; there is one per registration.
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Entry>> entries;
+        std::vector<std::unique_ptr<const Table>> tables;
+        size_t memory_budget;
+        CompileOptions compile_options;
+        size_t resident;
+
+        Entry *find(std::string_view name) const;
+        void add(std::string name, std::string source, bool is_path);
+        std::shared_ptr<const CompiledLexer> build(Entry *entry);
+        void evict_for(const Entry *keep);
+
+    public:
+        GrammarRegistry(size_t memory_budget = std::numeric_limits<size_t>::max(), const CompileOptions &compile_options = {});
+
+        GrammarRegistry(const GrammarRegistry &) = delete;
+        GrammarRegistry &operator=(const GrammarRegistry &) = delete;
+
+        // Registers a grammar which is read from `path` when it is first used. Registering the same
+        // name again is only allowed with the same path or source.
+        void add_file(std::string name, std::string path);
+        void add_source(std::string name, std::string source);
+
+        // Registers a grammar under a name derived from a hash of its source, and returns that name.
+        std::string add_content(std::string source);
+
+        bool contains(std::string_view name) const;
+        std::vector<std::string> names() const;
+
+        // Returns the compiled lexer, compiling it first if it is not resident. Throws UnknownGrammarError
+        // for names which were not registered, and the errors of compiling the grammar.
+        std::shared_ptr<const CompiledLexer> get(std::string_view name);
+
+        // Total memory of the resident lexers, not counting evicted ones which are still in use.
+        size_t resident_bytes();
+    };
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _LEXER_HOST_LEXER
+#define _LEXER_HOST_LEXER
+
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+
+#include "lexer/backend.hpp"
+#include "lexer/parallel_lexer.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/tile_set.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    // The three phases of CudaLexer on the threads of a pool, over tiles of the input: map composes
+    // the transitions of the bytes of every tile straight from the input, validating it as UTF-8 if
+    // asked to, scan composes the tile aggregates with parallel_inclusive_scan, and extract lexes
+    // every tile again starting from the composition of all tiles before it. The transition of
+    // every byte only lives in a register, so memory traffic is the input twice and the tokens.
+    class HostLexer : public LexerBackend
+    {
+        const ParallelLexer *lexer;
+        bool utf8_validation;
+        ThreadPool *pool;
+
+        std::string_view input;
+        std::optional<LexError> error;
+
+        // The composition of the transitions of every tile, and after the scan the composition of
+        // all tiles up to and including it.
+        std::vector<ParallelLexer::Transition> aggregates;
+        TileSet tiles;
+
+    public:
+        HostLexer(const ParallelLexer *lexer, bool utf8_validation = false, ThreadPool &pool = ThreadPool::global());
+
+        const char *name() const override;
+
+        void reserve(size_t input_length) override;
+        void release() override;
+
+        void map(std::string_view input) override;
+        void scan() override;
+        void extract(TokenStream &tokens) override;
+    };
+}
+
+#endif
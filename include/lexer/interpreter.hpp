@@ -2,26 +2,207 @@
 #define _LEXER_INTERPRETER
 
 #include <string_view>
-#include <unordered_map>
+#include <vector>
+#include <algorithm>
 
 #include "lexer/parallel_lexer.hpp"
+#include "lexer/lazy_parallel_lexer.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/token_sink.hpp"
+#include "instrumentation.hpp"
+#include "utf8.hpp"
 
 namespace lexer
 {
     struct LexerInterpreter
     {
+        // Exactly one of these is set.
         const ParallelLexer *lexer;
+        const LazyParallelLexer *lazy_lexer;
 
-        std::unordered_map<const lexer::Lexeme *, int> mp;
+        // Whether lex also validates that the input is UTF-8, reporting the first invalid byte as an error.
+        bool utf8_validation;
 
-        LexerInterpreter(const ParallelLexer *lexer);
+        // The state of an input that is lexed in consecutive blocks by lex_block.
+        struct Carry
+        {
+            // Bytes of the input lexed so far.
+            size_t offset = 0;
+            size_t token_begin = 0;
+            ParallelLexer::StateIndex state = 0;
+            bool invalid_utf8 = false;
+        };
 
-        void lex_linear(std::string_view input);
+        LexerInterpreter(const ParallelLexer *lexer, bool utf8_validation = false);
+        LexerInterpreter(const LazyParallelLexer *lexer, bool utf8_validation = false);
 
-        void add_token(const lexer::Lexeme *t);
+        // Lexes the input of grammar g, and prints the time taken and how many tokens of every
+        // lexeme it has.
+        void lex_linear(std::string_view input, const LexicalGrammar &g) const;
 
-        void print_token_table();
+        // Lex the input sequentially, passing every token to the sink as it is produced, see
+        // lexer/token_sink.hpp; a TokenStream appends them. UTF-8 validation is fused into the same
+        // pass: each block is validated right before it is lexed, while it is still in cache. If a
+        // profile is given, the pass is recorded in it as the "lex" stage.
+        template <typename Sink>
+        void lex(std::string_view input, Sink &sink, Profile *profile = nullptr) const;
+
+        // Lexes buffer[begin, end) as the next block of an input, passing on the tokens that end in it
+        // with offsets from the start of the input. For UTF-8 validation the buffer must hold the
+        // 2 * UTF8_BLOCK_SIZE bytes before begin, unless it is the first block, and reach past end
+        // unless it is the last; all blocks but the last must be a multiple of UTF8_BLOCK_SIZE bytes.
+        template <typename Sink>
+        void lex_block(Carry &carry, std::string_view buffer, size_t begin, size_t end, Sink &sink) const;
+
+        // Passes on the last token of an input lexed by lex_block.
+        template <typename Sink>
+        void finish(const Carry &carry, Sink &sink) const;
+
+    private:
+        // Input is lexed in blocks of this many bytes, each of which is validated as UTF-8 right
+        // before, so that the lexer reads it from L1 cache.
+        constexpr const static size_t BLOCK_SIZE = 64 * UTF8_BLOCK_SIZE;
+
+        // The tables of a ParallelLexer and a LazyParallelLexer behind the same interface, so that
+        // both get their own instantiation of the lexing loop.
+        struct EagerTables
+        {
+            const ParallelLexer *lexer;
+
+            ParallelLexer::Transition merge(ParallelLexer::StateIndex first, ParallelLexer::StateIndex second) const
+            {
+                return this->lexer->merge_table(first, second);
+            }
+
+            const Lexeme *final_state(ParallelLexer::StateIndex state) const
+            {
+                return this->lexer->final_states[state];
+            }
+        };
+
+        struct LazyTables
+        {
+            const LazyParallelLexer *lexer;
+
+            ParallelLexer::Transition merge(ParallelLexer::StateIndex first, ParallelLexer::StateIndex second) const
+            {
+                return this->lexer->merge(first, second);
+            }
+
+            const Lexeme *final_state(ParallelLexer::StateIndex state) const
+            {
+                return this->lexer->final_state(state);
+            }
+        };
+
+        // Lexes buffer[begin, end), the next bytes of an input after the carry.offset bytes before
+        // it, and returns the number of tokens passed on.
+        template <typename Tables, typename Sink>
+        static size_t lex_range(const Tables &tables, const std::vector<ParallelLexer::Transition> &initial_states, bool utf8_validation,
+                                std::string_view buffer, size_t begin, size_t end, Carry &carry, Sink &sink);
+
+        template <typename Tables, typename Sink>
+        static void finish_input(const Tables &tables, const Carry &carry, Sink &sink);
     };
+
+    template <typename Sink>
+    void LexerInterpreter::lex(std::string_view input, Sink &sink, Profile *profile) const
+    {
+        if (input.empty())
+            return;
+
+        // Validation is fused into the scan per block, so the whole pass is one stage.
+        StageTimer timer(profile, "lex", input.size());
+
+        auto carry = Carry();
+        size_t count;
+        if (this->lazy_lexer)
+            count = lex_range(LazyTables{this->lazy_lexer}, this->lazy_lexer->initial_states, this->utf8_validation, input, 0, input.size(), carry, sink);
+        else
+            count = lex_range(EagerTables{this->lexer}, this->lexer->initial_states, this->utf8_validation, input, 0, input.size(), carry, sink);
+        this->finish(carry, sink);
+
+        timer.add_count(count + 1);
+    }
+
+    template <typename Sink>
+    void LexerInterpreter::lex_block(Carry &carry, std::string_view buffer, size_t begin, size_t end, Sink &sink) const
+    {
+        if (this->lazy_lexer)
+            lex_range(LazyTables{this->lazy_lexer}, this->lazy_lexer->initial_states, this->utf8_validation, buffer, begin, end, carry, sink);
+        else
+            lex_range(EagerTables{this->lexer}, this->lexer->initial_states, this->utf8_validation, buffer, begin, end, carry, sink);
+    }
+
+    template <typename Sink>
+    void LexerInterpreter::finish(const Carry &carry, Sink &sink) const
+    {
+        if (this->lazy_lexer)
+            finish_input(LazyTables{this->lazy_lexer}, carry, sink);
+        else
+            finish_input(EagerTables{this->lexer}, carry, sink);
+    }
+
+    template <typename Tables, typename Sink>
+    size_t LexerInterpreter::lex_range(const Tables &tables, const std::vector<ParallelLexer::Transition> &initial_states, bool utf8_validation,
+                                       std::string_view buffer, size_t begin, size_t end, Carry &carry, Sink &sink)
+    {
+        if (begin == end)
+            return 0;
+
+        // Offsets in the buffer to offsets in the input.
+        auto base = carry.offset - begin;
+        auto state = carry.state;
+        auto token_begin = carry.token_begin;
+        size_t count = 0;
+
+        auto first = begin;
+        if (carry.offset == 0)
+        {
+            state = initial_states[static_cast<uint8_t>(buffer[begin])].result_state;
+            ++first;
+        }
+
+        for (size_t block = begin; block < end; block += BLOCK_SIZE)
+        {
+            auto block_end = std::min(end, block + BLOCK_SIZE);
+
+            // Stop validating after the first error, only the first one is reported.
+            if (utf8_validation && !carry.invalid_utf8)
+            {
+                if (auto offset = find_utf8_error(buffer, block, block_end))
+                {
+                    sink.on_error(LexError::Type::INVALID_UTF8, base + offset.value());
+                    carry.invalid_utf8 = true;
+                }
+            }
+
+            for (size_t i = std::max(block, first); i < block_end; ++i)
+            {
+                auto prev = state;
+                auto next = tables.merge(prev, initial_states[static_cast<uint8_t>(buffer[i])].result_state);
+                state = next.result_state;
+                if (next.produces_lexeme)
+                {
+                    sink.on_token(tables.final_state(prev), token_begin, base + i);
+                    token_begin = base + i;
+                    ++count;
+                }
+            }
+        }
+
+        carry.offset += end - begin;
+        carry.state = state;
+        carry.token_begin = token_begin;
+        return count;
+    }
+
+    template <typename Tables, typename Sink>
+    void LexerInterpreter::finish_input(const Tables &tables, const Carry &carry, Sink &sink)
+    {
+        if (carry.offset > 0)
+            sink.on_token(tables.final_state(carry.state), carry.token_begin, carry.offset);
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
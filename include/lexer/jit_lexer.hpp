@@ -0,0 +1,81 @@
+#ifndef _LEXER_JIT_LEXER
+#define _LEXER_JIT_LEXER
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/fsa.hpp"
+#include "lexer/token_stream.hpp"
+#include "instrumentation.hpp"
+
+namespace lexer
+{
+    struct JitUnavailableError : std::runtime_error
+    {
+        JitUnavailableError(const std::string &reason) : std::runtime_error("Cannot compile the lexer to native code: " + reason) {}
+    };
+
+    // The lexer DFA compiled to x86-64 machine code when the grammar is loaded, in a buffer which is
+    // mapped executable once written. Like a DirectLexer, every state is a block of code which
+    // compares the next byte against the byte ranges of its transitions and jumps straight to the
+    // block of the next state, but it is generated at runtime instead of at build time. A state with
+    // a transition to itself first skips the bytes of that transition 16 at a time with SSE2. Tokens
+    // are written to the arrays of the token stream directly.
+    //
+    // Only available on x86-64 with the System V calling convention, see supported(). Elsewhere the
+    // caller falls back to the table interpreter.
+    class JitLexer
+    {
+    public:
+        // Passed to the generated code, which resumes lexing from here and writes it back when it
+        // returns, either at the end of the input, in REJECT or when the token arrays are full.
+        struct Context
+        {
+            const char *input;
+            size_t pos;
+            size_t end;
+            size_t state;
+            size_t token_begin;
+            size_t *begins;
+            size_t *ends;
+            const Lexeme **lexemes;
+            // ends + capacity of the token arrays.
+            size_t *ends_limit;
+        };
+
+    private:
+        using StateIndex = FiniteStateAutomaton::StateIndex;
+        using LexFn = void (*)(Context *);
+
+        void *code;
+        size_t code_size;
+        LexFn lex_fn;
+
+        // The state after the first byte, as transitions from START do not produce tokens, and the
+        // lexeme of every state for the last token.
+        StateIndex first_states[FiniteStateAutomaton::MAX_SYM + 1];
+        std::vector<const Lexeme *> state_lexemes;
+
+    public:
+        static bool supported();
+
+        // Throws JitUnavailableError if the code cannot be generated or mapped on this platform.
+        JitLexer(const FiniteStateAutomaton &dfa);
+        ~JitLexer();
+
+        JitLexer(const JitLexer &) = delete;
+        JitLexer &operator=(const JitLexer &) = delete;
+
+        // Appends the tokens of the input to `tokens`, like LexerInterpreter::lex. UTF-8 is validated
+        // in a separate pass, which is recorded in the profile as part of the "lex" stage.
+        void lex(std::string_view input, TokenStream &tokens, bool utf8_validation = false, Profile *profile = nullptr) const;
+
+        size_t memory_bytes() const;
+    };
+}
+
+#endif
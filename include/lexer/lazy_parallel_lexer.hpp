@@ -0,0 +1,107 @@
+#ifndef _LEXER_LAZY_PARALLEL_LEXER
+#define _LEXER_LAZY_PARALLEL_LEXER
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+#include "lexer/fsa.hpp"
+#include "lexer/parallel_lexer.hpp"
+
+namespace lexer
+{
+    // Parallel lexer which does not generate the merge table. Only the initial states are computed
+    // up front; a merge is computed from the transition vectors of its two parallel states when it
+    // is first needed, and remembered in a cache of bounded size. Parallel states are numbered in
+    // the order they are discovered, so only the states that the lexed input actually reaches are
+    // ever stored.
+    //
+    // This trades a cache lookup per merge for being able to use grammars whose full merge table
+    // would not fit in memory. Merges may be looked up from any number of threads at once: cache
+    // hits take no lock, misses lock only to add a newly discovered state.
+    class LazyParallelLexer
+    {
+    public:
+        using StateIndex = ParallelLexer::StateIndex;
+        using Transition = ParallelLexer::Transition;
+
+        constexpr const static StateIndex REJECT = ParallelLexer::REJECT;
+        constexpr const static StateIndex START = ParallelLexer::START;
+
+        constexpr const static size_t DEFAULT_CACHE_BYTES = size_t{64} << 20;
+
+    private:
+        // States are stored in chunks which never move, so that they can be read while others are added.
+        constexpr const static size_t CHUNK_STATES = 256;
+        constexpr const static size_t MAX_CHUNKS = (size_t{std::numeric_limits<StateIndex>::max()} + 1) / CHUNK_STATES;
+
+        // Entries of a cache set, which is replaced in clock order: entries that were hit since the
+        // hand last passed them get a second chance.
+        constexpr const static size_t CACHE_WAYS = 4;
+
+        struct Chunk
+        {
+            // The transitions of every DFA state, for every state of the chunk.
+            std::unique_ptr<Transition[]> transitions;
+            std::array<const Lexeme*, CHUNK_STATES> final_states;
+        };
+
+        size_t dfa_states;
+        std::vector<const Lexeme*> dfa_lexemes;
+
+        mutable std::array<std::atomic<Chunk*>, MAX_CHUNKS> chunks;
+        mutable std::atomic<size_t> num_states;
+
+        // Guarded by mutex: the chunks, and the states by the hash of their transitions.
+        mutable std::mutex mutex;
+        mutable std::vector<std::unique_ptr<Chunk>> owned_chunks;
+        mutable std::unordered_multimap<size_t, StateIndex> state_index;
+
+        // Every entry packs both operands and the result of a merge, so it is read and written atomically.
+        std::unique_ptr<std::atomic<uint64_t>[]> cache;
+        size_t cache_sets;
+        mutable std::atomic<size_t> cache_misses;
+
+        const Transition* state_transitions(StateIndex state) const;
+
+        // Returns the index of the parallel state with these transitions, adding it if it is new.
+        StateIndex intern(const Transition* transitions) const;
+
+        Transition compute_merge(StateIndex first, StateIndex second) const;
+
+    public:
+        std::vector<Transition> initial_states;
+
+        StateIndex identity_state_index;
+
+        LazyParallelLexer(const LexicalGrammar* g, size_t cache_bytes = DEFAULT_CACHE_BYTES);
+        LazyParallelLexer(const FiniteStateAutomaton& dfa, size_t cache_bytes = DEFAULT_CACHE_BYTES);
+
+        LazyParallelLexer(const LazyParallelLexer&) = delete;
+        LazyParallelLexer& operator=(const LazyParallelLexer&) = delete;
+
+        // The equivalent of ParallelLexer::merge_table(first, second). Throws TooManyParallelStatesError
+        // if the merge discovers more states than StateIndex can represent.
+        Transition merge(StateIndex first, StateIndex second) const;
+
+        // The equivalent of ParallelLexer::final_states[state].
+        const Lexeme* final_state(StateIndex state) const;
+
+        // Parallel states discovered so far.
+        size_t states() const;
+
+        // Number of merges which were not found in the cache.
+        size_t misses() const;
+
+        // Memory held by the states and the cache.
+        size_t memory_bytes() const;
+    };
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include "parser.hpp"
 #include "lexer/lexical_grammar.hpp"
 #include "lexer/regex.hpp"
+#include "arena.hpp"
 
 namespace lexer {
     struct LexerParseError: std::runtime_error {
@@ -25,6 +26,7 @@ namespace lexer {
 
         Parser* parser;
 
+        Arena arena;
         std::vector<Lexeme> lexemes;
         std::unordered_map<std::string_view, LexemeDefinition> lexeme_definitions;
 
@@ -2,11 +2,13 @@
 #define _LEXER_LEXICAL_GRAMMAR
 
 #include <string>
+#include <string_view>
 #include <stdexcept>
 
 #include "lexer/fsa.hpp"
 #include "lexer/regex.hpp"
 #include "token_mapping.hpp"
+#include "arena.hpp"
 
 namespace lexer
 {
@@ -15,10 +17,15 @@ namespace lexer
         LexemeMatchesEmptyError() : std::runtime_error("Lexeme matches the empty string") {}
     };
 
+    struct UnknownLexemeError : std::runtime_error
+    {
+        UnknownLexemeError(std::string_view name) : std::runtime_error("Unknown lexeme '" + std::string(name) + "'") {}
+    };
+
     struct Lexeme
     {
         std::string name;
-        UniqueRegexNode regex;
+        RegexNodePtr regex;
         std::vector<const Lexeme *> preceded_by;
 
         Token as_token() const;
@@ -28,8 +35,14 @@ namespace lexer
     {
         std::vector<Lexeme> lexemes;
 
+        // Backing storage of the regexes of all lexemes.
+        Arena regex_arena;
+
         size_t lexeme_id(const Lexeme *lexeme) const;
 
+        // Returns nullptr if there is no lexeme with this name.
+        const Lexeme *find_lexeme(std::string_view name) const;
+
         void add_tokens(TokenMapping &tm) const;
 
         void validate() const;
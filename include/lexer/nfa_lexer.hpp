@@ -0,0 +1,253 @@
+#ifndef _LEXER_NFA_LEXER
+#define _LEXER_NFA_LEXER
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/fsa.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/token_sink.hpp"
+#include "instrumentation.hpp"
+#include "utf8.hpp"
+
+namespace lexer
+{
+    struct TooManyNfaStatesError : std::runtime_error
+    {
+        TooManyNfaStatesError() : std::runtime_error("Too many NFA states for the bit-parallel lexer") {}
+    };
+
+    // Lexes by simulating the Thompson NFA of the grammar directly, with the set of active states as a
+    // bit mask of one or more 64-bit words, so that neither the DFA nor the merge table is built.
+    //
+    // Every state of the NFA is the source of the transitions of at most one character or character
+    // set, which all go to the same fresh state, so these transitions form disjoint chains. Numbering
+    // the states along the chains makes every such transition go from state i to state i + 1, and a
+    // step over a byte a shift-and: the active states which have a transition on the byte, shifted by
+    // one, followed by the epsilon closure of the states which have epsilon transitions.
+    //
+    // Tokens are produced as by the lexer DFA of build_lexer_dfa: when no state survives a byte, the
+    // token ends before it with the lexeme of the lowest id that the active states accept, and the
+    // next one starts over from its successor root or from START.
+    struct NfaLexer
+    {
+        using StateIndex = FiniteStateAutomaton::StateIndex;
+
+        constexpr const static size_t WORD_BITS = 64;
+        constexpr const static size_t MAX_WORDS = 16;
+        constexpr const static size_t MAX_STATES = MAX_WORDS * WORD_BITS;
+
+        size_t num_states;
+        // Words per state set, rounded up to a power of two.
+        size_t words;
+
+        // For every byte, the states which have a transition on it.
+        std::vector<uint64_t> symbol_masks;
+
+        // For every state, the states reachable from it over epsilon transitions, itself included.
+        // Only used for the states in has_epsilon.
+        std::vector<uint64_t> closures;
+        std::vector<uint64_t> has_epsilon;
+
+        // The id of the lexeme that every accepting state accepts, and the lexemes by id. Of several
+        // accepted lexemes the one of the lowest id wins, as in FiniteStateAutomaton::to_dfa.
+        std::vector<uint64_t> accepting;
+        std::vector<size_t> lexeme_ids;
+        std::vector<const Lexeme *> lexemes;
+
+        // The closures of START and of the successor roots, and for every lexeme id the root that the
+        // token after it starts from, as an index in roots. Root 0 is START.
+        std::vector<uint64_t> roots;
+        std::vector<size_t> successor_root;
+
+        // Throws TooManyNfaStatesError if the NFA of the grammar has more than MAX_STATES states.
+        NfaLexer(const LexicalGrammar *g);
+
+        // Lexes the input sequentially, passing every token to the sink as it is produced, see
+        // lexer/token_sink.hpp. Validates the input as UTF-8 if asked to, like LexerInterpreter::lex,
+        // and records the pass in the profile as the "lex" stage.
+        template <typename Sink>
+        void lex(std::string_view input, Sink &sink, bool utf8_validation = false, Profile *profile = nullptr) const;
+
+        size_t memory_bytes() const;
+
+    private:
+        constexpr const static size_t NO_LEXEME = std::numeric_limits<size_t>::max();
+
+        // As in LexerInterpreter::lex.
+        constexpr const static size_t BLOCK_SIZE = 64 * UTF8_BLOCK_SIZE;
+
+        template <size_t WORDS>
+        struct StateSet
+        {
+            uint64_t bits[WORDS];
+
+            static StateSet load(const uint64_t *p)
+            {
+                auto set = StateSet();
+                std::copy(p, p + WORDS, set.bits);
+                return set;
+            }
+
+            bool any() const
+            {
+                uint64_t any = 0;
+                for (size_t w = 0; w < WORDS; ++w)
+                    any |= this->bits[w];
+                return any != 0;
+            }
+        };
+
+        // The lexing loop for state sets of WORDS words.
+        template <size_t WORDS>
+        struct Simulation
+        {
+            using Set = StateSet<WORDS>;
+
+            const NfaLexer &lexer;
+
+            // The active states which have a transition on c, moved over it.
+            Set move(const Set &set, uint8_t c) const
+            {
+                const auto *mask = &this->lexer.symbol_masks[c * WORDS];
+                auto result = Set();
+                uint64_t carry = 0;
+                for (size_t w = 0; w < WORDS; ++w)
+                {
+                    auto moving = set.bits[w] & mask[w];
+                    result.bits[w] = (moving << 1) | carry;
+                    carry = moving >> (WORD_BITS - 1);
+                }
+                return result;
+            }
+
+            Set closure(const Set &set) const
+            {
+                auto result = set;
+                for (size_t w = 0; w < WORDS; ++w)
+                {
+                    auto pending = set.bits[w] & this->lexer.has_epsilon[w];
+                    while (pending)
+                    {
+                        auto state = w * WORD_BITS + __builtin_ctzll(pending);
+                        pending &= pending - 1;
+
+                        const auto *reachable = &this->lexer.closures[state * WORDS];
+                        for (size_t v = 0; v < WORDS; ++v)
+                            result.bits[v] |= reachable[v];
+                    }
+                }
+                return result;
+            }
+
+            Set start(size_t root, uint8_t c) const
+            {
+                return this->closure(this->move(Set::load(&this->lexer.roots[root * WORDS]), c));
+            }
+
+            // The id of the accepted lexeme, which is the lowest, or NO_LEXEME.
+            size_t accepted(const Set &set) const
+            {
+                auto best = NO_LEXEME;
+                for (size_t w = 0; w < WORDS; ++w)
+                {
+                    auto pending = set.bits[w] & this->lexer.accepting[w];
+                    while (pending)
+                    {
+                        auto state = w * WORD_BITS + __builtin_ctzll(pending);
+                        pending &= pending - 1;
+                        best = std::min(best, this->lexer.lexeme_ids[state]);
+                    }
+                }
+                return best;
+            }
+
+            const Lexeme *lexeme(size_t id) const
+            {
+                return id == NO_LEXEME ? nullptr : this->lexer.lexemes[id];
+            }
+
+            // Returns the number of tokens passed on.
+            template <typename Sink>
+            size_t lex(std::string_view input, Sink &sink, bool utf8_validation) const
+            {
+                size_t token_begin = 0;
+                size_t count = 1;
+                auto state = this->start(0, static_cast<uint8_t>(input[0]));
+                bool invalid_utf8 = false;
+
+                for (size_t block = 0; block < input.size(); block += BLOCK_SIZE)
+                {
+                    auto block_end = std::min(input.size(), block + BLOCK_SIZE);
+
+                    if (utf8_validation && !invalid_utf8)
+                    {
+                        if (auto offset = find_utf8_error(input, block, block_end))
+                        {
+                            sink.on_error(LexError::Type::INVALID_UTF8, offset.value());
+                            invalid_utf8 = true;
+                        }
+                    }
+
+                    for (size_t i = std::max(block, size_t{1}); i < block_end; ++i)
+                    {
+                        auto c = static_cast<uint8_t>(input[i]);
+                        auto next = this->move(state, c);
+                        if (next.any())
+                        {
+                            state = this->closure(next);
+                            continue;
+                        }
+
+                        // Without an accepted lexeme no state stays active, and the rest of the input
+                        // is rejected as the last token.
+                        auto id = this->accepted(state);
+                        state = next;
+                        if (id == NO_LEXEME)
+                            continue;
+
+                        sink.on_token(this->lexeme(id), token_begin, i);
+                        token_begin = i;
+                        ++count;
+
+                        auto root = this->lexer.successor_root[id];
+                        state = this->start(root, c);
+                        if (root != 0 && !state.any())
+                            state = this->start(0, c);
+                    }
+                }
+
+                sink.on_token(this->lexeme(this->accepted(state)), token_begin, input.size());
+                return count;
+            }
+        };
+    };
+
+    template <typename Sink>
+    void NfaLexer::lex(std::string_view input, Sink &sink, bool utf8_validation, Profile *profile) const
+    {
+        if (input.empty())
+            return;
+
+        StageTimer timer(profile, "lex", input.size());
+
+        size_t count = 0;
+        switch (this->words)
+        {
+        case 1: count = Simulation<1>{*this}.lex(input, sink, utf8_validation); break;
+        case 2: count = Simulation<2>{*this}.lex(input, sink, utf8_validation); break;
+        case 4: count = Simulation<4>{*this}.lex(input, sink, utf8_validation); break;
+        case 8: count = Simulation<8>{*this}.lex(input, sink, utf8_validation); break;
+        case 16: count = Simulation<16>{*this}.lex(input, sink, utf8_validation); break;
+        }
+
+        timer.add_count(count);
+    }
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _LEXER_NUMBER_EXTRACTOR
+#define _LEXER_NUMBER_EXTRACTOR
+
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/token_stream.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    struct ParsedNumber
+    {
+        double value;
+        // Only valid if is_integer is set, which is the case for numbers without fraction or
+        // exponent that fit in an int64_t.
+        int64_t integer;
+        bool is_integer;
+    };
+
+    // Parses a decimal number in JSON syntax: -?[0-9]+(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    // Conversion to double is exactly rounded.
+    std::optional<ParsedNumber> parse_number(std::string_view text);
+
+    // Typed column holding the values of all tokens of one lexeme, in input order.
+    struct NumberColumn
+    {
+        // Index of every token of the lexeme in the token stream.
+        std::vector<size_t> tokens;
+        std::vector<double> values;
+        std::vector<int64_t> integers;
+        std::vector<uint8_t> is_integer;
+
+        // Index in the token stream of the first token which is not a valid number. Its value is NaN.
+        std::optional<size_t> first_error;
+
+        size_t size() const;
+    };
+
+    // Post-lex stage which converts every token of a number lexeme into its value, in parallel over
+    // the token stream. As token bounds are already known, no separate scan over the input is needed.
+    class NumberExtractor
+    {
+        const Lexeme *lexeme;
+
+    public:
+        // Throws UnknownLexemeError if the grammar has no lexeme of this name.
+        NumberExtractor(const LexicalGrammar *g, std::string_view lexeme_name);
+
+        NumberColumn extract(std::string_view input, const TokenStream &tokens, ThreadPool &pool = ThreadPool::global()) const;
+    };
+}
+
+#endif
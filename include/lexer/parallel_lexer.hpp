@@ -1,12 +1,21 @@
 #ifndef _LEXER_PARALLEL_LEXER
 #define _LEXER_PARALLEL_LEXER
 
+#include <functional>
 #include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
 #include "lexer/fsa.hpp"
 
 namespace lexer
 {
+    struct TooManyParallelStatesError : std::runtime_error
+    {
+        TooManyParallelStatesError() : std::runtime_error("Too many parallel states") {}
+    };
+
     struct ParallelLexer
     {
         using StateIndex = FiniteStateAutomaton::StateIndex;
@@ -37,12 +46,19 @@ namespace lexer
 
             void resize(size_t num_states);
 
+            // Moves the table to an allocation with room for exactly `capacity` states. A capacity which
+            // is not a power of two also keeps the columns from mapping to the same cache sets.
+            void reallocate(size_t capacity);
+
             size_t index(StateIndex first, StateIndex second) const;
 
             Transition &operator()(StateIndex first, StateIndex second);
             const Transition &operator()(StateIndex first, StateIndex second) const;
 
             size_t states() const;
+
+            // Size of the allocated table, which may have room for more states.
+            size_t bytes() const;
         };
 
         std::vector<Transition> initial_states;
@@ -53,9 +69,41 @@ namespace lexer
 
         StateIndex identity_state_index;
 
+        // Time spent in the phases of generating a parallel lexer from a DFA, and their results.
+        struct GenerationStats
+        {
+            // Parallel states of the single symbols, plus the identity.
+            double parallel_states_seconds = 0;
+            size_t initial_parallel_states = 0;
+
+            // Called when the parallel states of the single symbols are done, before the merge
+            // table is filled in, so that a caller can split its own measurements between the phases.
+            std::function<void()> on_parallel_states_done;
+
+            // Closure of the parallel states under merging, which fills in the merge table.
+            double merge_table_seconds = 0;
+            size_t parallel_states = 0;
+            size_t merge_table_bytes = 0;
+        };
+
         ParallelLexer(const LexicalGrammar* g);
+        ParallelLexer(const FiniteStateAutomaton& dfa, GenerationStats* stats = nullptr);
 
         void dump_sizes(std::ostream& out) const;
+
+        // How often every parallel state is an operand of a merge when lexing the samples sequentially.
+        std::vector<size_t> state_frequencies(const std::vector<std::string_view>& samples) const;
+
+        // Renumbers the parallel states so that `order[i]` becomes state i, permuting all tables.
+        void renumber(const std::vector<StateIndex>& order);
+
+        // Renumbers the parallel states by descending frequency on the samples, so that the merges
+        // of typical input fall in a small block in the corner of the merge table, and share cache
+        // lines. States which the samples do not use keep their relative order.
+        void optimize_layout(const std::vector<std::string_view>& samples);
+
+        // Memory held by the tables of this lexer.
+        size_t memory_bytes() const;
     };
 }
 
@@ -0,0 +1,87 @@
+#ifndef _LEXER_PIPELINE
+#define _LEXER_PIPELINE
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <cstddef>
+
+#include "lexer/interpreter.hpp"
+#include "lexer/token_stream.hpp"
+#include "bounded_queue.hpp"
+
+namespace lexer
+{
+    struct PipelineError : std::runtime_error
+    {
+        PipelineError(const std::string &what) : std::runtime_error(what) {}
+    };
+
+    // Lexes a file in blocks, in three stages that run at the same time: a reader thread reads the
+    // next block while the calling thread lexes the current one, carrying the state of the lexer
+    // from block to block, and an emitter thread hands the tokens of the previous one to a callback.
+    // The stages pass a fixed number of buffers around through bounded queues, so memory use only
+    // depends on the block size, not on the size of the file.
+    class LexPipeline
+    {
+    public:
+        struct Options
+        {
+            // Rounded up to a multiple of UTF8_BLOCK_SIZE.
+            size_t block_size = size_t{1} << 20;
+            // Blocks in flight between the stages, at least 2.
+            size_t buffers = 3;
+        };
+
+        // How long a stage spent working, as opposed to waiting for the stages next to it.
+        struct StageUtilization
+        {
+            const char *stage;
+            double busy_seconds;
+            // Busy time over the time of the whole run.
+            double utilization;
+        };
+
+        struct Result
+        {
+            size_t bytes = 0;
+            size_t tokens = 0;
+            std::optional<LexError> error;
+            double seconds = 0;
+            // Of the read, lex and emit stages, in that order.
+            std::vector<StageUtilization> stages;
+        };
+
+        // Called with the tokens of every block in order, with offsets from the start of the file.
+        // Errors are reported in the result rather than in the tokens.
+        using Emit = std::function<void(const TokenStream &tokens)>;
+
+    private:
+        // The block is data[begin, end). Before begin the buffer holds the end of the block before,
+        // and after end the start of the block after, as LexerInterpreter::lex_block needs them.
+        struct Block
+        {
+            std::unique_ptr<char[]> data;
+            size_t size;
+            size_t begin;
+            size_t end;
+            bool last;
+            TokenStream tokens;
+        };
+
+        const LexerInterpreter *interpreter;
+        Options options;
+
+    public:
+        LexPipeline(const LexerInterpreter *interpreter, const Options &options);
+
+        // Throws PipelineError if the file cannot be read. Exceptions thrown by a stage stop the
+        // pipeline and are rethrown.
+        Result run(const std::string &path, const Emit &emit) const;
+    };
+}
+
+#endif
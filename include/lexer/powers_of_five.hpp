@@ -0,0 +1,17 @@
+#ifndef _LEXER_POWERS_OF_FIVE
+#define _LEXER_POWERS_OF_FIVE
+
+#include <cstdint>
+
+namespace lexer
+{
+    constexpr const int SMALLEST_POWER_OF_TEN = -342;
+    constexpr const int LARGEST_POWER_OF_TEN = 308;
+
+    // 128-bit approximations of 5^q for q in [SMALLEST_POWER_OF_TEN, LARGEST_POWER_OF_TEN], normalized so
+    // that the most significant bit is set. Entry q is stored as the high word followed by the low word
+    // at index 2 * (q - SMALLEST_POWER_OF_TEN).
+    extern const uint64_t POWERS_OF_FIVE_128[2 * (LARGEST_POWER_OF_TEN - SMALLEST_POWER_OF_TEN + 1)];
+}
+
+#endif
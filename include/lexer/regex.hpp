@@ -2,13 +2,15 @@
 #define _LEXER_REGEX
 
 #include <iosfwd>
-#include <memory>
 
 #include "lexer/fsa.hpp"
 #include "lexer/char_range.hpp"
+#include "arena.hpp"
 
 namespace lexer
 {
+    // Regex nodes are allocated in an arena owned by the grammar, and are never destructed.
+    // Children are arena arrays too, so that nodes stay trivially destructible.
     struct RegexNode
     {
         using StateIndex = FiniteStateAutomaton::StateIndex;
@@ -16,17 +18,15 @@ namespace lexer
         virtual void print(std::ostream &os) const = 0;
         virtual StateIndex compile(FiniteStateAutomaton &fsa, StateIndex start) const = 0;
         virtual bool matches_empty() const = 0;
-
-        virtual ~RegexNode() = default;
     };
 
-    using UniqueRegexNode = std::unique_ptr<RegexNode>;
+    using RegexNodePtr = const RegexNode *;
 
     struct SequenceNode : public RegexNode
     {
-        std::vector<UniqueRegexNode> children;
+        ArenaSpan<RegexNodePtr> children;
 
-        SequenceNode(std::vector<UniqueRegexNode> &&children) : children(std::move(children)) {}
+        SequenceNode(ArenaSpan<RegexNodePtr> children) : children(children) {}
 
         void print(std::ostream &os) const override;
         StateIndex compile(FiniteStateAutomaton &fsa, StateIndex start) const override;
@@ -35,9 +35,9 @@ namespace lexer
 
     struct AlternationNode : public RegexNode
     {
-        std::vector<UniqueRegexNode> children;
+        ArenaSpan<RegexNodePtr> children;
 
-        AlternationNode(std::vector<UniqueRegexNode> &&children) : children(std::move(children)) {}
+        AlternationNode(ArenaSpan<RegexNodePtr> children) : children(children) {}
 
         void print(std::ostream &os) const override;
         StateIndex compile(FiniteStateAutomaton &fsa, StateIndex start) const override;
@@ -54,9 +54,9 @@ namespace lexer
     struct RepeatNode : public RegexNode
     {
         RepeatType repeat_type;
-        UniqueRegexNode child;
+        RegexNodePtr child;
 
-        RepeatNode(RepeatType repeat_type, UniqueRegexNode &&child) : repeat_type(repeat_type), child(std::move(child)) {}
+        RepeatNode(RepeatType repeat_type, RegexNodePtr child) : repeat_type(repeat_type), child(child) {}
 
         void print(std::ostream &os) const override;
         StateIndex compile(FiniteStateAutomaton &fsa, StateIndex start) const override;
@@ -65,10 +65,10 @@ namespace lexer
 
     struct CharSetNode : public RegexNode
     {
-        std::vector<CharRange> ranges;
+        ArenaSpan<CharRange> ranges;
         bool inverted;
 
-        CharSetNode(std::vector<CharRange> &&ranges, bool inverted) : ranges(std::move(ranges)), inverted(inverted) {}
+        CharSetNode(ArenaSpan<CharRange> ranges, bool inverted) : ranges(ranges), inverted(inverted) {}
 
         void print(std::ostream &os) const override;
         StateIndex compile(FiniteStateAutomaton &fsa, StateIndex start) const override;
@@ -14,17 +14,19 @@ namespace lexer
     class RegexParser
     {
         Parser *parser;
+        Arena *arena;
 
     public:
-        RegexParser(Parser *parser);
-        UniqueRegexNode parse();
+        // Nodes of the parsed regex are allocated in arena.
+        RegexParser(Parser *parser, Arena *arena);
+        RegexNodePtr parse();
 
     private:
-        UniqueRegexNode alternation();
-        UniqueRegexNode sequence();
-        UniqueRegexNode maybe_repeat();
-        UniqueRegexNode maybe_atom();
-        UniqueRegexNode group();
+        RegexNodePtr alternation();
+        RegexNodePtr sequence();
+        RegexNodePtr maybe_repeat();
+        RegexNodePtr maybe_atom();
+        RegexNodePtr group();
         uint8_t escaped_char();
     };
 }
\ No newline at end of file
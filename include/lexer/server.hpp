@@ -0,0 +1,199 @@
+#ifndef _LEXER_SERVER
+#define _LEXER_SERVER
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/grammar_registry.hpp"
+#include "lexer/token_stream.hpp"
+#include "thread_pool.hpp"
+
+// Protocol of the lexing service, over a Unix domain socket. Every message is a frame of a
+// fixed 16 byte header followed by `length` bytes of payload; all integers are little-endian.
+//
+//   Request:  u32 REQUEST_MAGIC, u32 RequestType, u64 length, payload
+//   Response: u32 RESPONSE_MAGIC, u32 ResponseStatus, u64 length, payload
+//
+// A LEX request carries the input as payload and is lexed with the default grammar of the server,
+// a LEX_GRAMMAR request selects the grammar with a u32 length and name in front of the input.
+// The response to either holds the tokens as structure of arrays:
+//
+//   u64 token count n, u32 error type (0 none, 1 rejected, 2 invalid UTF-8), u32 0, u64 error offset,
+//   u32 lexeme id[n], u32 0 if n is odd, u64 begin[n], u64 end[n]
+//
+// so that every array is 8 byte aligned relative to the payload. Lexeme ids index the lexemes of
+// the grammar, UINT32_MAX marks rejected input. A LEXEMES request has no payload, its response is
+// u32 count followed by a u32 length and the name of every lexeme; LEXEMES_GRAMMAR names the
+// grammar in its payload like LEX_GRAMMAR.
+//
+// Requests may be pipelined: responses are sent in the order of the requests on a connection.
+// The server keeps reading requests while it writes responses, but only holds a bounded number of
+// responses that the client has not read yet. A client which pipelines must therefore read the
+// responses while it is still writing requests, from another thread or by polling the socket for
+// both, or it can block forever in writing a large request.
+// UNKNOWN_GRAMMAR and GRAMMAR_ERROR responses have an empty payload; after any other status
+// than OK the server closes the connection.
+
+namespace lexer
+{
+    constexpr const uint32_t REQUEST_MAGIC = 0x51524c58;  // "XLRQ"
+    constexpr const uint32_t RESPONSE_MAGIC = 0x53524c58; // "XLRS"
+    constexpr const size_t FRAME_HEADER_SIZE = 16;
+
+    enum class RequestType : uint32_t
+    {
+        LEX = 0,
+        LEXEMES = 1,
+        LEX_GRAMMAR = 2,
+        LEXEMES_GRAMMAR = 3
+    };
+
+    enum class ResponseStatus : uint32_t
+    {
+        OK = 0,
+        BAD_REQUEST = 1,
+        TOO_LARGE = 2,
+        UNKNOWN_GRAMMAR = 3,
+        // The grammar could not be compiled.
+        GRAMMAR_ERROR = 4
+    };
+
+    struct SocketError : std::runtime_error
+    {
+        SocketError(const std::string &what);
+    };
+
+    class LexServer
+    {
+    public:
+        struct Options
+        {
+            std::string socket_path;
+            // Threads lexing requests, including the dispatcher.
+            size_t threads = 1;
+            // Most requests lexed together in one round, across all connections.
+            size_t max_batch = 64;
+            size_t max_connections = 256;
+            size_t max_request_bytes = size_t{256} << 20;
+        };
+
+    private:
+        // A request, and its response once it has been lexed.
+        struct Job
+        {
+            RequestType type;
+            // Empty for the default grammar.
+            std::string grammar;
+            std::string payload;
+            // Offset of the input in the payload, after the grammar name.
+            size_t input_offset = 0;
+            std::string response;
+        };
+
+        // Requests read together from one connection, which are answered together.
+        struct Batch
+        {
+            std::vector<Job> jobs;
+            bool done = false;
+        };
+
+        struct Connection
+        {
+            int fd;
+            std::thread thread;
+            std::atomic<bool> finished = false;
+        };
+
+        GrammarRegistry *registry;
+        std::string default_grammar;
+        bool utf8_validation;
+        Options options;
+
+        int listen_fd;
+        std::atomic<bool> stopping;
+
+        ThreadPool pool;
+        std::thread dispatcher;
+
+        // Batches waiting to be lexed, bounded to a few rounds worth of requests.
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::condition_variable done_cv;
+        std::deque<Batch *> queue;
+        size_t queued_jobs;
+
+        std::mutex connections_mutex;
+        std::condition_variable connections_cv;
+        std::list<Connection> connections;
+
+        void dispatch_loop();
+        void serve_connection(Connection *connection);
+        void reap_connections();
+        size_t active_connections() const;
+
+        bool read_request(int fd, Batch &batch);
+        void lex_job(Job &job);
+
+        void submit_and_wait(Batch &batch);
+
+    public:
+        // Grammars are looked up in the registry by name, compiling them on first use.
+        LexServer(GrammarRegistry *registry, std::string default_grammar, bool utf8_validation, const Options &options);
+        ~LexServer();
+
+        LexServer(const LexServer &) = delete;
+        LexServer &operator=(const LexServer &) = delete;
+
+        // Accepts and serves connections until stop is called.
+        void run();
+
+        // Safe to call from any thread; closes the socket and all connections.
+        void stop();
+    };
+
+    // Blocking client for the lexing service, mainly for tools and as a reference implementation.
+    class LexClient
+    {
+        int fd;
+
+    public:
+        struct Response
+        {
+            std::vector<uint32_t> lexeme_ids;
+            std::vector<uint64_t> begins;
+            std::vector<uint64_t> ends;
+            std::optional<LexError> error;
+        };
+
+        LexClient(const std::string &socket_path);
+        ~LexClient();
+
+        LexClient(const LexClient &) = delete;
+        LexClient &operator=(const LexClient &) = delete;
+
+        // An empty grammar name selects the default grammar of the server.
+        std::vector<std::string> lexemes(std::string_view grammar = "");
+
+        // send and receive may be called separately to pipeline requests: responses arrive in
+        // the order of the requests. To pipeline, call receive on another thread than send, as
+        // both block; a sender that only reads after writing can fill both socket buffers.
+        void send(std::string_view input, std::string_view grammar = "");
+        Response receive();
+
+        Response lex(std::string_view input, std::string_view grammar = "");
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _LEXER_SHUFFLE_LEXER
+#define _LEXER_SHUFFLE_LEXER
+
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+#include "lexer/backend.hpp"
+#include "lexer/fsa.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/tile_set.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    struct TooManyDfaStatesError : std::runtime_error
+    {
+        TooManyDfaStatesError() : std::runtime_error("Too many DFA states for state vectors") {}
+    };
+
+    // A parallel state is a function from DFA states to DFA states. For a DFA of at most MAX_STATES
+    // states such a function fits in a state vector of one byte per state, and composing two of
+    // them is a byte shuffle of one by the other, so no merge table is needed.
+    struct StateVector
+    {
+        constexpr const static size_t MAX_STATES = 64;
+
+        alignas(64) uint8_t states[MAX_STATES];
+
+        static StateVector identity();
+    };
+
+    // The transitions of a small DFA as one state vector per byte, together with a bit mask of the
+    // DFA states in which the byte produces a lexeme.
+    struct ShuffleTable
+    {
+        using StateIndex = FiniteStateAutomaton::StateIndex;
+
+        size_t num_states;
+        StateVector transitions[FiniteStateAutomaton::MAX_SYM + 1];
+        uint64_t produces_lexeme[FiniteStateAutomaton::MAX_SYM + 1];
+
+        // Lexeme accepted in each DFA state, or nullptr.
+        std::vector<const Lexeme *> lexemes;
+
+        // Throws TooManyDfaStatesError if the DFA does not fit.
+        ShuffleTable(const FiniteStateAutomaton &dfa);
+
+        static bool fits(const FiniteStateAutomaton &dfa);
+
+        // Replaces every state s of v by the state it goes to on the bytes of input, in order. Uses
+        // VPERMB or PSHUFB when the processor supports them.
+        void apply(StateVector &v, std::string_view input) const;
+
+        // Replaces every state s of first by second.states[s].
+        void compose(StateVector &first, const StateVector &second) const;
+
+        size_t memory_bytes() const;
+    };
+
+    // The phases of HostLexer with state vectors instead of parallel states: map composes the
+    // transitions of the bytes of every tile with shuffles, scan composes the tile aggregates the
+    // same way, and extract runs the DFA over every tile from the state the tiles before it end in.
+    class ShuffleLexer : public LexerBackend
+    {
+        const ShuffleTable *table;
+        bool utf8_validation;
+        ThreadPool *pool;
+
+        std::string_view input;
+        std::optional<LexError> error;
+
+        std::vector<StateVector> aggregates;
+        TileSet tiles;
+
+    public:
+        ShuffleLexer(const ShuffleTable *table, bool utf8_validation = false, ThreadPool &pool = ThreadPool::global());
+
+        const char *name() const override;
+
+        void reserve(size_t input_length) override;
+        void release() override;
+
+        void map(std::string_view input) override;
+        void scan() override;
+        void extract(TokenStream &tokens) override;
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _LEXER_STRING_DECODER
+#define _LEXER_STRING_DECODER
+
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/token_stream.hpp"
+#include "thread_pool.hpp"
+#include "arena.hpp"
+
+namespace lexer
+{
+    // Decodes a JSON string literal, including its quotes. Escape sequences are replaced by the
+    // characters they stand for, and the contents must be valid UTF-8. If there is nothing to
+    // decode the result points into `literal`, otherwise the decoded string is allocated in `arena`.
+    std::optional<std::string_view> decode_string(std::string_view literal, Arena &arena);
+
+    // Decoded contents of all tokens of one lexeme, in input order.
+    struct StringColumn
+    {
+        // Index of every token of the lexeme in the token stream.
+        std::vector<size_t> tokens;
+        std::vector<std::string_view> values;
+
+        // Index in the token stream of the first token which could not be decoded. Its value is empty.
+        std::optional<size_t> first_error;
+
+        // Backing storage of the values which needed decoding, one arena per chunk of work.
+        std::vector<Arena> arenas;
+
+        size_t size() const;
+    };
+
+    // Post-lex stage which decodes every token of a string lexeme, in parallel over the token stream.
+    // The values in the returned column may point into the input, which must outlive it.
+    class StringDecoder
+    {
+        const Lexeme *lexeme;
+
+    public:
+        // Throws UnknownLexemeError if the grammar has no lexeme of this name.
+        StringDecoder(const LexicalGrammar *g, std::string_view lexeme_name);
+
+        StringColumn decode(std::string_view input, const TokenStream &tokens, ThreadPool &pool = ThreadPool::global()) const;
+    };
+}
+
+#endif
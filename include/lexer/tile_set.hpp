@@ -0,0 +1,76 @@
+#ifndef _LEXER_TILE_SET
+#define _LEXER_TILE_SET
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+
+#include "lexer/token_stream.hpp"
+#include "thread_pool.hpp"
+
+namespace lexer
+{
+    // The tiles of the input which HostLexer and ShuffleLexer lex on the threads of a pool, and the
+    // tokens that end in each of them, which are collected per tile and then copied to their place
+    // in the stream. The lexers only differ in how they compose and run the DFA over a tile.
+    class TileSet
+    {
+    public:
+        struct Tile
+        {
+            std::optional<size_t> first_invalid;
+
+            // The tokens that end in the tile, the first of which begins at first_begin, in some
+            // tile before it. They are copied to offset in the stream.
+            std::vector<size_t> ends;
+            std::vector<const Lexeme *> lexemes;
+            size_t first_begin;
+            size_t offset;
+
+            // Index of the first rejected token, if any.
+            std::optional<size_t> first_rejected;
+
+            void clear_tokens();
+            void add_token(size_t end, const Lexeme *lexeme);
+        };
+
+    private:
+        ThreadPool *pool;
+        size_t input_length;
+        size_t tile_size;
+        size_t num_tiles;
+
+        // Kept across calls, so that the token buffers are only allocated while they grow.
+        std::vector<Tile> tiles;
+
+    public:
+        TileSet(ThreadPool &pool);
+
+        // The number of tiles of an input of input_length bytes.
+        size_t count(size_t input_length) const;
+
+        void reserve(size_t input_length);
+        void release();
+
+        // Splits an input of n bytes into tiles, which are a multiple of the block size of the
+        // UTF-8 validator so that every tile can be validated on its own.
+        void split(size_t n);
+
+        size_t size() const;
+        size_t begin(size_t t) const;
+        size_t end(size_t t) const;
+        Tile &operator[](size_t t);
+
+        // The lowest first_invalid of the tiles. An error may be found by the tile after the one
+        // it starts in.
+        std::optional<LexError> first_utf8_error() const;
+
+        // Appends the tokens of all tiles to `tokens`, followed by the last token, which ends at
+        // the end of the input and was recognized as `last`. Reports `error` first, so that it
+        // wins over rejected input at the same offset, as in LexerInterpreter. Returns the number
+        // of tokens appended.
+        size_t copy_tokens(TokenStream &tokens, const Lexeme *last, const std::optional<LexError> &error);
+    };
+}
+
+#endif
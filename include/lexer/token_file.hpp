@@ -0,0 +1,157 @@
+#ifndef _LEXER_TOKEN_FILE
+#define _LEXER_TOKEN_FILE
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <iosfwd>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/token_stream.hpp"
+
+// Compact binary format for token streams. All integers are little-endian, varints are LEB128.
+//
+//   Header:  u32 TOKEN_FILE_MAGIC, u16 version, u8 id width (1, 2 or 4 bytes), u8 0, u32 tokens per block,
+//            u32 lexeme count, per lexeme a varint length and its name, a varint length and the source name
+//   Block:   u32 token count n > 0, u32 flags, u32 payload size, u32 0, u64 begin of the first token, payload
+//   Payload: n lexeme ids of the id width, the largest value marking rejected input;
+//            n varint token lengths; unless the block is CONTIGUOUS, n - 1 varint gaps between the
+//            end of a token and the begin of the next
+//   Footer:  u32 0, u64 token count, u32 error type (0 none, 1 rejected, 2 invalid UTF-8), u64 error offset,
+//            u32 block count, u64 offset of every block, u64 offset of the footer, u32 TOKEN_FILE_END_MAGIC
+//
+// Offsets in the footer are relative to the start of the stream. Every block can be decoded on its
+// own given the header, so the blocks of a file can be read by several threads at once. The footer
+// ends in a fixed size trailer, so a reader can find the block index from the end of a file. Token
+// streams are self-delimiting, so several may be written one after another.
+
+namespace lexer
+{
+    constexpr const uint32_t TOKEN_FILE_MAGIC = 0x53544c58;     // "XLTS"
+    constexpr const uint32_t TOKEN_FILE_END_MAGIC = 0x45544c58; // "XLTE"
+    constexpr const uint16_t TOKEN_FILE_VERSION = 1;
+
+    struct TokenFormatError : std::runtime_error
+    {
+        TokenFormatError(const std::string &what) : std::runtime_error(what) {}
+    };
+
+    // Decoded tokens of one block. Lexeme ids index TokenFileHeader::lexemes, REJECTED_ID marks
+    // rejected input.
+    struct TokenBlock
+    {
+        constexpr const static uint32_t REJECTED_ID = UINT32_MAX;
+
+        std::vector<uint32_t> lexeme_ids;
+        std::vector<uint64_t> begins;
+        std::vector<uint64_t> ends;
+
+        size_t size() const;
+        void clear();
+    };
+
+    struct TokenFileHeader
+    {
+        std::vector<std::string> lexemes;
+        std::string source;
+        uint32_t id_width;
+        uint32_t block_tokens;
+    };
+
+    class TokenStreamWriter
+    {
+        std::ostream *out;
+        const LexicalGrammar *grammar;
+        uint32_t id_width;
+        uint32_t block_tokens;
+
+        // Bytes written so far, the output need not be seekable.
+        uint64_t offset;
+        std::vector<uint64_t> block_offsets;
+        uint64_t total_tokens;
+        uint64_t last_end;
+        bool finished;
+
+        TokenBlock pending;
+        std::string buffer;
+
+        void write_bytes(std::string_view bytes);
+        void flush_block();
+
+    public:
+        constexpr const static uint32_t DEFAULT_BLOCK_TOKENS = 4096;
+
+        // Writes the header. Token offsets must be nondecreasing over the whole stream.
+        TokenStreamWriter(std::ostream &out, const LexicalGrammar *grammar, std::string_view source = "", uint32_t block_tokens = DEFAULT_BLOCK_TOKENS);
+
+        TokenStreamWriter(const TokenStreamWriter &) = delete;
+        TokenStreamWriter &operator=(const TokenStreamWriter &) = delete;
+
+        void push_back(const Lexeme *lexeme, uint64_t begin, uint64_t end);
+
+        // Appends all tokens of the stream.
+        void write(const TokenStream &tokens);
+
+        // Writes the remaining tokens and the footer. Nothing may be written afterwards.
+        void finish(std::optional<LexError> error);
+    };
+
+    // Reads a token stream block by block, from any input stream.
+    class TokenStreamReader
+    {
+        std::istream *in;
+        TokenFileHeader file_header;
+        bool at_end;
+        uint64_t total_tokens;
+        std::optional<LexError> stream_error;
+        std::string buffer;
+
+    public:
+        // Reads the header.
+        TokenStreamReader(std::istream &in);
+
+        const TokenFileHeader &header() const;
+
+        // Decodes the next block into `block`, or reads the footer and returns false at the end of
+        // the stream, after which the input is positioned right after this token stream.
+        bool next_block(TokenBlock &block);
+
+        // Available once next_block returned false.
+        uint64_t token_count() const;
+        std::optional<LexError> error() const;
+    };
+
+    // Random access to the blocks of a file which holds a single token stream. read_block may be
+    // called from several threads at once.
+    class TokenFileReader
+    {
+        int fd;
+        TokenFileHeader file_header;
+        std::vector<uint64_t> block_offsets;
+        uint64_t footer_offset;
+        uint64_t total_tokens;
+        std::optional<LexError> file_error;
+
+        std::string read_range(uint64_t begin, uint64_t end) const;
+
+    public:
+        TokenFileReader(const std::string &path);
+        ~TokenFileReader();
+
+        TokenFileReader(const TokenFileReader &) = delete;
+        TokenFileReader &operator=(const TokenFileReader &) = delete;
+
+        const TokenFileHeader &header() const;
+        size_t block_count() const;
+        uint64_t token_count() const;
+        std::optional<LexError> error() const;
+
+        void read_block(size_t index, TokenBlock &block) const;
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef _LEXER_TOKEN_SINK
+#define _LEXER_TOKEN_SINK
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdio>
+
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/token_stream.hpp"
+
+// The engines which lex sequentially, LexerInterpreter and NfaLexer, are templates over where their
+// tokens go, so that what consumes them is inlined into the lexing loop instead of reading them back
+// from a TokenStream afterwards. A sink is any type with
+//
+//     void on_token(const Lexeme *lexeme, size_t begin, size_t end);
+//     void on_error(LexError::Type type, size_t offset);
+//
+// Tokens are passed in order. Rejected input is passed as a token with a null lexeme, and is not
+// also passed to on_error, which only receives invalid UTF-8, possibly before the tokens around it.
+// A TokenStream is the sink which stores every token.
+namespace lexer
+{
+    // Keeps the error with the lowest offset like TokenStream, where an earlier one wins a tie.
+    struct ErrorSink
+    {
+        std::optional<LexError> error;
+
+        void on_token(const Lexeme *lexeme, size_t begin, size_t)
+        {
+            if (!lexeme)
+                this->on_error(LexError::Type::REJECTED, begin);
+        }
+
+        void on_error(LexError::Type type, size_t offset)
+        {
+            if (!this->error.has_value() || offset < this->error->offset)
+                this->error = LexError{type, offset};
+        }
+    };
+
+    // Counts the tokens, and those of every lexeme by id.
+    struct CountingSink : ErrorSink
+    {
+        const LexicalGrammar *g;
+        std::vector<size_t> counts;
+        size_t tokens;
+
+        CountingSink(const LexicalGrammar *g) : g(g), counts(g->lexemes.size()), tokens(0) {}
+
+        void on_token(const Lexeme *lexeme, size_t begin, size_t end)
+        {
+            ++this->tokens;
+            if (lexeme)
+                ++this->counts[lexeme - this->g->lexemes.data()];
+            else
+                ErrorSink::on_token(lexeme, begin, end);
+        }
+
+        void print_token_table(FILE *out = stdout) const
+        {
+            fprintf(out, "lexeme\t\tcount\n");
+            for (size_t i = 0; i < this->counts.size(); ++i)
+                fprintf(out, "%-20s\t%5zu\n", this->g->lexemes[i].name.c_str(), this->counts[i]);
+        }
+    };
+
+    // Passes on the tokens for whose lexeme the predicate holds, and every error.
+    template <typename Predicate, typename Sink>
+    struct FilterSink
+    {
+        Predicate predicate;
+        Sink *sink;
+
+        void on_token(const Lexeme *lexeme, size_t begin, size_t end)
+        {
+            if (this->predicate(lexeme))
+                this->sink->on_token(lexeme, begin, end);
+        }
+
+        void on_error(LexError::Type type, size_t offset)
+        {
+            this->sink->on_error(type, offset);
+        }
+    };
+
+    template <typename Predicate, typename Sink>
+    FilterSink<Predicate, Sink> filter_sink(Predicate predicate, Sink &sink)
+    {
+        return FilterSink<Predicate, Sink>{predicate, &sink};
+    }
+
+    // Passes the tokens of a stream to a sink, for the engines which can only fill a TokenStream.
+    // Its error goes first, so that it still wins over a rejected token at the same offset.
+    template <typename Sink>
+    void pass_tokens(const TokenStream &tokens, Sink &sink)
+    {
+        if (tokens.error.has_value())
+            sink.on_error(tokens.error->type, tokens.error->offset);
+        for (size_t i = 0; i < tokens.size(); ++i)
+            sink.on_token(tokens.lexemes[i], tokens.begins[i], tokens.ends[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _LEXER_TOKEN_STREAM
+#define _LEXER_TOKEN_STREAM
+
+#include <vector>
+#include <optional>
+#include <cstddef>
+
+namespace lexer
+{
+    struct Lexeme;
+
+    struct LexError
+    {
+        enum class Type
+        {
+            // The lexer could not match the input at this offset to any lexeme.
+            REJECTED,
+            INVALID_UTF8
+        };
+
+        Type type;
+        size_t offset;
+    };
+
+    // Output of the lexer, stored as structure of arrays. Token i covers the input bytes
+    // [begins[i], ends[i]) and was recognized as lexemes[i]. Input that was rejected by the
+    // lexer shows up as a token with a nullptr lexeme.
+    struct TokenStream
+    {
+        std::vector<size_t> begins;
+        std::vector<size_t> ends;
+        std::vector<const Lexeme *> lexemes;
+
+        // The error with the lowest offset that was encountered while lexing, if any.
+        std::optional<LexError> error;
+
+        size_t size() const;
+        void clear();
+        void push_back(const Lexeme *lexeme, size_t begin, size_t end);
+
+        // Records an error, unless one at a lower offset was reported already.
+        void report_error(LexError::Type type, size_t offset);
+
+        // As a sink of the lexing engines, see lexer/token_sink.hpp.
+        void on_token(const Lexeme *lexeme, size_t begin, size_t end)
+        {
+            this->push_back(lexeme, begin, end);
+        }
+
+        void on_error(LexError::Type type, size_t offset)
+        {
+            this->report_error(type, offset);
+        }
+    };
+}
+
+#endif
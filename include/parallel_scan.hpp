@@ -0,0 +1,59 @@
+#ifndef _PARALLEL_SCAN
+#define _PARALLEL_SCAN
+
+#include <vector>
+#include <cstddef>
+
+#include "thread_pool.hpp"
+
+// Replaces every data[i] by op(data[0], op(data[1], ... data[i])), for an associative op which
+// need not be commutative or have an identity. Works by reduce-then-scan over tiles: the first pass
+// reduces every tile but the last to its aggregate, the aggregates are scanned sequentially into
+// the carry of every tile, and the second pass scans every tile starting from its carry. This
+// calls op about 2n times over two passes over data, and needs no memory besides one value per
+// tile. Tiles hold at least min_tile_size elements; input that fits in one tile is scanned in a
+// single pass.
+template <typename T, typename Op>
+void parallel_inclusive_scan(ThreadPool &pool, T *data, size_t n, Op op, size_t min_tile_size = size_t{1} << 16)
+{
+    if (n == 0)
+        return;
+
+    auto scan_tile = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin + 1; i < end; ++i)
+            data[i] = op(data[i - 1], data[i]);
+    };
+
+    size_t tiles = pool.chunk_count(n, min_tile_size);
+    if (tiles == 1)
+    {
+        scan_tile(0, n);
+        return;
+    }
+
+    auto tile_begin = [&](size_t tile)
+    { return n * tile / tiles; };
+
+    // The aggregate of the last tile is never needed.
+    std::vector<T> carries(tiles);
+    pool.parallel_for(tiles - 1, [&](size_t tile)
+                      {
+                          size_t end = tile_begin(tile + 1);
+                          T aggregate = data[tile_begin(tile)];
+                          for (size_t i = tile_begin(tile) + 1; i < end; ++i)
+                              aggregate = op(aggregate, data[i]);
+                          carries[tile + 1] = aggregate; });
+
+    for (size_t tile = 2; tile < tiles; ++tile)
+        carries[tile] = op(carries[tile - 1], carries[tile]);
+
+    pool.parallel_for(tiles, [&](size_t tile)
+                      {
+                          size_t begin = tile_begin(tile);
+                          if (tile > 0)
+                              data[begin] = op(carries[tile], data[begin]);
+                          scan_tile(begin, tile_begin(tile + 1)); });
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _THREAD_POOL
+#define _THREAD_POOL
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// Work-stealing pool: every worker has its own queue, which it pops from the back, and idle
+// workers steal from the front of the queues of others. Tasks submitted by a worker go to its
+// own queue, so nested work stays on the thread that spawned it unless another one is idle.
+class ThreadPool
+{
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    // Idle workers sleep until a task is queued anywhere.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> next_queue;
+    bool stopping;
+
+    void worker_loop(size_t index);
+    bool try_pop(size_t index, std::function<void()> &task);
+    void submit(std::function<void()> task);
+    void run_batch(size_t n, const std::function<void(size_t)> &f);
+
+public:
+    // A pool of 0 threads is valid, in which case all work runs on the calling thread.
+    ThreadPool(size_t num_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const;
+
+    // Number of chunks to split n items into, such that every chunk holds at least
+    // min_chunk_size items and there are a few more chunks than threads to balance load.
+    size_t chunk_count(size_t n, size_t min_chunk_size) const;
+
+    // Calls f(i) for every i in [0, n) and blocks until all calls have returned.
+    // The calling thread takes part in the work, so nested calls from inside f are fine.
+    // If a call throws, the calls which have not started yet are skipped, and the first exception
+    // is rethrown here once the others have returned.
+    template <typename F>
+    void parallel_for(size_t n, F &&f)
+    {
+        this->run_batch(n, std::function<void(size_t)>(std::forward<F>(f)));
+    }
+
+    // Splits [0, n) into `chunks` contiguous ranges and calls f(chunk, begin, end) for each.
+    template <typename F>
+    void for_each_chunk(size_t n, size_t chunks, F &&f)
+    {
+        this->parallel_for(chunks, [&](size_t chunk)
+                           { f(chunk, n * chunk / chunks, n * (chunk + 1) / chunks); });
+    }
+
+    // Process-wide pool with one thread per hardware thread.
+    static ThreadPool &global();
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _UTF8
+#define _UTF8
+
+#include <string_view>
+#include <optional>
+#include <cstddef>
+
+// Block size find_utf8_error works in. Ranges that do not end at the end of the input
+// must be a multiple of this.
+constexpr const size_t UTF8_BLOCK_SIZE = 16;
+
+// Returns the offset of the first byte of the first ill-formed UTF-8 sequence in text, or nullopt
+// if all of it is valid UTF-8. Overlong encodings, surrogates and code points above U+10FFFF are
+// ill-formed.
+std::optional<size_t> validate_utf8(std::string_view text);
+
+// Validates the bytes of input in [begin, end), using the bytes before begin as context, so that
+// a large input can be validated in independent pieces and interleaved with other work on the
+// same bytes. A sequence which continues past end is only an error if end is the end of the input.
+// The result is the first ill-formed sequence near or in the range, which may start a few bytes
+// before begin; taking the minimum over all pieces gives the same result as validate_utf8.
+// Uses SSSE3 when the processor supports it.
+std::optional<size_t> find_utf8_error(std::string_view input, size_t begin, size_t end);
+
+#endif
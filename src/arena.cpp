@@ -0,0 +1,54 @@
+#include "arena.hpp"
+
+#include <cstdint>
+
+Arena::Arena() : head(nullptr), remaining(0), used(0) {}
+
+Arena::Arena(Arena &&other) noexcept : blocks(std::move(other.blocks)), head(other.head), remaining(other.remaining), used(other.used)
+{
+    other.head = nullptr;
+    other.remaining = 0;
+    other.used = 0;
+}
+
+Arena &Arena::operator=(Arena &&other) noexcept
+{
+    std::swap(this->blocks, other.blocks);
+    std::swap(this->head, other.head);
+    std::swap(this->remaining, other.remaining);
+    std::swap(this->used, other.used);
+    return *this;
+}
+
+void *Arena::allocate(size_t size, size_t align)
+{
+    // Oversized allocations get a block of their own, so that the rest of the current block is
+    // still used by the allocations after them.
+    if (size + align > BLOCK_SIZE)
+    {
+        this->blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(size + align));
+        auto *block = this->blocks.back().get();
+        this->used += size;
+        return block + (align - reinterpret_cast<uintptr_t>(block) % align) % align;
+    }
+
+    auto padding = (align - reinterpret_cast<uintptr_t>(this->head) % align) % align;
+    if (padding + size > this->remaining)
+    {
+        this->blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(BLOCK_SIZE));
+        this->head = this->blocks.back().get();
+        this->remaining = BLOCK_SIZE;
+        padding = (align - reinterpret_cast<uintptr_t>(this->head) % align) % align;
+    }
+
+    auto *result = this->head + padding;
+    this->head += padding + size;
+    this->remaining -= padding + size;
+    this->used += size;
+    return result;
+}
+
+size_t Arena::bytes_used() const
+{
+    return this->used;
+}
@@ -0,0 +1,101 @@
+#include "instrumentation.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <ostream>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+    // Small sequential thread ids, which are easier to read in a trace than native ones.
+    uint32_t thread_index()
+    {
+        static std::atomic<uint32_t> next_index = 0;
+        thread_local uint32_t index = next_index++;
+        return index;
+    }
+}
+
+Profile::Profile() : epoch(Clock::now()) {}
+
+Profile::Profile(const Profile &other)
+{
+    auto lock = std::lock_guard(other.mutex);
+    this->epoch = other.epoch;
+    this->event_list = other.event_list;
+}
+
+Profile &Profile::operator=(const Profile &other)
+{
+    if (this == &other)
+        return *this;
+
+    auto lock = std::scoped_lock(this->mutex, other.mutex);
+    this->epoch = other.epoch;
+    this->event_list = other.event_list;
+    return *this;
+}
+
+void Profile::clear()
+{
+    auto lock = std::lock_guard(this->mutex);
+    this->epoch = Clock::now();
+    this->event_list.clear();
+}
+
+void Profile::record(const char *stage, Clock::time_point start, Clock::time_point end, size_t bytes, size_t count)
+{
+    auto lock = std::lock_guard(this->mutex);
+    auto ns = [](Clock::duration d)
+    { return static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count())); };
+
+    this->event_list.push_back({stage, ns(start - this->epoch), ns(end - start), bytes, count, thread_index()});
+}
+
+std::vector<StageEvent> Profile::events() const
+{
+    auto lock = std::lock_guard(this->mutex);
+    return this->event_list;
+}
+
+std::vector<StageStats> Profile::stages() const
+{
+    auto events = this->events();
+    std::stable_sort(events.begin(), events.end(), [](const StageEvent &a, const StageEvent &b)
+                     { return a.start_ns < b.start_ns; });
+
+    auto stats = std::vector<StageStats>();
+    for (const auto &event : events)
+    {
+        auto it = std::find_if(stats.begin(), stats.end(), [&](const StageStats &s)
+                               { return std::strcmp(s.stage, event.stage) == 0; });
+        if (it == stats.end())
+            it = stats.insert(stats.end(), {event.stage, 0, 0, 0, 0});
+
+        ++it->calls;
+        it->seconds += event.duration_ns * 1e-9;
+        it->bytes += event.bytes;
+        it->count += event.count;
+    }
+
+    return stats;
+}
+
+void Profile::write_chrome_trace(std::ostream &os) const
+{
+    // Complete events ("ph": "X") with microsecond timestamps. Stage names are literals, so they
+    // need no escaping.
+    auto events = this->events();
+    os << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const auto &e = events[i];
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "%s{\"name\":\"%s\",\"cat\":\"lexer\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%zu,\"count\":%zu}}",
+                 i == 0 ? "\n" : ",\n", e.stage, e.thread, e.start_ns / 1000.0, e.duration_ns / 1000.0, e.bytes, e.count);
+        os << line;
+    }
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
@@ -1,200 +1,393 @@
 #include <string>
 #include <iostream>
 #include <cstdlib>
+#include <climits>
 #include <time.h>
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
 
 #include "lexer.cuh"
 
-__global__ void map_trans_kernel(
-    lexer::ParallelLexer::Transition *trans,
+// Length of the well-formed UTF-8 sequence starting at idx, or 0 if it is ill-formed.
+__device__ size_t utf8_sequence_length(const unsigned char *input, size_t input_length, size_t idx) {
+    unsigned char lead = input[idx];
+    size_t length;
+    unsigned char min = 0x80, max = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0)
+            min = 0xA0;
+        else if (lead == 0xED)
+            max = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0)
+            min = 0x90;
+        else if (lead == 0xF4)
+            max = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (input_length - idx < length || input[idx + 1] < min || input[idx + 1] > max)
+        return 0;
+
+    for (size_t i = 2; i < length; ++i) {
+        if ((input[idx + i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    return length;
+}
+
+// Whether a sequential validator would report an error at idx, assuming the input before it is valid.
+// The lowest such idx is the first error: a continuation byte is fine only if it is covered by a
+// well-formed sequence starting at one of the 3 bytes before it, any other byte must start one.
+__device__ bool utf8_error_at(const unsigned char *input, size_t input_length, size_t idx) {
+    unsigned char c = input[idx];
+    if (c < 0x80)
+        return false;
+
+    if ((c & 0xC0) != 0x80)
+        return utf8_sequence_length(input, input_length, idx) == 0;
+
+    for (size_t back = 1; back <= 3 && back <= idx; ++back) {
+        if ((input[idx - back] & 0xC0) != 0x80)
+            return utf8_sequence_length(input, input_length, idx - back) <= back;
+    }
+
+    return true;
+}
+
+namespace {
+    // Every thread composes tiles of at least this many bytes, so that the aggregates of small inputs
+    // stay few.
+    constexpr const size_t MIN_TILE_SIZE = 32;
+
+    __device__ lexer::ParallelLexer::Transition merge(
+        const lexer::ParallelLexer::Transition *merge_table,
+        size_t num_states,
+        lexer::ParallelLexer::StateIndex first,
+        lexer::ParallelLexer::StateIndex second
+    ) {
+        return merge_table[first + second * num_states];
+    }
+}
+
+__global__ void reduce_tiles_kernel(
+    lexer::ParallelLexer::Transition *aggregates,
     lexer::ParallelLexer::Transition *initial_states,
+    lexer::ParallelLexer::Transition *merge_table,
+    size_t num_states,
     char *input,
     size_t input_length,
+    size_t tile_size,
+    unsigned long long *first_invalid,
     size_t N_THREADS
 ) {
-    for (size_t idx = threadIdx.x + blockIdx.x * blockDim.x; idx < input_length; idx += N_THREADS) {
-        trans[idx] = initial_states[input[idx]];
-        // printf("%c %lu %d\n", input[idx], initial_states[input[idx]].result_state, initial_states[input[idx]].produces_lexeme);
+    auto *bytes = reinterpret_cast<const unsigned char *>(input);
+    size_t num_tiles = (input_length + tile_size - 1) / tile_size;
+    for (size_t tile = threadIdx.x + blockIdx.x * blockDim.x; tile < num_tiles; tile += N_THREADS) {
+        size_t begin = tile * tile_size;
+        size_t end = begin + tile_size < input_length ? begin + tile_size : input_length;
+
+        auto state = initial_states[bytes[begin]];
+        for (size_t idx = begin + 1; idx < end; ++idx)
+            state = merge(merge_table, num_states, state.result_state, initial_states[bytes[idx]].result_state);
+        aggregates[tile] = state;
+
+        if (first_invalid) {
+            for (size_t idx = begin; idx < end; ++idx) {
+                if (utf8_error_at(bytes, input_length, idx)) {
+                    atomicMin(first_invalid, (unsigned long long) idx);
+                    break;
+                }
+            }
+        }
     }
 }
 
-__global__ void prefix_step_kernel(
-    lexer::ParallelLexer::Transition *start,
-    lexer::ParallelLexer::Transition *prefix,
+__global__ void count_tokens_kernel(
+    size_t *counts,
+    lexer::ParallelLexer::Transition *aggregates,
+    lexer::ParallelLexer::Transition *initial_states,
     lexer::ParallelLexer::Transition *merge_table,
     size_t num_states,
-    size_t step_size,
+    char *input,
     size_t input_length,
+    size_t tile_size,
     size_t N_THREADS
 ) {
-    for (size_t idx = threadIdx.x + blockIdx.x * blockDim.x; idx <= input_length; idx += N_THREADS) {
-        if (idx < step_size) {
-            prefix[idx] = start[idx];
-        } else if (idx < input_length) {
-            // start[idx - step_size] + start[idx]
-            size_t table_index = (start[idx - step_size].result_state) + start[idx].result_state * num_states;
-            prefix[idx] = merge_table[table_index];
-            // printf("adding %lu: %lu; %lu: %lu, res: %lu\n", idx - step_size, start[idx - step_size].result_state, idx, start[idx].result_state, prefix[idx].result_state);
-        } else if (idx == input_length) {
-            size_t table_index = (prefix[idx - 1].result_state);
-            prefix[idx] = merge_table[table_index];
+    auto *bytes = reinterpret_cast<const unsigned char *>(input);
+    size_t num_tiles = (input_length + tile_size - 1) / tile_size;
+    for (size_t tile = threadIdx.x + blockIdx.x * blockDim.x; tile < num_tiles; tile += N_THREADS) {
+        size_t begin = tile * tile_size;
+        size_t end = begin + tile_size < input_length ? begin + tile_size : input_length;
+
+        auto state = tile == 0 ? initial_states[bytes[0]].result_state : aggregates[tile - 1].result_state;
+        size_t count = 0;
+        for (size_t idx = begin > 0 ? begin : 1; idx < end; ++idx) {
+            auto next = merge(merge_table, num_states, state, initial_states[bytes[idx]].result_state);
+            count += next.produces_lexeme;
+            state = next.result_state;
         }
-    }
-    if (step_size == input_length && threadIdx.x + blockIdx.x * blockDim.x == 0) {
-        start[input_length] = merge_table[start[input_length - 1].result_state];
+        counts[tile] = count;
     }
 }
 
-__global__ void extract_final_kernel(
-    lexer::ParallelLexer::Transition *trans,
+__global__ void write_tokens_kernel(
+    size_t *offsets,
+    lexer::ParallelLexer::Transition *aggregates,
+    lexer::ParallelLexer::Transition *initial_states,
+    lexer::ParallelLexer::Transition *merge_table,
+    size_t num_states,
     lexer::Lexeme **final_states,
-    lexer::Lexeme **res,
-    bool *res_is_token,
+    char *input,
     size_t input_length,
+    size_t tile_size,
+    size_t *begins,
+    size_t *ends,
+    lexer::Lexeme **lexemes,
+    unsigned long long *first_rejected,
     size_t N_THREADS
 ) {
-    for (size_t idx = threadIdx.x + blockIdx.x * blockDim.x; idx <= input_length; idx += N_THREADS) {
-        // printf("%d: %lu, %d\n", idx, trans[idx].result_state, trans[idx].produces_lexeme);
-        res[idx] = final_states[trans[idx].result_state];
-        res_is_token[idx] = trans[idx].produces_lexeme;
+    auto *bytes = reinterpret_cast<const unsigned char *>(input);
+    size_t num_tiles = (input_length + tile_size - 1) / tile_size;
+    for (size_t tile = threadIdx.x + blockIdx.x * blockDim.x; tile < num_tiles; tile += N_THREADS) {
+        size_t begin = tile * tile_size;
+        size_t end = begin + tile_size < input_length ? begin + tile_size : input_length;
+
+        // Every token begins where the one before it ends, so the begin of the token after each one
+        // is written along with it.
+        if (tile == 0)
+            begins[0] = 0;
+
+        auto state = tile == 0 ? initial_states[bytes[0]].result_state : aggregates[tile - 1].result_state;
+        size_t out = offsets[tile];
+        for (size_t idx = begin > 0 ? begin : 1; idx < end; ++idx) {
+            auto next = merge(merge_table, num_states, state, initial_states[bytes[idx]].result_state);
+            if (next.produces_lexeme) {
+                auto *lexeme = final_states[state];
+                if (!lexeme)
+                    atomicMin(first_rejected, (unsigned long long) out);
+                ends[out] = idx;
+                lexemes[out] = lexeme;
+                begins[out + 1] = idx;
+                ++out;
+            }
+            state = next.result_state;
+        }
     }
 }
 
+namespace {
+    const dim3 BLOCK_SIZE(256);
+    const dim3 NUM_BLOCKS(1200);
+    const size_t N_THREADS = BLOCK_SIZE.x * NUM_BLOCKS.x;
+
+    size_t tile_size_for(size_t input_length) {
+        return std::max(MIN_TILE_SIZE, (input_length + N_THREADS - 1) / N_THREADS);
+    }
+}
+
+void CudaWorkspace::reserve(size_t input_length, size_t num_tiles) {
+    this->input.reserve(input_length);
+    this->aggregates.reserve(num_tiles);
+    this->first_invalid.reserve(1);
+    this->counts.reserve(num_tiles + 1);
+    this->first_rejected.reserve(1);
+    this->host_aggregates.reserve(num_tiles);
+    this->host_counts.reserve(num_tiles + 1);
+}
+
+void CudaWorkspace::reserve_tokens(size_t num_tokens) {
+    this->begins.reserve(num_tokens);
+    this->ends.reserve(num_tokens);
+    this->lexemes.reserve(num_tokens);
+}
+
+void CudaWorkspace::release() {
+    this->input.release();
+    this->aggregates.release();
+    this->first_invalid.release();
+    this->counts.release();
+    this->first_rejected.release();
+    this->begins.release();
+    this->ends.release();
+    this->lexemes.release();
+    this->host_aggregates.release();
+    this->host_counts.release();
+}
+
 void CudaLexer::map_trans()
 {
-    char *d_input;
-    lexer::ParallelLexer::Transition *d_initial_states;
-    size_t d_initial_states_size = initial_states.size() * sizeof(lexer::ParallelLexer::Transition);
-    size_t d_trans_size = (input.length() + 1) * sizeof(lexer::ParallelLexer::Transition);
     size_t d_input_size = input.length() * sizeof(char);
-    cudaMalloc(&d_initial_states, d_initial_states_size);
-    cudaMalloc(&d_trans, d_trans_size);
-    cudaMalloc(&d_input, d_input_size);
 
-    cudaMemcpy(d_input, input.c_str(), d_input_size, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_initial_states, initial_states.data(), d_initial_states_size, cudaMemcpyHostToDevice);
+    this->tile_size = tile_size_for(input.length());
+    this->num_tiles = (input.length() + this->tile_size - 1) / this->tile_size;
+    this->workspace.reserve(input.length(), this->num_tiles);
+
+    {
+        StageTimer timer(&this->profile, "h2d", d_input_size);
+        cudaMemcpy(workspace.input.data(), input.data(), d_input_size, cudaMemcpyHostToDevice);
+    }
+
+    unsigned long long *d_first_invalid = nullptr;
+    unsigned long long first_invalid = ULLONG_MAX;
+    if (this->utf8_validation) {
+        d_first_invalid = workspace.first_invalid.data();
+        cudaMemcpy(d_first_invalid, &first_invalid, sizeof(unsigned long long), cudaMemcpyHostToDevice);
+    }
 
-    dim3 block_size(256);
-    dim3 num_blocks(1200);
-    size_t N_THREADS = block_size.x * num_blocks.x;
-    map_trans_kernel<<<num_blocks, block_size>>>(d_trans, d_initial_states, d_input, input.length(), N_THREADS);
+    {
+        StageTimer timer(&this->profile, "map", input.length());
+        reduce_tiles_kernel<<<NUM_BLOCKS, BLOCK_SIZE>>>(
+            workspace.aggregates.data(), workspace.initial_states.data(), workspace.merge_table.data(), num_states,
+            workspace.input.data(), input.length(), tile_size, d_first_invalid, N_THREADS
+        );
 
-    cudaDeviceSynchronize();
+        cudaDeviceSynchronize();
+    }
 
     cudaError_t error = cudaGetLastError();
     if (error != cudaSuccess) {
         std::cerr << "CUDA error: " << cudaGetErrorString(error) << std::endl;
     }
 
-    cudaFree(d_input);
-    cudaFree(d_initial_states);
+    if (this->utf8_validation) {
+        cudaMemcpy(&first_invalid, d_first_invalid, sizeof(unsigned long long), cudaMemcpyDeviceToHost);
+        if (first_invalid != ULLONG_MAX)
+            report_error(lexer::LexError::Type::INVALID_UTF8, first_invalid);
+    }
 }
 
 void CudaLexer::compute_prefix()
 {
-    lexer::ParallelLexer::Transition *d_prefix;
-    cudaMalloc(&d_prefix, (input.length() + 1) * sizeof(lexer::ParallelLexer::Transition));
+    // One aggregate per tile, few enough to compose on the host.
+    size_t d_aggregates_size = this->num_tiles * sizeof(lexer::ParallelLexer::Transition);
+    auto *aggregates = workspace.host_aggregates.data();
 
-    lexer::ParallelLexer::Transition *d_merge_table;
-    size_t d_merge_table_size = this->num_states * this->num_states * sizeof(lexer::ParallelLexer::Transition);
-    cudaMalloc(&d_merge_table, d_merge_table_size);
-
-    cudaMemcpy(d_merge_table, this->merge_table, d_merge_table_size, cudaMemcpyHostToDevice);
-
-    dim3 block_size(256);
-    dim3 num_blocks(1200);
-    size_t N_THREADS = block_size.x * num_blocks.x;
-    // __global__ void prefix_step_kernel(
-    //     lexer::ParallelLexer::Transition *start,
-    //     lexer::ParallelLexer::Transition *prefix,
-    //     lexer::ParallelLexer::Transition *merge_table,
-    //     size_t num_states,
-    //     size_t step_size,
-    //     size_t input_length,
-    //     size_t N_THREADS,
-    // )
-    for (size_t step_size = 1; step_size < input.length(); step_size <<= 1) {
-        prefix_step_kernel<<<num_blocks, block_size>>>(
-            d_trans, d_prefix, d_merge_table, num_states, step_size, input.length(), N_THREADS
-        );
+    {
+        StageTimer timer(&this->profile, "d2h", d_aggregates_size);
+        cudaMemcpy(aggregates, workspace.aggregates.data(), d_aggregates_size, cudaMemcpyDeviceToHost);
+    }
+
+    {
+        StageTimer timer(&this->profile, "scan", input.length());
+        for (size_t tile = 1; tile < this->num_tiles; ++tile)
+            aggregates[tile] = this->merge_table[aggregates[tile - 1].result_state + aggregates[tile].result_state * this->num_states];
+    }
+
+    {
+        StageTimer timer(&this->profile, "h2d", d_aggregates_size);
+        cudaMemcpy(workspace.aggregates.data(), aggregates, d_aggregates_size, cudaMemcpyHostToDevice);
+    }
+}
 
+void CudaLexer::extract_results(lexer::TokenStream &tokens)
+{
+    size_t d_counts_size = (this->num_tiles + 1) * sizeof(size_t);
+    auto *counts = workspace.host_counts.data();
+
+    {
+        StageTimer timer(&this->profile, "count", input.length());
+        count_tokens_kernel<<<NUM_BLOCKS, BLOCK_SIZE>>>(
+            workspace.counts.data(),
+            workspace.aggregates.data(),
+            workspace.initial_states.data(),
+            workspace.merge_table.data(),
+            num_states,
+            workspace.input.data(),
+            input.length(),
+            tile_size,
+            N_THREADS
+        );
         cudaDeviceSynchronize();
-        cudaError_t error = cudaGetLastError();
-        if (error != cudaSuccess) {
-            std::cerr << "CUDA error: " << cudaGetErrorString(error) << std::endl;
-        }
+    }
 
-        auto tmp = d_trans;
-        d_trans = d_prefix;
-        d_prefix = tmp;
+    {
+        StageTimer timer(&this->profile, "d2h", d_counts_size);
+        cudaMemcpy(counts, workspace.counts.data(), this->num_tiles * sizeof(size_t), cudaMemcpyDeviceToHost);
     }
 
-    prefix_step_kernel<<<num_blocks, block_size>>>(
-        d_trans, d_prefix, d_merge_table, num_states, input.length(), input.length(), N_THREADS
-    );
+    // The offset in the stream of the first token that ends in every tile. Like the aggregates,
+    // there are few enough of these to scan on the host.
+    {
+        StageTimer timer(&this->profile, "scan", this->num_tiles);
+        size_t total = 0;
+        for (size_t tile = 0; tile < this->num_tiles; ++tile) {
+            size_t count = counts[tile];
+            counts[tile] = total;
+            total += count;
+        }
+        counts[this->num_tiles] = total;
+    }
 
-    cudaFree(d_prefix);
-    cudaFree(d_merge_table);
-}
+    size_t total = counts[this->num_tiles];
+    workspace.reserve_tokens(total + 1);
+
+    unsigned long long first_rejected = ULLONG_MAX;
+    {
+        StageTimer timer(&this->profile, "h2d", d_counts_size);
+        cudaMemcpy(workspace.counts.data(), counts, d_counts_size, cudaMemcpyHostToDevice);
+        cudaMemcpy(workspace.first_rejected.data(), &first_rejected, sizeof(unsigned long long), cudaMemcpyHostToDevice);
+    }
+
+    {
+        StageTimer timer(&this->profile, "extract", input.length());
+        write_tokens_kernel<<<NUM_BLOCKS, BLOCK_SIZE>>>(
+            workspace.counts.data(),
+            workspace.aggregates.data(),
+            workspace.initial_states.data(),
+            workspace.merge_table.data(),
+            num_states,
+            workspace.final_states.data(),
+            workspace.input.data(),
+            input.length(),
+            tile_size,
+            workspace.begins.data(),
+            workspace.ends.data(),
+            workspace.lexemes.data(),
+            workspace.first_rejected.data(),
+            N_THREADS
+        );
+        cudaDeviceSynchronize();
+    }
 
-void CudaLexer::extract_results()
-{
-    // __global__ void extract_final_kernel(
-    //     lexer::ParallelLexer::Transition *trans,
-    //     lexer::Lexeme **final_states,
-    //     lexer::Lexeme **res,
-    //     bool *res_is_token
-    //     unsigned long long *count,
-    //     size_t input_length,
-    //     size_t N_THREADS
-    // )
-    lexer::Lexeme **d_final_states;
-    lexer::Lexeme **d_res;
-    bool *d_res_is_token;
-    size_t d_final_states_size = final_states.size() * sizeof(lexer::Lexeme*);
-    size_t d_res_size = (input.length() + 1) * sizeof(lexer::Lexeme*);
-    size_t d_res_is_token_size = (input.length() + 1) * sizeof(bool);
-    cudaMalloc(&d_final_states, d_final_states_size);
-    cudaMalloc(&d_res, d_res_size);
-    cudaMalloc(&d_res_is_token, d_res_is_token_size);
-
-    cudaMemcpy(d_final_states, final_states.data(), d_final_states_size, cudaMemcpyHostToDevice);
-
-    dim3 block_size(256);
-    dim3 num_blocks(1200);
-    size_t N_THREADS = block_size.x * num_blocks.x;
-    extract_final_kernel<<<num_blocks, block_size>>>(
-        d_trans,
-        d_final_states,
-        d_res,
-        d_res_is_token,
-        input.length(),
-        N_THREADS
-    );
-    cudaDeviceSynchronize();
-    
     cudaError_t error = cudaGetLastError();
     if (error != cudaSuccess) {
         std::cerr << "CUDA error: " << cudaGetErrorString(error) << std::endl;
     }
 
-    res = (lexer::Lexeme **) malloc((input.length() + 1) * sizeof(lexer::Lexeme *));
-    res_is_token = (bool *) malloc((input.length() + 1) * sizeof(bool));
-
-    cudaMemcpy(res, d_res, input.length() * sizeof(lexer::Lexeme *), cudaMemcpyDeviceToHost);
-    cudaMemcpy(res_is_token, d_res_is_token, (input.length() + 1) * sizeof(bool), cudaMemcpyDeviceToHost);
-
-    res_is_token = res_is_token + 1;
+    // The tokens are copied straight into the stream, followed by the last token, which always
+    // ends at the end of the input.
+    auto base = tokens.size();
+    tokens.begins.resize(base + total + 1);
+    tokens.ends.resize(base + total + 1);
+    tokens.lexemes.resize(base + total + 1);
+
+    {
+        StageTimer timer(&this->profile, "d2h", total * (2 * sizeof(size_t) + sizeof(lexer::Lexeme *)) + sizeof(size_t));
+        cudaMemcpy(tokens.begins.data() + base, workspace.begins.data(), (total + 1) * sizeof(size_t), cudaMemcpyDeviceToHost);
+        cudaMemcpy(tokens.ends.data() + base, workspace.ends.data(), total * sizeof(size_t), cudaMemcpyDeviceToHost);
+        cudaMemcpy(tokens.lexemes.data() + base, workspace.lexemes.data(), total * sizeof(lexer::Lexeme *), cudaMemcpyDeviceToHost);
+        cudaMemcpy(&first_rejected, workspace.first_rejected.data(), sizeof(unsigned long long), cudaMemcpyDeviceToHost);
+    }
 
-    cudaFree(d_final_states);
-    cudaFree(d_res);
-    cudaFree(d_res_is_token);
+    const auto *last = this->final_states[workspace.host_aggregates.data()[this->num_tiles - 1].result_state];
+    tokens.ends[base + total] = input.length();
+    tokens.lexemes[base + total] = last;
 
-    cudaFree(d_trans);
+    if (first_rejected != ULLONG_MAX)
+        report_error(lexer::LexError::Type::REJECTED, tokens.begins[base + first_rejected]);
+    else if (!last)
+        report_error(lexer::LexError::Type::REJECTED, tokens.begins[base + total]);
 }
 
-CudaLexer::CudaLexer(lexer::ParallelLexer &lexer) {
+CudaLexer::CudaLexer(const lexer::ParallelLexer &lexer, bool utf8_validation): utf8_validation(utf8_validation) {
     this->initial_states = lexer.initial_states;
     this->num_states = lexer.merge_table.states();
     this->merge_table = (lexer::ParallelLexer::Transition*) malloc(this->num_states * this->num_states * sizeof(lexer::ParallelLexer::Transition));
@@ -205,34 +398,101 @@ CudaLexer::CudaLexer(lexer::ParallelLexer &lexer) {
         }
     }
     this->final_states = lexer.final_states;
+
+    // The tables do not change, so they are uploaded once.
+    size_t d_initial_states_size = initial_states.size() * sizeof(lexer::ParallelLexer::Transition);
+    size_t d_merge_table_size = this->num_states * this->num_states * sizeof(lexer::ParallelLexer::Transition);
+    size_t d_final_states_size = final_states.size() * sizeof(lexer::Lexeme*);
+    cudaMemcpy(workspace.initial_states.reserve(initial_states.size()), initial_states.data(), d_initial_states_size, cudaMemcpyHostToDevice);
+    cudaMemcpy(workspace.merge_table.reserve(this->num_states * this->num_states), this->merge_table, d_merge_table_size, cudaMemcpyHostToDevice);
+    cudaMemcpy(workspace.final_states.reserve(final_states.size()), final_states.data(), d_final_states_size, cudaMemcpyHostToDevice);
+}
+
+CudaLexer::~CudaLexer() {
+    free(this->merge_table);
+}
+
+void CudaLexer::run(std::string_view input, lexer::TokenStream &tokens)
+{
+    this->profile.clear();
+
+    map(input);
+
+    scan();
+
+    extract_results(tokens);
 }
 
 void CudaLexer::lex_cuda(std::string input)
 {
-    this->input = input;
-    
+    auto tokens = lexer::TokenStream();
+
     clock_t start = clock();
+    run(input, tokens);
+    clock_t end = clock();
+
+    printf("CUDA Running Time: %lf s\n", ((double)(end - start))/ CLOCKS_PER_SEC);
+
+    print_token_table(tokens);
+
+    if (this->error.has_value()) {
+        const char *what = this->error->type == lexer::LexError::Type::INVALID_UTF8 ? "Invalid UTF-8" : "Rejected input";
+        printf("%s at offset %zu\n", what, this->error->offset);
+    }
+}
+
+const char *CudaLexer::name() const {
+    return "cuda";
+}
+
+void CudaLexer::reserve(size_t input_length) {
+    size_t tile_size = tile_size_for(input_length);
+    this->workspace.reserve(input_length, (input_length + tile_size - 1) / tile_size);
+}
+
+void CudaLexer::release() {
+    this->workspace.release();
+}
+
+void CudaLexer::map(std::string_view input) {
+    this->input = input;
+    this->error.reset();
+
     map_trans();
+}
 
+void CudaLexer::scan() {
     compute_prefix();
+}
 
-    extract_results();
-    clock_t end = clock();
+void CudaLexer::extract(lexer::TokenStream &tokens) {
+    extract_results(tokens);
 
-    printf("CUDA Running Time: %lf s\n", ((double)(end - start))/ CLOCKS_PER_SEC);
+    if (this->error.has_value())
+        tokens.report_error(this->error->type, this->error->offset);
+}
 
-    print_token_table();
+std::optional<lexer::LexError> CudaLexer::last_error() const {
+    return this->error;
 }
 
-void CudaLexer::print_token_table() {
-    std::unordered_map<lexer::Lexeme *, int> mp;
-    for (int i = 0; i < input.length(); i++) {
-        if (res_is_token[i]) {
-            if (mp.find(res[i]) != mp.end()) {
-                mp[res[i]]++;
-            } else {
-                mp[res[i]] = 1;
-            }
+void CudaLexer::report_error(lexer::LexError::Type type, size_t offset) {
+    if (!this->error.has_value() || offset < this->error->offset)
+        this->error = lexer::LexError{type, offset};
+}
+
+void CudaLexer::print_token_table(const lexer::TokenStream &tokens) {
+    StageTimer timer(&this->profile, "histogram", input.length());
+    std::unordered_map<const lexer::Lexeme *, int> mp;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        timer.add_count(1);
+        // A null lexeme means the token was rejected, which extract_results has reported.
+        if (!tokens.lexemes[i])
+            continue;
+        if (mp.find(tokens.lexemes[i]) != mp.end()) {
+            mp[tokens.lexemes[i]]++;
+        } else {
+            mp[tokens.lexemes[i]] = 1;
         }
     }
 
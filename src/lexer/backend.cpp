@@ -0,0 +1,17 @@
+#include "lexer/backend.hpp"
+
+namespace lexer {
+    void LexerBackend::lex(std::string_view input, TokenStream& tokens) {
+        this->profile.clear();
+        if (input.empty())
+            return;
+
+        this->map(input);
+        this->scan();
+        this->extract(tokens);
+    }
+
+    const Profile& LexerBackend::last_profile() const {
+        return this->profile;
+    }
+}
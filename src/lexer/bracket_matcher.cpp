@@ -0,0 +1,186 @@
+#include "lexer/bracket_matcher.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+    constexpr const size_t MIN_CHUNK_SIZE = 1 << 14;
+
+    struct Bracket {
+        size_t token;
+        int32_t kind;
+        ptrdiff_t level;
+    };
+
+    struct Chunk {
+        std::vector<Bracket> brackets;
+        ptrdiff_t depth_delta = 0;
+
+        // Range of non-negative levels in this chunk. For each of them, first the number of brackets
+        // at that level and later the position in the sorted array the next one is written to.
+        ptrdiff_t min_level = std::numeric_limits<ptrdiff_t>::max();
+        ptrdiff_t max_level = -1;
+        std::vector<size_t> offsets;
+
+        size_t first_error = lexer::BracketMatches::NO_MATCH;
+    };
+}
+
+namespace lexer {
+    bool BracketMatches::balanced() const {
+        return !this->first_error.has_value();
+    }
+
+    BracketMatcher::BracketMatcher(const LexicalGrammar* g, const std::vector<BracketPair>& pairs):
+        kinds(g->lexemes.size(), 0), g(g) {
+        auto lookup = [&](const std::string& name) {
+            auto* lexeme = g->find_lexeme(name);
+            if (!lexeme)
+                throw UnknownLexemeError(name);
+            return g->lexeme_id(lexeme);
+        };
+
+        for (size_t p = 0; p < pairs.size(); ++p) {
+            this->kinds[lookup(pairs[p].open)] = p + 1;
+            this->kinds[lookup(pairs[p].close)] = -static_cast<int32_t>(p + 1);
+        }
+    }
+
+    int32_t BracketMatcher::kind(const Lexeme* lexeme) const {
+        if (!lexeme)
+            return 0;
+        return this->kinds[this->g->lexeme_id(lexeme)];
+    }
+
+    BracketMatches BracketMatcher::match(const TokenStream& tokens, ThreadPool& pool) const {
+        constexpr const size_t NO_MATCH = BracketMatches::NO_MATCH;
+
+        auto result = BracketMatches{std::vector<size_t>(tokens.size(), NO_MATCH), std::nullopt};
+
+        auto num_chunks = pool.chunk_count(tokens.size(), MIN_CHUNK_SIZE);
+        auto chunks = std::vector<Chunk>(num_chunks);
+
+        // Collect the brackets of each chunk, and by how much the chunk changes the depth.
+        pool.for_each_chunk(tokens.size(), num_chunks, [&](size_t c, size_t begin, size_t end) {
+            auto& chunk = chunks[c];
+            for (size_t i = begin; i < end; ++i) {
+                auto kind = this->kind(tokens.lexemes[i]);
+                if (kind == 0)
+                    continue;
+
+                chunk.brackets.push_back({i, kind, 0});
+                chunk.depth_delta += kind > 0 ? 1 : -1;
+            }
+        });
+
+        // Exclusive scan over the chunks to find the depth at which each of them starts.
+        auto start_depths = std::vector<ptrdiff_t>(num_chunks);
+        {
+            ptrdiff_t depth = 0;
+            for (size_t c = 0; c < num_chunks; ++c) {
+                start_depths[c] = depth;
+                depth += chunks[c].depth_delta;
+            }
+        }
+
+        // The level of an opener is the depth before it, and the level of a closer the depth after
+        // it. Matching brackets then share a level, and in the order of the input every level alternates
+        // between an opener and the closer matching it. Closers at a negative level have no opener.
+        pool.parallel_for(num_chunks, [&](size_t c) {
+            auto& chunk = chunks[c];
+            auto depth = start_depths[c];
+            for (auto& bracket : chunk.brackets) {
+                bracket.level = bracket.kind > 0 ? depth++ : --depth;
+                if (bracket.level < 0) {
+                    chunk.first_error = std::min(chunk.first_error, bracket.token);
+                    continue;
+                }
+
+                chunk.min_level = std::min(chunk.min_level, bracket.level);
+                chunk.max_level = std::max(chunk.max_level, bracket.level);
+            }
+
+            if (chunk.max_level < 0)
+                return;
+
+            chunk.offsets.resize(chunk.max_level - chunk.min_level + 1, 0);
+            for (const auto& bracket : chunk.brackets) {
+                if (bracket.level >= 0)
+                    ++chunk.offsets[bracket.level - chunk.min_level];
+            }
+        });
+
+        // Turn the per-chunk counts into the positions at which each chunk writes its brackets into an
+        // array that is stably sorted by level. The level range of a chunk is bounded by its size,
+        // so this only touches as many counters as there are brackets.
+        ptrdiff_t num_levels = 0;
+        for (const auto& chunk : chunks)
+            num_levels = std::max(num_levels, chunk.max_level + 1);
+
+        auto level_offsets = std::vector<size_t>(num_levels + 1, 0);
+        for (const auto& chunk : chunks) {
+            for (size_t i = 0; i < chunk.offsets.size(); ++i)
+                level_offsets[chunk.min_level + i + 1] += chunk.offsets[i];
+        }
+
+        for (ptrdiff_t level = 0; level < num_levels; ++level)
+            level_offsets[level + 1] += level_offsets[level];
+
+        for (auto& chunk : chunks) {
+            for (size_t i = 0; i < chunk.offsets.size(); ++i) {
+                auto count = chunk.offsets[i];
+                chunk.offsets[i] = level_offsets[chunk.min_level + i];
+                level_offsets[chunk.min_level + i] += count;
+            }
+        }
+
+        auto num_sorted = level_offsets[num_levels];
+        auto sorted = std::vector<Bracket>(num_sorted);
+        pool.parallel_for(num_chunks, [&](size_t c) {
+            auto& chunk = chunks[c];
+            for (const auto& bracket : chunk.brackets) {
+                if (bracket.level >= 0)
+                    sorted[chunk.offsets[bracket.level - chunk.min_level]++] = bracket;
+            }
+        });
+
+        // Pair every opener with the bracket following it at the same level, which is necessarily
+        // a closer. An opener without such a bracket is never closed.
+        auto num_pair_chunks = pool.chunk_count(num_sorted, MIN_CHUNK_SIZE);
+        auto pair_errors = std::vector<size_t>(num_pair_chunks, NO_MATCH);
+        pool.for_each_chunk(num_sorted, num_pair_chunks, [&](size_t c, size_t begin, size_t end) {
+            auto& first_error = pair_errors[c];
+            for (size_t i = begin; i < end; ++i) {
+                const auto& open = sorted[i];
+                if (open.kind < 0)
+                    continue;
+
+                if (i + 1 == num_sorted || sorted[i + 1].level != open.level) {
+                    first_error = std::min(first_error, open.token);
+                    continue;
+                }
+
+                const auto& close = sorted[i + 1];
+                assert(close.kind < 0);
+                if (close.kind != -open.kind) {
+                    first_error = std::min(first_error, close.token);
+                    continue;
+                }
+
+                result.partners[open.token] = close.token;
+                result.partners[close.token] = open.token;
+            }
+        });
+
+        auto first_error = NO_MATCH;
+        for (const auto& chunk : chunks)
+            first_error = std::min(first_error, chunk.first_error);
+        for (auto error : pair_errors)
+            first_error = std::min(first_error, error);
+
+        if (first_error != NO_MATCH)
+            result.first_error = first_error;
+
+        return result;
+    }
+}
@@ -0,0 +1,152 @@
+#include "lexer/direct_lexer.hpp"
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/fsa.hpp"
+#include "utf8.hpp"
+
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <cstdio>
+
+namespace {
+    using lexer::DirectLexer;
+    using lexer::FiniteStateAutomaton;
+    using StateIndex = FiniteStateAutomaton::StateIndex;
+
+    // Filled in by the static initializers of the generated lexers, before main.
+    std::vector<const DirectLexer*>& registered_lexers() {
+        static auto lexers = std::vector<const DirectLexer*>();
+        return lexers;
+    }
+
+    std::string byte_literal(size_t c) {
+        char buffer[8];
+        snprintf(buffer, sizeof(buffer), "0x%02zX", c);
+        return buffer;
+    }
+
+    // Writes the block of one state. On entry the input before i has been consumed; the block
+    // consumes input[i] and jumps to the next state, or finishes the last token at the end.
+    void generate_state(std::ostream& out, const lexer::LexicalGrammar* g, const FiniteStateAutomaton& dfa, StateIndex state) {
+        auto lexeme_expr = [&](const lexer::Lexeme* lexeme) {
+            return lexeme ? "lexemes + " + std::to_string(g->lexeme_id(lexeme)) : std::string("nullptr");
+        };
+
+        out << "    state_" << state << ":\n";
+
+        // Nothing leaves REJECT, so the rest of the input is the last token.
+        if (state == FiniteStateAutomaton::REJECT) {
+            out << "        tokens.push_back(nullptr, token_begin, n);\n";
+            out << "        return;\n";
+            return;
+        }
+
+        out << "        if (i == n) {\n";
+        out << "            tokens.push_back(" << lexeme_expr(dfa.lexemes[state]) << ", token_begin, n);\n";
+        out << "            return;\n";
+        out << "        }\n";
+        out << "        switch (static_cast<uint8_t>(input[i++])) {\n";
+
+        // The bytes of every distinct target, where bytes without a transition go to REJECT. The
+        // most common target becomes the default.
+        auto byte_targets = std::vector<std::pair<StateIndex, bool>>(FiniteStateAutomaton::MAX_SYM + 1, {FiniteStateAutomaton::REJECT, false});
+        for (const auto& t : dfa.transitions(state))
+            byte_targets[t.sym] = {t.dst, t.produces_lexeme};
+
+        auto targets = std::map<std::pair<StateIndex, bool>, std::vector<size_t>>();
+        for (size_t c = 0; c < byte_targets.size(); ++c)
+            targets[byte_targets[c]].push_back(c);
+
+        auto default_target = targets.begin()->first;
+        for (const auto& [target, syms] : targets) {
+            if (syms.size() > targets[default_target].size())
+                default_target = target;
+        }
+
+        auto jump = [&](std::pair<StateIndex, bool> target, const char* indent) {
+            auto [dst, produces_lexeme] = target;
+            if (produces_lexeme) {
+                out << indent << "tokens.push_back(" << lexeme_expr(dfa.lexemes[state]) << ", token_begin, i - 1);\n";
+                out << indent << "token_begin = i - 1;\n";
+            }
+            out << indent << "goto state_" << dst << ";\n";
+        };
+
+        for (const auto& [target, syms] : targets) {
+            if (target == default_target)
+                continue;
+            for (size_t k = 0; k < syms.size(); ++k)
+                out << (k % 8 == 0 ? "            " : " ") << "case " << byte_literal(syms[k]) << ":" << (k % 8 == 7 || k + 1 == syms.size() ? "\n" : "");
+            jump(target, "                ");
+        }
+
+        out << "            default:\n";
+        jump(default_target, "                ");
+        out << "        }\n";
+    }
+}
+
+namespace lexer {
+    void DirectLexer::lex(std::string_view input, const LexicalGrammar& g, TokenStream& tokens, bool utf8_validation) const {
+        if (input.empty())
+            return;
+
+        // Reported first, so that it wins over rejected input at the same offset, as in LexerInterpreter.
+        if (utf8_validation) {
+            if (auto offset = validate_utf8(input))
+                tokens.report_error(LexError::Type::INVALID_UTF8, offset.value());
+        }
+
+        this->lex_fn(input.data(), input.size(), tokens, g.lexemes.data());
+    }
+
+    DirectLexer::Registration::Registration(const DirectLexer* lexer) {
+        registered_lexers().push_back(lexer);
+    }
+
+    const DirectLexer* DirectLexer::find(uint64_t grammar_hash) {
+        for (const auto* lexer : registered_lexers()) {
+            if (lexer->grammar_hash == grammar_hash)
+                return lexer;
+        }
+        return nullptr;
+    }
+
+    void generate_direct_lexer(std::ostream& out, const LexicalGrammar* g, uint64_t grammar_hash, const std::string& name) {
+        auto dfa = FiniteStateAutomaton::build_lexer_dfa(g);
+
+        // Only the states which are jumped to get a block, which leaves out the successor roots.
+        auto reachable = std::set<StateIndex>{FiniteStateAutomaton::START};
+        for (size_t src = 0; src < dfa.num_states(); ++src) {
+            for (const auto& t : dfa.transitions(src))
+                reachable.insert(t.dst);
+            if (dfa.transitions(src).size() < FiniteStateAutomaton::MAX_SYM + 1)
+                reachable.insert(FiniteStateAutomaton::REJECT);
+        }
+
+        char hash[32];
+        snprintf(hash, sizeof(hash), "0x%016llxULL", static_cast<unsigned long long>(grammar_hash));
+
+        out << "// Generated by gen_direct_lexer from the grammar '" << name << "', do not edit.\n";
+        out << "// " << dfa.num_states() << " DFA states, of which " << reachable.size() << " are reachable.\n\n";
+        out << "#include \"lexer/direct_lexer.hpp\"\n";
+        out << "#include \"lexer/lexical_grammar.hpp\"\n\n";
+        out << "#include <cstdint>\n\n";
+        out << "namespace {\n";
+        out << "    void lex(const char* input, size_t n, lexer::TokenStream& tokens, const lexer::Lexeme* lexemes) {\n";
+        out << "        size_t i = 0;\n";
+        out << "        size_t token_begin = 0;\n";
+        out << "        goto state_" << FiniteStateAutomaton::START << ";\n\n";
+
+        for (auto state : reachable) {
+            generate_state(out, g, dfa, state);
+            out << "\n";
+        }
+
+        out << "    }\n\n";
+        out << "    const lexer::DirectLexer direct_lexer = {\"" << name << "\", " << hash << ", lex};\n";
+        out << "    const lexer::DirectLexer::Registration registration(&direct_lexer);\n";
+        out << "}\n";
+    }
+}
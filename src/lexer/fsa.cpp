@@ -1,7 +1,10 @@
-#include <unordered_set>
-#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <array>
 #include <bitset>
+#include <deque>
 #include <iostream>
+#include <cassert>
 
 #include "lexer/fsa.hpp"
 #include "lexer/lexical_grammar.hpp"
@@ -12,9 +15,10 @@ using StateIndex = lexer::FiniteStateAutomaton::StateIndex;
 
 namespace lexer
 {
+    // Set of NFA states, kept sorted so that it can be compared and hashed directly.
     struct StateSet
     {
-        std::unordered_set<StateIndex> states;
+        std::vector<StateIndex> states;
 
         struct Hash
         {
@@ -24,7 +28,7 @@ namespace lexer
 
     size_t StateSet::Hash::operator()(const StateSet &ss) const
     {
-        return hash_order_independent_range(ss.states.begin(), ss.states.end(), std::hash<StateIndex>{});
+        return hash_range(ss.states.begin(), ss.states.end(), std::hash<StateIndex>{});
     }
 
     bool operator==(const StateSet &lhs, const StateSet &rhs)
@@ -32,64 +36,104 @@ namespace lexer
         return lhs.states == rhs.states;
     }
 
+    // Working memory of the subset construction, which is reused for every state set so that
+    // the inner loops do not allocate.
+    struct SubsetScratch
+    {
+        // The generation in which each NFA state was last added to a closure.
+        std::vector<uint32_t> visited;
+        uint32_t generation = 0;
+        std::vector<StateIndex> stack;
+
+        // Destinations of the transitions out of a state set, bucketed by symbol, and the
+        // symbols which have a non-empty bucket.
+        std::array<std::vector<StateIndex>, FiniteStateAutomaton::MAX_SYM + 1> moves;
+        std::vector<Symbol> follow;
+
+        SubsetScratch(size_t nfa_states) : visited(nfa_states, 0) {}
+    };
+
     // epsilon closure
-    void closure(const FiniteStateAutomaton &fsa, StateSet &ss)
+    StateSet closure(const FiniteStateAutomaton &fsa, const std::vector<StateIndex> &states, SubsetScratch &scratch)
     {
-        auto queue = std::deque<StateIndex>();
-        for (auto state : ss.states)
-            queue.push_back(state);
+        auto ss = StateSet{};
+        auto generation = ++scratch.generation;
 
         auto enqueue = [&](StateIndex state)
         {
-            auto inserted = ss.states.insert(state).second;
-            if (inserted)
-                queue.push_back(state);
+            if (scratch.visited[state] == generation)
+                return;
+            scratch.visited[state] = generation;
+            scratch.stack.push_back(state);
         };
 
-        while (!queue.empty())
+        for (auto state : states)
+            enqueue(state);
+
+        while (!scratch.stack.empty())
         {
-            auto src = queue.front();
-            queue.pop_front();
+            auto src = scratch.stack.back();
+            scratch.stack.pop_back();
+            ss.states.push_back(src);
 
-            for (const auto &[maybe_sym, dst, _] : fsa[src].transitions)
+            for (const auto &t : fsa.transitions(src))
             {
-                if (!maybe_sym.has_value())
-                    enqueue(dst);
+                if (t.is_epsilon())
+                    enqueue(t.dst);
             }
         }
+
+        std::sort(ss.states.begin(), ss.states.end());
+        return ss;
     }
 
-    std::unordered_set<Symbol> follow(const FiniteStateAutomaton &fsa, const StateSet &ss)
+    // Computes the move of ss over every symbol at once, into scratch.moves and scratch.follow.
+    void move(const FiniteStateAutomaton &fsa, const StateSet &ss, SubsetScratch &scratch)
     {
+        for (auto sym : scratch.follow)
+            scratch.moves[sym].clear();
+        scratch.follow.clear();
+
         // Epsilon-transitions should already be dealt with at this point
-        auto syms = std::unordered_set<Symbol>();
         for (auto src : ss.states)
         {
-            for (const auto &[maybe_sym, dst, _] : fsa[src].transitions)
+            for (const auto &t : fsa.transitions(src))
             {
-                if (maybe_sym.has_value())
-                    syms.insert(maybe_sym.value());
+                if (t.is_epsilon())
+                    continue;
+
+                auto &bucket = scratch.moves[t.sym];
+                if (bucket.empty())
+                    scratch.follow.push_back(t.sym);
+                bucket.push_back(t.dst);
             }
         }
-        return syms;
+
+        std::sort(scratch.follow.begin(), scratch.follow.end());
     }
 
-    StateSet move(const FiniteStateAutomaton &fsa, const StateSet &ss, Symbol move_sym)
+    bool FiniteStateAutomaton::Transition::is_epsilon() const
     {
-        auto after_move = StateSet{};
-        for (auto src : ss.states)
-        {
-            for (const auto &[sym, dst, _] : fsa[src].transitions)
-            {
-                if (sym == move_sym)
-                    after_move.states.insert(dst);
-            }
-        }
+        return this->sym == EPSILON;
+    }
 
-        return after_move;
+    auto FiniteStateAutomaton::TransitionRange::begin() const -> const Transition *
+    {
+        return this->first;
+    }
+
+    auto FiniteStateAutomaton::TransitionRange::end() const -> const Transition *
+    {
+        return this->last;
     }
 
-    FiniteStateAutomaton::FiniteStateAutomaton()
+    size_t FiniteStateAutomaton::TransitionRange::size() const
+    {
+        return this->last - this->first;
+    }
+
+    FiniteStateAutomaton::FiniteStateAutomaton():
+        offsets{0}
     {
         assert(this->add_state() == REJECT);
         assert(this->add_state() == START);
@@ -97,14 +141,14 @@ namespace lexer
 
     size_t FiniteStateAutomaton::num_states() const
     {
-        return this->states.size();
+        return this->lexemes.size();
     }
 
     StateIndex FiniteStateAutomaton::add_state()
     {
         StateIndex index = this->num_states();
-        this->states.push_back({.lexeme = nullptr,
-                                .transitions = {}});
+        this->lexemes.push_back(nullptr);
+        this->offsets.push_back(this->edges.size());
         return index;
     }
 
@@ -113,7 +157,8 @@ namespace lexer
         assert(src < this->num_states());
         assert(dst < this->num_states());
 
-        this->states[src].transitions.push_back({sym, dst, produces_lexeme});
+        auto symbol = sym.has_value() ? uint16_t{sym.value()} : EPSILON;
+        this->pending.push_back({src, {symbol, dst, produces_lexeme}});
     }
 
     void FiniteStateAutomaton::add_epsilon_transition(StateIndex src, StateIndex dst, bool produces_lexeme)
@@ -121,37 +166,65 @@ namespace lexer
         this->add_transition(src, dst, std::nullopt, produces_lexeme);
     }
 
-    std::optional<StateIndex> FiniteStateAutomaton::find_first_transition_dst(StateIndex src, std::optional<uint8_t> sym) const
+    void FiniteStateAutomaton::finalize()
     {
-        for (const auto t : this->states[src].transitions)
+        if (this->pending.empty())
+            return;
+
+        // Counting sort of the pending transitions by source state, merged with the existing rows.
+        auto offsets = std::vector<uint32_t>(this->num_states() + 1, 0);
+        for (size_t src = 0; src < this->num_states(); ++src)
+            offsets[src + 1] = this->offsets[src + 1] - this->offsets[src];
+        for (const auto &p : this->pending)
+            ++offsets[p.src + 1];
+        for (size_t src = 0; src < this->num_states(); ++src)
+            offsets[src + 1] += offsets[src];
+
+        auto edges = std::vector<Transition>(offsets.back());
+        auto heads = std::vector<uint32_t>(offsets.begin(), offsets.end() - 1);
+        for (size_t src = 0; src < this->num_states(); ++src)
         {
-            if (t.maybe_sym == sym)
-            {
-                return t.dst;
-            }
+            for (const auto &t : this->transitions(src))
+                edges[heads[src]++] = t;
         }
+        for (const auto &p : this->pending)
+            edges[heads[p.src]++] = p.transition;
 
-        return std::nullopt;
+        this->offsets = std::move(offsets);
+        this->edges = std::move(edges);
+        this->pending.clear();
     }
 
-    auto FiniteStateAutomaton::operator[](StateIndex state) -> State &
+    auto FiniteStateAutomaton::transitions(StateIndex src) const -> TransitionRange
     {
-        assert(state < this->num_states());
-        return this->states[state];
+        assert(src < this->num_states());
+        auto *data = this->edges.data();
+        return {data + this->offsets[src], data + this->offsets[src + 1]};
     }
 
-    auto FiniteStateAutomaton::operator[](StateIndex state) const -> const State &
+    std::optional<StateIndex> FiniteStateAutomaton::find_first_transition_dst(StateIndex src, std::optional<uint8_t> sym) const
     {
-        assert(state < this->num_states());
-        return this->states[state];
+        auto symbol = sym.has_value() ? uint16_t{sym.value()} : EPSILON;
+        for (const auto &t : this->transitions(src))
+        {
+            if (t.sym == symbol)
+            {
+                return t.dst;
+            }
+        }
+
+        return std::nullopt;
     }
 
     void FiniteStateAutomaton::to_dfa(const LexicalGrammar *g, FiniteStateAutomaton &dfa, StateIndex nfa_start, StateIndex dfa_start) const
     {
+        assert(this->pending.empty());
+
         auto seen = std::unordered_map<StateSet, StateIndex, StateSet::Hash>();
-        auto queue = std::deque<StateSet>();
+        auto queue = std::deque<std::pair<StateSet, StateIndex>>();
+        auto scratch = SubsetScratch(this->num_states());
 
-        auto enqueue = [&](const StateSet &ss)
+        auto enqueue = [&](StateSet &&ss)
         {
             auto it = seen.find(ss);
             if (it != seen.end())
@@ -159,69 +232,67 @@ namespace lexer
 
             auto state = dfa.add_state();
             seen.insert(it, {ss, state});
-            queue.push_back(ss);
+            queue.push_back({std::move(ss), state});
             return state;
         };
 
         {
-            auto start_ss = StateSet{{nfa_start}};
             // Move over all epsilon-transitions
-            closure(*this, start_ss);
+            auto start_ss = closure(*this, {nfa_start}, scratch);
 
             seen.insert({start_ss, dfa_start});
-            queue.push_back(start_ss);
+            queue.push_back({std::move(start_ss), dfa_start});
         }
 
         while (!queue.empty())
         {
-            auto ss = queue.front();
-            auto src = seen[ss];
+            auto [ss, src] = std::move(queue.front());
             queue.pop_front();
-            auto follow_set = follow(*this, ss);
+            move(*this, ss, scratch);
 
-            for (auto sym : follow_set)
+            for (auto sym : scratch.follow)
             {
-                auto new_ss = move(*this, ss, sym);
                 // Move over all epsilon-transitions
-                closure(*this, new_ss);
-                auto dst = enqueue(new_ss);
+                auto new_ss = closure(*this, scratch.moves[sym], scratch);
+                auto dst = enqueue(std::move(new_ss));
                 dfa.add_transition(src, dst, sym);
             }
         }
 
         for (const auto &[ss, dfa_index] : seen)
         {
-            auto &dfa_state = dfa[dfa_index];
+            auto &dfa_lexeme = dfa.lexemes[dfa_index];
 
             for (auto nfa_index : ss.states)
             {
-                const auto &nfa_state = this->states[nfa_index];
+                const auto *nfa_lexeme = this->lexemes[nfa_index];
 
-                if (nfa_state.lexeme && dfa_state.lexeme)
+                if (nfa_lexeme && dfa_lexeme)
                 {
-                    if (g->lexeme_id(nfa_state.lexeme) < g->lexeme_id(dfa_state.lexeme))
+                    if (g->lexeme_id(nfa_lexeme) < g->lexeme_id(dfa_lexeme))
                     {
-                        dfa_state.lexeme = nfa_state.lexeme;
+                        dfa_lexeme = nfa_lexeme;
                     }
                 }
-                else if (nfa_state.lexeme)
+                else if (nfa_lexeme)
                 {
-                    dfa_state.lexeme = nfa_state.lexeme;
+                    dfa_lexeme = nfa_lexeme;
                 }
             }
         }
     }
 
-    FiniteStateAutomaton FiniteStateAutomaton::build_lexer_dfa(const LexicalGrammar *g)
+    auto FiniteStateAutomaton::build_lexer_nfa(const LexicalGrammar *g) -> LexerNfa
     {
-        auto nfa = FiniteStateAutomaton();
+        auto result = LexerNfa();
+        auto &nfa = result.nfa;
+        auto &succ_nfa_roots = result.successor_roots;
 
-        auto succ_nfa_roots = std::unordered_map<const Lexeme *, StateIndex>();
         for (const auto &lexeme : g->lexemes)
         {
             auto regex_start = nfa.add_state();
             auto regex_end = lexeme.regex->compile(nfa, regex_start);
-            nfa.states[regex_end].lexeme = &lexeme;
+            nfa.lexemes[regex_end] = &lexeme;
 
             if (lexeme.preceded_by.empty())
             {
@@ -254,6 +325,19 @@ namespace lexer
             }
         }
 
+        nfa.finalize();
+        return result;
+    }
+
+    FiniteStateAutomaton FiniteStateAutomaton::build_lexer_dfa(const LexicalGrammar *g)
+    {
+        return build_lexer_dfa(g, build_lexer_nfa(g));
+    }
+
+    FiniteStateAutomaton FiniteStateAutomaton::build_lexer_dfa(const LexicalGrammar *g, const LexerNfa &lexer_nfa)
+    {
+        const auto &nfa = lexer_nfa.nfa;
+
         // Convert the NFA into a DFA, for each root (including start).
         auto dfa = FiniteStateAutomaton();
 
@@ -262,7 +346,7 @@ namespace lexer
 
         // Handle each of the successor roots.
         auto succ_dfa_roots = std::unordered_map<const Lexeme *, StateIndex>();
-        for (const auto [lexeme, nfa_root] : succ_nfa_roots)
+        for (const auto [lexeme, nfa_root] : lexer_nfa.successor_roots)
         {
             auto dfa_root = dfa.add_state();
             succ_dfa_roots.insert({lexeme, dfa_root});
@@ -270,15 +354,19 @@ namespace lexer
             nfa.to_dfa(g, dfa, nfa_root, dfa_root);
         }
 
+        dfa.finalize();
+
         // Now its time to add the lexer loop. For each symbol of each final state that does
         // not already have an outgoing transition, add a new transition by looking up where
         // it goes from the start state. If the lexeme in this final state appears in succ_dfa_roots,
         // look up where it goes from there instead.
+        // The new transitions are pending until the end, so the lookups only see the transitions
+        // of the subset construction.
 
         for (size_t src = 0; src < dfa.num_states(); ++src)
         {
-            auto &state = dfa.states[src];
-            if (!state.lexeme)
+            const auto *lexeme = dfa.lexemes[src];
+            if (!lexeme)
                 continue;
 
             // Empty tokens are not allowed, as this could require the lexer to generate two tokens on a transition.
@@ -286,11 +374,11 @@ namespace lexer
             assert(src != START);
 
             auto outgoing = std::bitset<MAX_SYM + 1>();
-            for (auto &t : state.transitions)
+            for (const auto &t : dfa.transitions(src))
             {
-                assert(t.maybe_sym.has_value());             // Not a DFA.
-                assert(!outgoing.test(t.maybe_sym.value())); // Not a DFA.
-                outgoing.set(t.maybe_sym.value());
+                assert(!t.is_epsilon());     // Not a DFA.
+                assert(!outgoing.test(t.sym)); // Not a DFA.
+                outgoing.set(t.sym);
             }
 
             for (size_t sym = 0; sym < outgoing.size(); ++sym)
@@ -299,7 +387,7 @@ namespace lexer
                     continue;
 
                 // Add a successor edge if required.
-                auto it = succ_dfa_roots.find(state.lexeme);
+                auto it = succ_dfa_roots.find(lexeme);
                 if (it != succ_dfa_roots.end())
                 {
                     // Look up where it goes from the successor root.
@@ -329,6 +417,7 @@ namespace lexer
             }
         }
 
+        dfa.finalize();
         return dfa;
     }
-}
\ No newline at end of file
+}
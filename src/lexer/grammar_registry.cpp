@@ -0,0 +1,253 @@
+#include "lexer/grammar_registry.hpp"
+#include "lexer/lexer_parser.hpp"
+#include "parser.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+    lexer::LexicalGrammar parse_grammar(std::string_view source)
+    {
+        auto parser = Parser(source);
+        auto g = lexer::LexerParser(&parser).parse();
+        g.validate();
+        return g;
+    }
+
+    std::string read_grammar(const std::string &path)
+    {
+        auto in = std::ifstream(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Failed to open grammar file '" + path + "'");
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Coarse enough that most lookups find it unchanged, fine enough to order evictions.
+    uint64_t now_ms()
+    {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+    }
+}
+
+namespace lexer
+{
+    uint64_t content_hash(std::string_view source)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (unsigned char c : source)
+        {
+            hash ^= c;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    CompiledLexer::CompiledLexer(std::string name, std::string_view source, const CompileOptions &options) :
+        name(std::move(name)), grammar(parse_grammar(source)), direct_lexer(DirectLexer::find(content_hash(source)))
+    {
+        if (options.direct)
+        {
+            if (!this->direct_lexer)
+                throw NoDirectLexerError(this->name);
+            return;
+        }
+
+        if (options.nfa)
+        {
+            this->nfa_lexer.emplace(&this->grammar);
+            return;
+        }
+
+        auto dfa = FiniteStateAutomaton::build_lexer_dfa(&this->grammar);
+        if (options.jit && JitLexer::supported())
+        {
+            this->jit_lexer.emplace(dfa);
+            return;
+        }
+
+        if (ShuffleTable::fits(dfa))
+        {
+            this->shuffle_table.emplace(dfa);
+            if (options.host)
+                return;
+        }
+
+        if (options.lazy)
+            this->lazy_lexer.emplace(dfa, options.merge_cache_bytes);
+        else
+        {
+            this->parallel_lexer.emplace(dfa);
+            if (!options.layout_samples.empty())
+                this->parallel_lexer->optimize_layout(std::vector<std::string_view>(options.layout_samples.begin(), options.layout_samples.end()));
+        }
+    }
+
+    LexerInterpreter CompiledLexer::interpreter(bool utf8_validation) const
+    {
+        if (this->lazy_lexer)
+            return LexerInterpreter(&this->lazy_lexer.value(), utf8_validation);
+        return LexerInterpreter(&this->parallel_lexer.value(), utf8_validation);
+    }
+
+    std::unique_ptr<LexerBackend> CompiledLexer::host_backend(bool utf8_validation, ThreadPool &pool) const
+    {
+        if (this->shuffle_table)
+            return std::make_unique<ShuffleLexer>(&this->shuffle_table.value(), utf8_validation, pool);
+        return std::make_unique<HostLexer>(&this->parallel_lexer.value(), utf8_validation, pool);
+    }
+
+    size_t CompiledLexer::memory_bytes() const
+    {
+        if (this->nfa_lexer)
+            return this->nfa_lexer->memory_bytes();
+        if (this->jit_lexer)
+            return this->jit_lexer->memory_bytes();
+        size_t bytes = 0;
+        if (this->lazy_lexer)
+            bytes = this->lazy_lexer->memory_bytes();
+        else if (this->parallel_lexer)
+            bytes = this->parallel_lexer->memory_bytes();
+        if (this->shuffle_table)
+            bytes += this->shuffle_table->memory_bytes();
+        return bytes;
+    }
+
+    GrammarRegistry::GrammarRegistry(size_t memory_budget, const CompileOptions &compile_options) :
+        table(nullptr), memory_budget(memory_budget), compile_options(compile_options), resident(0)
+    {
+        this->tables.push_back(std::make_unique<const Table>());
+        this->table = this->tables.back().get();
+    }
+
+    GrammarRegistry::Entry *GrammarRegistry::find(std::string_view name) const
+    {
+        const auto *table = this->table.load(std::memory_order_acquire);
+        auto it = table->find(name);
+        return it == table->end() ? nullptr : it->second;
+    }
+
+    void GrammarRegistry::add(std::string name, std::string source, bool is_path)
+    {
+        auto lock = std::unique_lock(this->mutex);
+
+        if (auto *existing = this->find(name))
+        {
+            if (existing->source != source || existing->is_path != is_path)
+                throw GrammarConflictError(name);
+            return;
+        }
+
+        auto entry = std::make_unique<Entry>();
+        entry->name = name;
+        entry->source = std::move(source);
+        entry->is_path = is_path;
+        entry->last_used = 0;
+
+        // Copy on write: lookups which already loaded the old table keep using it.
+        auto table = std::make_unique<Table>(*this->table.load());
+        table->emplace(std::move(name), entry.get());
+        this->entries.push_back(std::move(entry));
+        this->tables.push_back(std::move(table));
+        this->table.store(this->tables.back().get(), std::memory_order_release);
+    }
+
+    void GrammarRegistry::add_file(std::string name, std::string path)
+    {
+        this->add(std::move(name), std::move(path), true);
+    }
+
+    void GrammarRegistry::add_source(std::string name, std::string source)
+    {
+        this->add(std::move(name), std::move(source), false);
+    }
+
+    std::string GrammarRegistry::add_content(std::string source)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "#%016llx", static_cast<unsigned long long>(content_hash(source)));
+        this->add(name, std::move(source), false);
+        return name;
+    }
+
+    bool GrammarRegistry::contains(std::string_view name) const
+    {
+        return this->find(name) != nullptr;
+    }
+
+    std::vector<std::string> GrammarRegistry::names() const
+    {
+        auto result = std::vector<std::string>();
+        for (const auto &[name, entry] : *this->table.load(std::memory_order_acquire))
+            result.push_back(name);
+        return result;
+    }
+
+    std::shared_ptr<const CompiledLexer> GrammarRegistry::get(std::string_view name)
+    {
+        auto *entry = this->find(name);
+        if (!entry)
+            throw UnknownGrammarError(name);
+
+        auto now = now_ms();
+        if (entry->last_used.load(std::memory_order_relaxed) != now)
+            entry->last_used.store(now, std::memory_order_relaxed);
+        if (auto compiled = entry->compiled.load(std::memory_order_acquire))
+            return compiled;
+
+        return this->build(entry);
+    }
+
+    std::shared_ptr<const CompiledLexer> GrammarRegistry::build(Entry *entry)
+    {
+        auto build_lock = std::unique_lock(entry->build_mutex);
+
+        // Someone else may have built it while this thread waited for the lock.
+        if (auto compiled = entry->compiled.load(std::memory_order_acquire))
+            return compiled;
+
+        auto source = entry->is_path ? read_grammar(entry->source) : entry->source;
+        auto compiled = std::shared_ptr<const CompiledLexer>(std::make_shared<CompiledLexer>(entry->name, source, this->compile_options));
+
+        auto lock = std::unique_lock(this->mutex);
+        entry->resident_bytes = compiled->memory_bytes();
+        this->resident += entry->resident_bytes;
+        entry->compiled.store(compiled, std::memory_order_release);
+        this->evict_for(entry);
+
+        return compiled;
+    }
+
+    void GrammarRegistry::evict_for(const Entry *keep)
+    {
+        while (this->resident > this->memory_budget)
+        {
+            Entry *victim = nullptr;
+            for (const auto &entry : this->entries)
+            {
+                if (entry.get() == keep || entry->resident_bytes == 0)
+                    continue;
+                if (!victim || entry->last_used.load(std::memory_order_relaxed) < victim->last_used.load(std::memory_order_relaxed))
+                    victim = entry.get();
+            }
+
+            // The lexer which was just built stays, even if it exceeds the budget on its own.
+            if (!victim)
+                return;
+
+            victim->compiled.store(nullptr, std::memory_order_release);
+            this->resident -= victim->resident_bytes;
+            victim->resident_bytes = 0;
+        }
+    }
+
+    size_t GrammarRegistry::resident_bytes()
+    {
+        auto lock = std::unique_lock(this->mutex);
+        return this->resident;
+    }
+}
@@ -0,0 +1,95 @@
+#include "lexer/host_lexer.hpp"
+#include "utf8.hpp"
+#include "parallel_scan.hpp"
+
+#include <algorithm>
+
+namespace lexer {
+    HostLexer::HostLexer(const ParallelLexer* lexer, bool utf8_validation, ThreadPool& pool):
+        lexer(lexer), utf8_validation(utf8_validation), pool(&pool), tiles(pool) {}
+
+    const char* HostLexer::name() const {
+        return "host";
+    }
+
+    void HostLexer::reserve(size_t input_length) {
+        this->aggregates.reserve(this->tiles.count(input_length));
+        this->tiles.reserve(input_length);
+    }
+
+    void HostLexer::release() {
+        this->aggregates = std::vector<ParallelLexer::Transition>();
+        this->tiles.release();
+    }
+
+    void HostLexer::map(std::string_view input) {
+        StageTimer timer(&this->profile, "map", input.size());
+
+        this->input = input;
+        this->error.reset();
+
+        this->tiles.split(input.size());
+        this->aggregates.resize(this->tiles.size());
+
+        const auto& initial_states = this->lexer->initial_states;
+        const auto& merge_table = this->lexer->merge_table;
+
+        this->pool->parallel_for(this->tiles.size(), [&](size_t t) {
+            auto begin = this->tiles.begin(t);
+            auto end = this->tiles.end(t);
+
+            auto state = initial_states[static_cast<uint8_t>(input[begin])];
+            for (size_t i = begin + 1; i < end; ++i)
+                state = merge_table(state.result_state, initial_states[static_cast<uint8_t>(input[i])].result_state);
+            this->aggregates[t] = state;
+
+            // Validated right after mapping, while the tile is still in cache.
+            if (this->utf8_validation)
+                this->tiles[t].first_invalid = find_utf8_error(input, begin, end);
+        });
+
+        if (this->utf8_validation)
+            this->error = this->tiles.first_utf8_error();
+    }
+
+    void HostLexer::scan() {
+        StageTimer timer(&this->profile, "scan", this->input.size());
+
+        const auto& merge_table = this->lexer->merge_table;
+        parallel_inclusive_scan(*this->pool, this->aggregates.data(), this->aggregates.size(),
+            [&](ParallelLexer::Transition a, ParallelLexer::Transition b) {
+                return merge_table(a.result_state, b.result_state);
+            });
+    }
+
+    void HostLexer::extract(TokenStream& tokens) {
+        auto input = this->input;
+        StageTimer timer(&this->profile, "extract", input.size());
+
+        const auto& initial_states = this->lexer->initial_states;
+        const auto& merge_table = this->lexer->merge_table;
+        const auto& final_states = this->lexer->final_states;
+
+        // A token ends before every position whose composed transition produces a lexeme, the
+        // lexeme being the final state of the composition up to the position before. The last
+        // token ends at the end of the input.
+        this->pool->parallel_for(this->tiles.size(), [&](size_t t) {
+            auto& tile = this->tiles[t];
+            tile.clear_tokens();
+
+            auto begin = this->tiles.begin(t);
+            auto end = this->tiles.end(t);
+
+            auto state = t == 0 ? initial_states[static_cast<uint8_t>(input[0])].result_state : this->aggregates[t - 1].result_state;
+            for (size_t i = std::max(begin, size_t{1}); i < end; ++i) {
+                auto next = merge_table(state, initial_states[static_cast<uint8_t>(input[i])].result_state);
+                if (next.produces_lexeme)
+                    tile.add_token(i, final_states[state]);
+                state = next.result_state;
+            }
+        });
+
+        const auto* last = final_states[this->aggregates.back().result_state];
+        timer.add_count(this->tiles.copy_tokens(tokens, last, this->error));
+    }
+}
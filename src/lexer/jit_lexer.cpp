@@ -0,0 +1,524 @@
+#include "lexer/jit_lexer.hpp"
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <map>
+#include <initializer_list>
+#include <optional>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define JIT_HAVE_X86_64
+#endif
+
+namespace {
+    using lexer::JitLexer;
+    using lexer::FiniteStateAutomaton;
+    using StateIndex = FiniteStateAutomaton::StateIndex;
+    using Context = JitLexer::Context;
+
+    // Room for at least this many tokens whenever the token arrays are grown.
+    constexpr const size_t MIN_TOKEN_CAPACITY = 4096;
+
+    // Self-loops over more byte ranges than this are not worth a skip loop, and there are only 8
+    // registers to hold their bounds.
+    constexpr const size_t MAX_SKIP_RANGES = 4;
+
+    constexpr const size_t SKIP_WIDTH = 16;
+
+#ifdef JIT_HAVE_X86_64
+    // General purpose and SSE registers, by their encoding.
+    enum Reg : uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11 };
+    using Xmm = uint8_t;
+
+    enum Condition : uint8_t { BELOW = 0x2, ABOVE_EQUAL = 0x3, NOT_EQUAL = 0x5, ABOVE = 0x7 };
+
+    constexpr uint8_t field(size_t offset) {
+        return static_cast<uint8_t>(offset);
+    }
+
+    // Just the instructions the lexer needs. Labels are bound to positions in the code, and jumps
+    // and RIP-relative operands refer to them with 32-bit displacements which are filled in by
+    // finish().
+    class Assembler {
+        std::vector<uint8_t> code;
+        std::vector<std::optional<size_t>> labels;
+        // Positions of 32-bit displacements and the labels they refer to.
+        std::vector<std::pair<size_t, size_t>> fixups;
+
+        void emit(std::initializer_list<uint8_t> bytes) {
+            this->code.insert(this->code.end(), bytes);
+        }
+
+        void imm32(uint32_t value) {
+            for (size_t i = 0; i < 4; ++i)
+                this->code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+
+        void rel32(size_t label) {
+            this->fixups.push_back({this->code.size(), label});
+            this->imm32(0);
+        }
+
+        static uint8_t rex_w(uint8_t reg, uint8_t rm) {
+            return 0x48 | ((reg >> 3) << 2) | (rm >> 3);
+        }
+
+        static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+            return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+        }
+
+        // An SSE instruction on two registers, with an optional REX prefix for xmm8 and up.
+        void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, uint8_t rm) {
+            this->code.push_back(prefix);
+            if (reg >= 8 || rm >= 8)
+                this->code.push_back(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+            this->emit({0x0F, opcode, modrm(3, reg, rm)});
+        }
+
+    public:
+        size_t new_label() {
+            this->labels.emplace_back();
+            return this->labels.size() - 1;
+        }
+
+        void bind(size_t label) {
+            this->labels[label] = this->code.size();
+        }
+
+        size_t position(size_t label) const {
+            return this->labels[label].value();
+        }
+
+        void align(size_t alignment) {
+            while (this->code.size() % alignment != 0)
+                this->code.push_back(0xCC);
+        }
+
+        void data(uint8_t value, size_t count) {
+            this->code.insert(this->code.end(), count, value);
+        }
+
+        // mov dst, [base + disp]
+        void load(Reg dst, Reg base, uint8_t disp) { this->emit({rex_w(dst, base), 0x8B, modrm(1, dst, base), disp}); }
+        // mov [base + disp], src
+        void store(Reg base, uint8_t disp, Reg src) { this->emit({rex_w(src, base), 0x89, modrm(1, src, base), disp}); }
+        // mov [base], src, where base is not rsp, rbp, r12 or r13.
+        void store(Reg base, Reg src) { this->emit({rex_w(src, base), 0x89, modrm(0, src, base)}); }
+        // mov qword [base + disp], imm32
+        void store_imm(Reg base, uint8_t disp, uint32_t value) {
+            this->emit({rex_w(0, base), 0xC7, modrm(1, 0, base), disp});
+            this->imm32(value);
+        }
+        // mov dst, src
+        void mov(Reg dst, Reg src) { this->emit({rex_w(src, dst), 0x89, modrm(3, src, dst)}); }
+        // mov dst, imm64
+        void mov_imm64(Reg dst, uint64_t value) {
+            this->emit({rex_w(0, dst), static_cast<uint8_t>(0xB8 + (dst & 7))});
+            this->imm32(static_cast<uint32_t>(value));
+            this->imm32(static_cast<uint32_t>(value >> 32));
+        }
+        // lea dst, [base + disp]
+        void lea(Reg dst, Reg base, uint8_t disp) { this->emit({rex_w(dst, base), 0x8D, modrm(1, dst, base), disp}); }
+        // lea dst, [rip + label]
+        void lea(Reg dst, size_t label) {
+            this->emit({rex_w(dst, 0), 0x8D, modrm(0, dst, 5)});
+            this->rel32(label);
+        }
+        // mov dst, [base + index * 8], where base is not rbp or r13.
+        void load_indexed(Reg dst, Reg base, Reg index) {
+            this->emit({static_cast<uint8_t>(rex_w(dst, base) | ((index >> 3) << 1)), 0x8B, modrm(0, dst, 4), modrm(3, index, base)});
+        }
+        // movzx dst32, byte [base + index], where base is not rbp or r13.
+        void load_byte(Reg dst, Reg base, Reg index) { this->emit({0x0F, 0xB6, modrm(0, dst, 4), modrm(0, index, base)}); }
+        // add dst, src
+        void add(Reg dst, Reg src) { this->emit({rex_w(src, dst), 0x01, modrm(3, src, dst)}); }
+        // add dst, imm8
+        void add(Reg dst, uint8_t value) { this->emit({rex_w(0, dst), 0x83, modrm(3, 0, dst), value}); }
+        // inc dst
+        void inc(Reg dst) { this->emit({rex_w(0, dst), 0xFF, modrm(3, 0, dst)}); }
+        // cmp a, b
+        void cmp(Reg a, Reg b) { this->emit({rex_w(b, a), 0x39, modrm(3, b, a)}); }
+        // cmp a, [base + disp]
+        void cmp(Reg a, Reg base, uint8_t disp) { this->emit({rex_w(a, base), 0x3B, modrm(1, a, base), disp}); }
+        // cmp eax, imm32
+        void cmp_eax(uint32_t value) {
+            this->emit({0x3D});
+            this->imm32(value);
+        }
+        // xor eax, imm32
+        void xor_eax(uint32_t value) {
+            this->emit({0x35});
+            this->imm32(value);
+        }
+        // bsf eax, eax
+        void bsf_eax() { this->emit({0x0F, 0xBC, 0xC0}); }
+        void jcc(Condition condition, size_t label) {
+            this->emit({0x0F, static_cast<uint8_t>(0x80 | condition)});
+            this->rel32(label);
+        }
+        void jmp(size_t label) {
+            this->emit({0xE9});
+            this->rel32(label);
+        }
+        void jmp(Reg target) { this->emit({0xFF, modrm(3, 4, target)}); }
+        void ret() { this->emit({0xC3}); }
+
+        // movdqu dst, [base + index]
+        void movdqu(Xmm dst, Reg base, Reg index) { this->emit({0xF3, 0x0F, 0x6F, modrm(0, dst, 4), modrm(0, index, base)}); }
+        // movdqa dst, [rip + label]
+        void load_constant(Xmm dst, size_t label) {
+            this->code.push_back(0x66);
+            if (dst >= 8)
+                this->code.push_back(0x44);
+            this->emit({0x0F, 0x6F, modrm(0, dst, 5)});
+            this->rel32(label);
+        }
+        void movdqa(Xmm dst, Xmm src) { this->sse(0x66, 0x6F, dst, src); }
+        void pcmpeqb(Xmm dst, Xmm src) { this->sse(0x66, 0x74, dst, src); }
+        void psubb(Xmm dst, Xmm src) { this->sse(0x66, 0xF8, dst, src); }
+        void pminub(Xmm dst, Xmm src) { this->sse(0x66, 0xDA, dst, src); }
+        void por(Xmm dst, Xmm src) { this->sse(0x66, 0xEB, dst, src); }
+        // pmovmskb eax, src
+        void pmovmskb_eax(Xmm src) { this->sse(0x66, 0xD7, RAX, src); }
+
+        std::vector<uint8_t> finish() {
+            for (const auto& [at, label] : this->fixups) {
+                auto displacement = static_cast<uint32_t>(this->position(label) - (at + 4));
+                std::memcpy(&this->code[at], &displacement, sizeof(displacement));
+            }
+            return std::move(this->code);
+        }
+    };
+
+    // A transition: the next state and whether it produces a token.
+    using Target = std::pair<StateIndex, bool>;
+
+    struct ByteRange {
+        size_t first;
+        size_t last;
+        Target target;
+    };
+
+    // The register assignment of the generated code: rdi holds the context, rcx the input, rsi the
+    // position of the next byte, rdx the end of the input, r11 the beginning of the current token,
+    // r8, r9 and r10 where the next token goes in the begins, ends and lexemes arrays, and rax and
+    // the SSE registers are scratch.
+    class CodeGenerator {
+        Assembler as;
+        const FiniteStateAutomaton& dfa;
+
+        std::vector<size_t> state_labels;
+        size_t table;
+        size_t epilogue;
+        // 16 copies of a byte, for the bounds of skip loops.
+        std::map<uint8_t, size_t> constants;
+
+        size_t constant(uint8_t value) {
+            auto it = this->constants.find(value);
+            if (it == this->constants.end())
+                it = this->constants.insert({value, this->as.new_label()}).first;
+            return it->second;
+        }
+
+        std::vector<ByteRange> byte_ranges(StateIndex state) const {
+            auto targets = std::vector<Target>(FiniteStateAutomaton::MAX_SYM + 1, {FiniteStateAutomaton::REJECT, false});
+            for (const auto& t : this->dfa.transitions(state))
+                targets[t.sym] = {t.dst, t.produces_lexeme};
+
+            auto ranges = std::vector<ByteRange>();
+            for (size_t c = 0; c < targets.size(); ++c) {
+                if (!ranges.empty() && ranges.back().target == targets[c])
+                    ranges.back().last = c;
+                else
+                    ranges.push_back({c, c, targets[c]});
+            }
+            return ranges;
+        }
+
+        // Compares eax against the first bytes of the ranges in a binary search.
+        void generate_search(const std::vector<ByteRange>& ranges, size_t begin, size_t end, const std::map<Target, size_t>& stubs) {
+            if (end - begin == 1) {
+                this->as.jmp(stubs.at(ranges[begin].target));
+                return;
+            }
+
+            auto mid = begin + (end - begin) / 2;
+            auto lower = this->as.new_label();
+            this->as.cmp_eax(ranges[mid].first);
+            this->as.jcc(BELOW, lower);
+            this->generate_search(ranges, mid, end, stubs);
+            this->as.bind(lower);
+            this->generate_search(ranges, begin, mid, stubs);
+        }
+
+        // Advances rsi over the bytes in the ranges 16 at a time, for as long as 16 bytes are left,
+        // and then falls through to the byte by byte code. Every range is tested as an unsigned
+        // compare of the byte minus the first of the range, with PMINUB.
+        void generate_skip_loop(const std::vector<ByteRange>& self_ranges, size_t loop, size_t dispatch) {
+            for (size_t k = 0; k < self_ranges.size(); ++k) {
+                const auto& range = self_ranges[k];
+                this->as.load_constant(8 + 2 * k, this->constant(range.first));
+                if (range.first != range.last)
+                    this->as.load_constant(9 + 2 * k, this->constant(range.last - range.first));
+            }
+
+            auto found = this->as.new_label();
+            this->as.bind(loop);
+            this->as.lea(RAX, RSI, SKIP_WIDTH);
+            this->as.cmp(RAX, RDX);
+            this->as.jcc(ABOVE, dispatch);
+            this->as.movdqu(0, RCX, RSI);
+
+            // xmm1 collects the bytes in any of the ranges.
+            for (size_t k = 0; k < self_ranges.size(); ++k) {
+                const auto& range = self_ranges[k];
+                Xmm result = k == 0 ? 1 : 3;
+                if (range.first == range.last) {
+                    this->as.movdqa(result, 0);
+                    this->as.pcmpeqb(result, 8 + 2 * k);
+                } else {
+                    this->as.movdqa(2, 0);
+                    this->as.psubb(2, 8 + 2 * k);
+                    this->as.movdqa(result, 2);
+                    this->as.pminub(result, 9 + 2 * k);
+                    this->as.pcmpeqb(result, 2);
+                }
+                if (k > 0)
+                    this->as.por(1, result);
+            }
+
+            this->as.pmovmskb_eax(1);
+            this->as.xor_eax(0xFFFF);
+            this->as.jcc(NOT_EQUAL, found);
+            this->as.add(RSI, static_cast<uint8_t>(SKIP_WIDTH));
+            this->as.jmp(loop);
+
+            this->as.bind(found);
+            this->as.bsf_eax();
+            this->as.add(RSI, RAX);
+        }
+
+        void generate_state(StateIndex state) {
+            this->as.bind(this->state_labels[state]);
+
+            // Nothing leaves REJECT, so the rest of the input is the last token.
+            if (state == FiniteStateAutomaton::REJECT) {
+                this->as.store_imm(RDI, field(offsetof(Context, state)), state);
+                this->as.jmp(this->epilogue);
+                return;
+            }
+
+            auto ranges = this->byte_ranges(state);
+            auto self_ranges = std::vector<ByteRange>();
+            for (const auto& range : ranges) {
+                if (range.target == Target{state, false})
+                    self_ranges.push_back(range);
+            }
+
+            auto dispatch = this->as.new_label();
+            auto exit = this->as.new_label();
+            auto self_loop = dispatch;
+            if (!self_ranges.empty() && self_ranges.size() <= MAX_SKIP_RANGES) {
+                self_loop = this->as.new_label();
+                this->generate_skip_loop(self_ranges, self_loop, dispatch);
+            }
+
+            this->as.bind(dispatch);
+            this->as.cmp(RSI, RDX);
+            this->as.jcc(ABOVE_EQUAL, exit);
+            this->as.load_byte(RAX, RCX, RSI);
+
+            auto stubs = std::map<Target, size_t>();
+            for (const auto& range : ranges)
+                stubs.insert({range.target, this->as.new_label()});
+            this->generate_search(ranges, 0, ranges.size(), stubs);
+
+            for (const auto& [target, label] : stubs) {
+                auto [dst, produces_lexeme] = target;
+                this->as.bind(label);
+                if (produces_lexeme) {
+                    // Returns before the byte when the arrays are full, to be resumed in this state.
+                    this->as.cmp(R9, RDI, field(offsetof(Context, ends_limit)));
+                    this->as.jcc(ABOVE_EQUAL, exit);
+                    this->as.store(R8, R11);
+                    this->as.store(R9, RSI);
+                    this->as.mov_imm64(RAX, reinterpret_cast<uint64_t>(this->dfa.lexemes[state]));
+                    this->as.store(R10, RAX);
+                    this->as.mov(R11, RSI);
+                    this->as.add(R8, uint8_t{8});
+                    this->as.add(R9, uint8_t{8});
+                    this->as.add(R10, uint8_t{8});
+                }
+                this->as.inc(RSI);
+                this->as.jmp(dst == state && !produces_lexeme ? self_loop : this->state_labels[dst]);
+            }
+
+            this->as.bind(exit);
+            this->as.store_imm(RDI, field(offsetof(Context, state)), state);
+            this->as.jmp(this->epilogue);
+        }
+
+    public:
+        CodeGenerator(const FiniteStateAutomaton& dfa): dfa(dfa) {
+            for (size_t state = 0; state < dfa.num_states(); ++state)
+                this->state_labels.push_back(this->as.new_label());
+            this->table = this->as.new_label();
+            this->epilogue = this->as.new_label();
+        }
+
+        // The code, followed by the constants and a table of the address of every state, relative to
+        // the start of the code until relocate() makes them absolute.
+        std::vector<uint8_t> generate() {
+            // Loads the context and jumps to the code of its state through the table.
+            this->as.load(RCX, RDI, field(offsetof(Context, input)));
+            this->as.load(RSI, RDI, field(offsetof(Context, pos)));
+            this->as.load(R11, RDI, field(offsetof(Context, token_begin)));
+            this->as.load(R8, RDI, field(offsetof(Context, begins)));
+            this->as.load(R9, RDI, field(offsetof(Context, ends)));
+            this->as.load(R10, RDI, field(offsetof(Context, lexemes)));
+            this->as.load(RAX, RDI, field(offsetof(Context, state)));
+            this->as.lea(RDX, this->table);
+            this->as.load_indexed(RAX, RDX, RAX);
+            this->as.load(RDX, RDI, field(offsetof(Context, end)));
+            this->as.jmp(RAX);
+
+            this->as.bind(this->epilogue);
+            this->as.store(RDI, field(offsetof(Context, pos)), RSI);
+            this->as.store(RDI, field(offsetof(Context, token_begin)), R11);
+            this->as.store(RDI, field(offsetof(Context, begins)), R8);
+            this->as.store(RDI, field(offsetof(Context, ends)), R9);
+            this->as.store(RDI, field(offsetof(Context, lexemes)), R10);
+            this->as.ret();
+
+            for (size_t state = 0; state < this->dfa.num_states(); ++state)
+                this->generate_state(state);
+
+            this->as.align(SKIP_WIDTH);
+            for (const auto& [value, label] : this->constants) {
+                this->as.bind(label);
+                this->as.data(value, SKIP_WIDTH);
+            }
+
+            this->as.align(sizeof(uint64_t));
+            this->as.bind(this->table);
+            this->as.data(0, this->dfa.num_states() * sizeof(uint64_t));
+
+            auto code = this->as.finish();
+            for (size_t state = 0; state < this->dfa.num_states(); ++state) {
+                uint64_t offset = this->as.position(this->state_labels[state]);
+                std::memcpy(&code[this->as.position(this->table) + state * sizeof(uint64_t)], &offset, sizeof(offset));
+            }
+            return code;
+        }
+
+        size_t table_offset() const {
+            return this->as.position(this->table);
+        }
+    };
+#endif
+}
+
+namespace lexer {
+    bool JitLexer::supported() {
+#ifdef JIT_HAVE_X86_64
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    JitLexer::JitLexer(const FiniteStateAutomaton& dfa):
+        code(nullptr), code_size(0), lex_fn(nullptr), state_lexemes(dfa.lexemes) {
+#ifdef JIT_HAVE_X86_64
+        std::fill(std::begin(this->first_states), std::end(this->first_states), FiniteStateAutomaton::REJECT);
+        for (const auto& t : dfa.transitions(FiniteStateAutomaton::START))
+            this->first_states[t.sym] = t.dst;
+
+        auto generator = CodeGenerator(dfa);
+        auto code = generator.generate();
+
+        this->code_size = code.size();
+        this->code = mmap(nullptr, this->code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (this->code == MAP_FAILED) {
+            this->code = nullptr;
+            throw JitUnavailableError("failed to map memory for the code");
+        }
+
+        std::memcpy(this->code, code.data(), code.size());
+        auto* table = reinterpret_cast<uint64_t*>(static_cast<uint8_t*>(this->code) + generator.table_offset());
+        for (size_t state = 0; state < dfa.num_states(); ++state)
+            table[state] += reinterpret_cast<uint64_t>(this->code);
+
+        // Never writable and executable at once.
+        if (mprotect(this->code, this->code_size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(this->code, this->code_size);
+            this->code = nullptr;
+            throw JitUnavailableError("failed to make the code executable");
+        }
+
+        this->lex_fn = reinterpret_cast<LexFn>(this->code);
+#else
+        throw JitUnavailableError("only x86-64 is supported");
+#endif
+    }
+
+    JitLexer::~JitLexer() {
+#ifdef JIT_HAVE_X86_64
+        if (this->code)
+            munmap(this->code, this->code_size);
+#endif
+    }
+
+    void JitLexer::lex(std::string_view input, TokenStream& tokens, bool utf8_validation, Profile* profile) const {
+        if (input.empty())
+            return;
+
+        StageTimer timer(profile, "lex", input.size());
+        auto first_token = tokens.size();
+
+        // Reported first, so that it wins over rejected input at the same offset, as in LexerInterpreter.
+        if (utf8_validation) {
+            if (auto offset = validate_utf8(input))
+                tokens.report_error(LexError::Type::INVALID_UTF8, offset.value());
+        }
+
+        auto n = input.size();
+        auto context = Context{};
+        context.input = input.data();
+        context.pos = 1;
+        context.end = n;
+        context.state = this->first_states[static_cast<uint8_t>(input[0])];
+        context.token_begin = 0;
+
+        // The generated code returns whenever the arrays are full, and they are grown geometrically,
+        // but never past one token for every byte which is left.
+        auto count = tokens.size();
+        while (context.pos < n && context.state != FiniteStateAutomaton::REJECT) {
+            auto capacity = count + std::min(n - context.pos, std::max(MIN_TOKEN_CAPACITY, count));
+            tokens.begins.resize(capacity);
+            tokens.ends.resize(capacity);
+            tokens.lexemes.resize(capacity);
+
+            context.begins = tokens.begins.data() + count;
+            context.ends = tokens.ends.data() + count;
+            context.lexemes = tokens.lexemes.data() + count;
+            context.ends_limit = tokens.ends.data() + capacity;
+            this->lex_fn(&context);
+            count = context.ends - tokens.ends.data();
+        }
+
+        tokens.begins.resize(count);
+        tokens.ends.resize(count);
+        tokens.lexemes.resize(count);
+        tokens.push_back(this->state_lexemes[context.state], context.token_begin, n);
+        timer.add_count(tokens.size() - first_token);
+    }
+
+    size_t JitLexer::memory_bytes() const {
+        return sizeof(JitLexer) + this->code_size + this->state_lexemes.capacity() * sizeof(const Lexeme*);
+    }
+}
@@ -0,0 +1,190 @@
+#include "lexer/lazy_parallel_lexer.hpp"
+#include "lexer/lexical_grammar.hpp"
+#include "hash_util.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+namespace {
+    using StateIndex = lexer::LazyParallelLexer::StateIndex;
+    using Transition = lexer::LazyParallelLexer::Transition;
+
+    // Layout of a cache entry: the operands in the low 32 bits, then the result.
+    constexpr const uint64_t ENTRY_VALID = uint64_t{1} << 63;
+    constexpr const uint64_t ENTRY_REFERENCED = uint64_t{1} << 62;
+    constexpr const uint64_t ENTRY_PRODUCES_LEXEME = uint64_t{1} << 48;
+    constexpr const uint64_t ENTRY_KEY_MASK = 0xFFFFFFFF;
+
+    uint64_t entry_key(StateIndex first, StateIndex second) {
+        return (uint64_t{first} << 16) | second;
+    }
+
+    uint64_t make_entry(uint64_t key, Transition transition) {
+        return ENTRY_VALID | key | (uint64_t{transition.result_state} << 32) | (transition.produces_lexeme ? ENTRY_PRODUCES_LEXEME : 0);
+    }
+
+    Transition entry_transition(uint64_t entry) {
+        return {static_cast<StateIndex>(entry >> 32), (entry & ENTRY_PRODUCES_LEXEME) != 0};
+    }
+
+    bool same_transitions(const Transition* lhs, const Transition* rhs, size_t n) {
+        return std::equal(lhs, lhs + n, rhs, [](const auto& lhs, const auto& rhs) {
+            return lhs.result_state == rhs.result_state && lhs.produces_lexeme == rhs.produces_lexeme;
+        });
+    }
+}
+
+namespace lexer {
+    LazyParallelLexer::LazyParallelLexer(const LexicalGrammar* g, size_t cache_bytes):
+        LazyParallelLexer(FiniteStateAutomaton::build_lexer_dfa(g), cache_bytes) {}
+
+    LazyParallelLexer::LazyParallelLexer(const FiniteStateAutomaton& dfa, size_t cache_bytes):
+        dfa_states(dfa.num_states()), dfa_lexemes(dfa.lexemes), num_states(0), cache_misses(0) {
+        for (auto& chunk : this->chunks)
+            chunk.store(nullptr, std::memory_order_relaxed);
+
+        this->cache_sets = std::bit_floor(std::max(size_t{1}, cache_bytes / (CACHE_WAYS * sizeof(uint64_t))));
+        this->cache = std::make_unique<std::atomic<uint64_t>[]>(this->cache_sets * CACHE_WAYS);
+        for (size_t i = 0; i < this->cache_sets * CACHE_WAYS; ++i)
+            this->cache[i].store(0, std::memory_order_relaxed);
+
+        // The initial states, one for every character, as in ParallelLexer.
+        auto ps = std::vector<Transition>(this->dfa_states);
+        this->initial_states.resize(FiniteStateAutomaton::MAX_SYM + 1);
+        for (size_t sym = 0; sym <= FiniteStateAutomaton::MAX_SYM; ++sym) {
+            std::fill(ps.begin(), ps.end(), Transition());
+            for (size_t src = 0; src < this->dfa_states; ++src) {
+                for (const auto [transition_sym, dst, produces_lexeme] : dfa.transitions(src)) {
+                    assert(transition_sym != FiniteStateAutomaton::EPSILON); // Not a DFA
+                    if (transition_sym == sym)
+                        ps[src] = {dst, produces_lexeme};
+                }
+            }
+
+            this->initial_states[sym] = {this->intern(ps.data()), ps[START].produces_lexeme};
+        }
+
+        for (size_t i = 0; i < this->dfa_states; ++i)
+            ps[i] = {static_cast<StateIndex>(i), false};
+        this->identity_state_index = this->intern(ps.data());
+    }
+
+    const Transition* LazyParallelLexer::state_transitions(StateIndex state) const {
+        const auto* chunk = this->chunks[state / CHUNK_STATES].load(std::memory_order_acquire);
+        return chunk->transitions.get() + (state % CHUNK_STATES) * this->dfa_states;
+    }
+
+    StateIndex LazyParallelLexer::intern(const Transition* transitions) const {
+        size_t hash = 0;
+        for (size_t i = 0; i < this->dfa_states; ++i) {
+            hash = hash_combine(hash, transitions[i].result_state);
+            hash = hash_combine(hash, transitions[i].produces_lexeme);
+        }
+
+        auto lock = std::unique_lock(this->mutex);
+
+        auto [begin, end] = this->state_index.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            if (same_transitions(this->state_transitions(it->second), transitions, this->dfa_states))
+                return it->second;
+        }
+
+        auto state = this->num_states.load(std::memory_order_relaxed);
+        if (state > std::numeric_limits<StateIndex>::max())
+            throw TooManyParallelStatesError();
+
+        auto* chunk = this->chunks[state / CHUNK_STATES].load(std::memory_order_relaxed);
+        if (!chunk) {
+            auto& owned = this->owned_chunks.emplace_back(std::make_unique<Chunk>());
+            owned->transitions = std::make_unique<Transition[]>(CHUNK_STATES * this->dfa_states);
+            chunk = owned.get();
+        }
+
+        std::copy(transitions, transitions + this->dfa_states, chunk->transitions.get() + (state % CHUNK_STATES) * this->dfa_states);
+        chunk->final_states[state % CHUNK_STATES] = this->dfa_lexemes[transitions[START].result_state];
+
+        // Publish the chunk only after the state is written. Threads which learn of the state from
+        // the cache synchronize with the release of the cache entry instead.
+        this->chunks[state / CHUNK_STATES].store(chunk, std::memory_order_release);
+        this->state_index.emplace(hash, state);
+        this->num_states.store(state + 1, std::memory_order_release);
+
+        return state;
+    }
+
+    auto LazyParallelLexer::compute_merge(StateIndex first, StateIndex second) const -> Transition {
+        // Merging with the identity takes produces_lexeme from the other side, as in ParallelLexer.
+        StateIndex result;
+        if (first == this->identity_state_index) {
+            result = second;
+        } else if (second == this->identity_state_index) {
+            result = first;
+        } else {
+            const auto* lhs = this->state_transitions(first);
+            const auto* rhs = this->state_transitions(second);
+
+            thread_local auto merged = std::vector<Transition>();
+            merged.resize(this->dfa_states);
+            for (size_t i = 0; i < this->dfa_states; ++i)
+                merged[i] = rhs[lhs[i].result_state];
+
+            result = this->intern(merged.data());
+        }
+
+        return {result, this->state_transitions(result)[START].produces_lexeme};
+    }
+
+    auto LazyParallelLexer::merge(StateIndex first, StateIndex second) const -> Transition {
+        auto key = entry_key(first, second);
+        auto* set = &this->cache[(((key * 0x9E3779B97F4A7C15) >> 32) & (this->cache_sets - 1)) * CACHE_WAYS];
+
+        for (size_t way = 0; way < CACHE_WAYS; ++way) {
+            auto entry = set[way].load(std::memory_order_acquire);
+            if ((entry & ENTRY_VALID) && (entry & ENTRY_KEY_MASK) == key) {
+                if (!(entry & ENTRY_REFERENCED))
+                    set[way].fetch_or(ENTRY_REFERENCED, std::memory_order_relaxed);
+                return entry_transition(entry);
+            }
+        }
+
+        this->cache_misses.fetch_add(1, std::memory_order_relaxed);
+        auto transition = this->compute_merge(first, second);
+
+        // Replace the first entry which is empty or was not referenced, clearing the referenced bit
+        // of the entries passed over. If every entry was referenced, the first is replaced. Racing
+        // writers may replace each other's entries, which only costs a later miss.
+        size_t victim = 0;
+        for (size_t way = 0; way < CACHE_WAYS; ++way) {
+            auto entry = set[way].load(std::memory_order_relaxed);
+            if (!(entry & ENTRY_VALID) || !(entry & ENTRY_REFERENCED)) {
+                victim = way;
+                break;
+            }
+            set[way].fetch_and(~ENTRY_REFERENCED, std::memory_order_relaxed);
+        }
+        set[victim].store(make_entry(key, transition), std::memory_order_release);
+
+        return transition;
+    }
+
+    const Lexeme* LazyParallelLexer::final_state(StateIndex state) const {
+        return this->chunks[state / CHUNK_STATES].load(std::memory_order_acquire)->final_states[state % CHUNK_STATES];
+    }
+
+    size_t LazyParallelLexer::states() const {
+        return this->num_states.load(std::memory_order_acquire);
+    }
+
+    size_t LazyParallelLexer::misses() const {
+        return this->cache_misses.load(std::memory_order_relaxed);
+    }
+
+    size_t LazyParallelLexer::memory_bytes() const {
+        auto lock = std::unique_lock(this->mutex);
+        return this->initial_states.size() * sizeof(Transition)
+            + this->cache_sets * CACHE_WAYS * sizeof(uint64_t)
+            + this->owned_chunks.size() * (sizeof(Chunk) + CHUNK_STATES * this->dfa_states * sizeof(Transition))
+            + this->state_index.size() * (sizeof(size_t) + sizeof(StateIndex));
+    }
+}
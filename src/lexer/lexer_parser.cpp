@@ -23,7 +23,7 @@ namespace lexer {
         if (error)
             throw LexerParseError();
 
-        return {std::move(this->lexemes)};
+        return {std::move(this->lexemes), std::move(this->arena)};
     }
 
     bool LexerParser::lexeme_decl() {
@@ -38,8 +38,8 @@ namespace lexer {
 
         this->parser->eat_delim(false);
 
-        auto regex_parser = RegexParser(this->parser);
-        auto root = UniqueRegexNode(nullptr);
+        auto regex_parser = RegexParser(this->parser, &this->arena);
+        auto root = RegexNodePtr(nullptr);
         try {
             root = regex_parser.parse();
         } catch (const RegexParseError&) {
@@ -61,7 +61,7 @@ namespace lexer {
             return false;
         }
 
-        this->lexemes.push_back({std::string(lexeme_name), std::move(root)});
+        this->lexemes.push_back({std::string(lexeme_name), root});
 
         return this->parser->expect('\n');
     }
@@ -13,6 +13,15 @@ namespace lexer {
         return lexeme - this->lexemes.data();
     }
 
+    const Lexeme* LexicalGrammar::find_lexeme(std::string_view name) const {
+        for (const auto& lexeme : this->lexemes) {
+            if (lexeme.name == name)
+                return &lexeme;
+        }
+
+        return nullptr;
+    }
+
     void LexicalGrammar::add_tokens(TokenMapping& tm) const {
         tm.insert(Token::INVALID);
         for (const auto& lexeme : this->lexemes) {
@@ -0,0 +1,112 @@
+#include "lexer/nfa_lexer.hpp"
+#include "lexer/lexical_grammar.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace lexer {
+    NfaLexer::NfaLexer(const LexicalGrammar* g) {
+        auto lexer_nfa = FiniteStateAutomaton::build_lexer_nfa(g);
+        const auto& nfa = lexer_nfa.nfa;
+
+        this->num_states = nfa.num_states();
+        if (this->num_states > MAX_STATES)
+            throw TooManyNfaStatesError();
+
+        this->words = 1;
+        while (this->words * WORD_BITS < this->num_states)
+            this->words *= 2;
+
+        // The single destination of the symbol transitions of every state, if it has any.
+        constexpr auto NONE = std::numeric_limits<size_t>::max();
+        auto successor = std::vector<size_t>(this->num_states, NONE);
+        auto is_successor = std::vector<bool>(this->num_states, false);
+        for (size_t src = 0; src < this->num_states; ++src) {
+            for (const auto& t : nfa.transitions(src)) {
+                if (t.is_epsilon())
+                    continue;
+                assert(successor[src] == NONE || successor[src] == t.dst);
+                successor[src] = t.dst;
+                is_successor[t.dst] = true;
+            }
+        }
+
+        // Number the states along the chains of symbol transitions.
+        auto index = std::vector<size_t>(this->num_states, NONE);
+        size_t next_index = 0;
+        for (size_t head = 0; head < this->num_states; ++head) {
+            if (is_successor[head])
+                continue;
+            for (auto state = head; state != NONE; state = successor[state])
+                index[state] = next_index++;
+        }
+        assert(next_index == this->num_states);
+
+        auto set_bit = [&](std::vector<uint64_t>& masks, size_t offset, size_t state) {
+            masks[offset * this->words + state / WORD_BITS] |= uint64_t{1} << (state % WORD_BITS);
+        };
+
+        this->symbol_masks.assign((FiniteStateAutomaton::MAX_SYM + 1) * this->words, 0);
+        this->closures.assign(this->num_states * this->words, 0);
+        this->has_epsilon.assign(this->words, 0);
+        this->accepting.assign(this->words, 0);
+        this->lexeme_ids.assign(this->num_states, NO_LEXEME);
+
+        for (size_t src = 0; src < this->num_states; ++src) {
+            for (const auto& t : nfa.transitions(src)) {
+                if (t.is_epsilon())
+                    set_bit(this->has_epsilon, 0, index[src]);
+                else
+                    set_bit(this->symbol_masks, t.sym, index[src]);
+            }
+
+            if (const auto* lexeme = nfa.lexemes[src]) {
+                set_bit(this->accepting, 0, index[src]);
+                this->lexeme_ids[index[src]] = g->lexeme_id(lexeme);
+            }
+        }
+
+        // The epsilon closure of every state, by a depth first search from it.
+        auto closure = [&](std::vector<uint64_t>& masks, size_t offset, size_t from) {
+            auto visited = std::vector<bool>(this->num_states, false);
+            auto stack = std::vector<size_t>{from};
+            visited[from] = true;
+            while (!stack.empty()) {
+                auto src = stack.back();
+                stack.pop_back();
+                set_bit(masks, offset, index[src]);
+                for (const auto& t : nfa.transitions(src)) {
+                    if (t.is_epsilon() && !visited[t.dst]) {
+                        visited[t.dst] = true;
+                        stack.push_back(t.dst);
+                    }
+                }
+            }
+        };
+
+        for (size_t src = 0; src < this->num_states; ++src)
+            closure(this->closures, index[src], src);
+
+        for (const auto& lexeme : g->lexemes)
+            this->lexemes.push_back(&lexeme);
+
+        this->roots.assign(this->words, 0);
+        closure(this->roots, 0, FiniteStateAutomaton::START);
+
+        this->successor_root.assign(g->lexemes.size(), 0);
+        for (const auto& [lexeme, root] : lexer_nfa.successor_roots) {
+            this->roots.resize(this->roots.size() + this->words, 0);
+            closure(this->roots, this->roots.size() / this->words - 1, root);
+            this->successor_root[g->lexeme_id(lexeme)] = this->roots.size() / this->words - 1;
+        }
+    }
+
+    size_t NfaLexer::memory_bytes() const {
+        return sizeof(NfaLexer)
+            + (this->symbol_masks.capacity() + this->closures.capacity() + this->has_epsilon.capacity()
+                + this->accepting.capacity() + this->roots.capacity()) * sizeof(uint64_t)
+            + (this->lexeme_ids.capacity() + this->successor_root.capacity()) * sizeof(size_t)
+            + this->lexemes.capacity() * sizeof(const Lexeme*);
+    }
+}
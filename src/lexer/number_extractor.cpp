@@ -0,0 +1,286 @@
+#include "lexer/number_extractor.hpp"
+#include "lexer/powers_of_five.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <bit>
+
+namespace {
+    constexpr const size_t MIN_CHUNK_SIZE = 1 << 14;
+
+    // Most digits that are guaranteed to fit in the 64-bit mantissa accumulator.
+    constexpr const int64_t MAX_DIGITS = 19;
+
+    bool is_digit(char c) {
+        return '0' <= c && c <= '9';
+    }
+
+    uint64_t load_eight(const char* p) {
+        uint64_t val;
+        std::memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+    // SWAR check whether all 8 bytes (little endian) are ASCII digits.
+    bool is_eight_digits(uint64_t val) {
+        return ((val & 0xF0F0F0F0F0F0F0F0) | (((val + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+    }
+
+    // Converts 8 ASCII digits into their value with three multiplications instead of eight.
+    uint32_t parse_eight_digits(uint64_t val) {
+        constexpr const uint64_t mask = 0x000000FF000000FF;
+        constexpr const uint64_t mul1 = 0x000F424000000064; // 100 + (1000000 << 32)
+        constexpr const uint64_t mul2 = 0x0000271000000001; // 1 + (10000 << 32)
+        val -= 0x3030303030303030;
+        val = (val * 10) + (val >> 8);
+        val = (((val & mask) * mul1) + (((val >> 16) & mask) * mul2)) >> 32;
+        return static_cast<uint32_t>(val);
+    }
+
+    const char* parse_digits(const char* p, const char* end, uint64_t& mantissa) {
+        while (end - p >= 8 && is_eight_digits(load_eight(p))) {
+            mantissa = mantissa * 100000000 + parse_eight_digits(load_eight(p));
+            p += 8;
+        }
+
+        while (p != end && is_digit(*p)) {
+            mantissa = mantissa * 10 + (*p - '0');
+            ++p;
+        }
+
+        return p;
+    }
+
+    double make_double(uint64_t mantissa, int32_t power2, bool negative) {
+        uint64_t bits = mantissa | (static_cast<uint64_t>(power2) << 52) | (static_cast<uint64_t>(negative) << 63);
+        return std::bit_cast<double>(bits);
+    }
+
+    // Clinger's fast path: both the mantissa and the power of ten are exactly representable,
+    // so a single correctly rounded operation gives the correctly rounded result.
+    std::optional<double> clinger(uint64_t w, int64_t q) {
+        constexpr const double powers[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        if (w > (uint64_t(1) << 53) || q < -22 || q > 22)
+            return std::nullopt;
+
+        auto d = static_cast<double>(w);
+        return q < 0 ? d / powers[-q] : d * powers[q];
+    }
+
+    // Eisel-Lemire: computes the binary64 closest to w * 10^q from a 128-bit approximation of 5^q.
+    // With at most 19 significant digits the approximation is always sufficient (Mushtak & Lemire).
+    double eisel_lemire(uint64_t w, int64_t q, bool negative) {
+        constexpr const int MANTISSA_BITS = 52;
+        constexpr const int MINIMUM_EXPONENT = -1023;
+        constexpr const int INFINITE_POWER = 0x7FF;
+
+        if (w == 0 || q < lexer::SMALLEST_POWER_OF_TEN)
+            return make_double(0, 0, negative);
+        if (q > lexer::LARGEST_POWER_OF_TEN)
+            return make_double(0, INFINITE_POWER, negative);
+
+        int lz = std::countl_zero(w);
+        w <<= lz;
+
+        // Only the high bits of the product are needed, unless they are all ones and a carry from
+        // the lower half of 5^q could still propagate into them.
+        using u128 = unsigned __int128;
+        const uint64_t* power = &lexer::POWERS_OF_FIVE_128[2 * (q - lexer::SMALLEST_POWER_OF_TEN)];
+        auto first = static_cast<u128>(w) * power[0];
+        auto high = static_cast<uint64_t>(first >> 64);
+        auto low = static_cast<uint64_t>(first);
+
+        constexpr const uint64_t precision_mask = std::numeric_limits<uint64_t>::max() >> (MANTISSA_BITS + 3);
+        if ((high & precision_mask) == precision_mask) {
+            auto second_high = static_cast<uint64_t>((static_cast<u128>(w) * power[1]) >> 64);
+            low += second_high;
+            if (second_high > low)
+                ++high;
+        }
+
+        int upperbit = static_cast<int>(high >> 63);
+        int shift = upperbit + 64 - MANTISSA_BITS - 3;
+        uint64_t mantissa = high >> shift;
+        int32_t power2 = static_cast<int32_t>((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz - MINIMUM_EXPONENT;
+
+        if (power2 <= 0) {
+            // Subnormal result.
+            if (-power2 + 1 >= 64)
+                return make_double(0, 0, negative);
+
+            mantissa >>= -power2 + 1;
+            mantissa += mantissa & 1;
+            mantissa >>= 1;
+            power2 = mantissa < (uint64_t(1) << MANTISSA_BITS) ? 0 : 1;
+            return make_double(mantissa & ~(uint64_t(1) << MANTISSA_BITS), power2, negative);
+        }
+
+        // Exactly halfway between two floats can only happen for small q, in which case we have
+        // to round to even instead of up.
+        if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1) {
+            if ((mantissa << shift) == high)
+                mantissa &= ~uint64_t(1);
+        }
+
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        if (mantissa >= (uint64_t(2) << MANTISSA_BITS)) {
+            mantissa = uint64_t(1) << MANTISSA_BITS;
+            ++power2;
+        }
+
+        if (power2 >= INFINITE_POWER)
+            return make_double(0, INFINITE_POWER, negative);
+
+        return make_double(mantissa & ~(uint64_t(1) << MANTISSA_BITS), power2, negative);
+    }
+}
+
+namespace lexer {
+    std::optional<ParsedNumber> parse_number(std::string_view text) {
+        const char* p = text.data();
+        const char* end = p + text.size();
+
+        bool negative = p != end && *p == '-';
+        if (negative)
+            ++p;
+
+        uint64_t mantissa = 0;
+        auto integer_begin = p;
+        p = parse_digits(p, end, mantissa);
+        int64_t digits = p - integer_begin;
+        // JSON allows no leading zeros in the integer part.
+        if (digits == 0 || (digits > 1 && *integer_begin == '0'))
+            return std::nullopt;
+
+        int64_t exponent = 0;
+        bool is_integer = true;
+
+        if (p != end && *p == '.') {
+            ++p;
+            auto fraction_begin = p;
+            p = parse_digits(p, end, mantissa);
+            if (p == fraction_begin)
+                return std::nullopt;
+
+            exponent = fraction_begin - p;
+            digits -= exponent;
+            is_integer = false;
+        }
+
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool negative_exponent = p != end && *p == '-';
+            if (p != end && (*p == '-' || *p == '+'))
+                ++p;
+
+            if (p == end || !is_digit(*p))
+                return std::nullopt;
+
+            int64_t explicit_exponent = 0;
+            for (; p != end && is_digit(*p); ++p) {
+                // Saturate, anything this large is going to be zero or infinity anyway.
+                if (explicit_exponent < 0x10000000)
+                    explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            }
+
+            exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+            is_integer = false;
+        }
+
+        if (p != end)
+            return std::nullopt;
+
+        if (digits > MAX_DIGITS) {
+            // The mantissa has overflowed, so take the slow but exact path for these rare inputs.
+            double value;
+            auto [ptr, ec] = std::from_chars(text.data(), end, value);
+            if (ec == std::errc::result_out_of_range) {
+                // Infinity or zero, depending on the decimal magnitude: the number of digits before
+                // the decimal point plus the exponent, less the leading zeros of the digits.
+                int64_t magnitude = digits + exponent;
+                for (auto q = integer_begin; q != end && (*q == '0' || *q == '.'); ++q) {
+                    if (*q == '0')
+                        --magnitude;
+                }
+                value = magnitude > 0 ? make_double(0, 0x7FF, negative) : make_double(0, 0, negative);
+            }
+            return ParsedNumber{value, 0, false};
+        }
+
+        if (is_integer && mantissa <= uint64_t(std::numeric_limits<int64_t>::max()) + negative) {
+            auto integer = static_cast<int64_t>(negative ? 0 - mantissa : mantissa);
+            auto value = static_cast<double>(mantissa);
+            return ParsedNumber{negative ? -value : value, integer, true};
+        }
+
+        if (auto value = clinger(mantissa, exponent))
+            return ParsedNumber{negative ? -value.value() : value.value(), 0, false};
+
+        return ParsedNumber{eisel_lemire(mantissa, exponent, negative), 0, false};
+    }
+
+    size_t NumberColumn::size() const {
+        return this->tokens.size();
+    }
+
+    NumberExtractor::NumberExtractor(const LexicalGrammar* g, std::string_view lexeme_name):
+        lexeme(g->find_lexeme(lexeme_name)) {
+        if (!this->lexeme)
+            throw UnknownLexemeError(lexeme_name);
+    }
+
+    NumberColumn NumberExtractor::extract(std::string_view input, const TokenStream& tokens, ThreadPool& pool) const {
+        auto num_chunks = pool.chunk_count(tokens.size(), MIN_CHUNK_SIZE);
+
+        // First count the numbers in every chunk, so that each chunk knows where to write its values.
+        auto offsets = std::vector<size_t>(num_chunks + 1, 0);
+        pool.for_each_chunk(tokens.size(), num_chunks, [&](size_t c, size_t begin, size_t end) {
+            offsets[c + 1] = std::count(tokens.lexemes.begin() + begin, tokens.lexemes.begin() + end, this->lexeme);
+        });
+
+        for (size_t c = 0; c < num_chunks; ++c)
+            offsets[c + 1] += offsets[c];
+
+        auto column = NumberColumn();
+        column.tokens.resize(offsets[num_chunks]);
+        column.values.resize(offsets[num_chunks]);
+        column.integers.resize(offsets[num_chunks]);
+        column.is_integer.resize(offsets[num_chunks]);
+
+        auto errors = std::vector<size_t>(num_chunks, tokens.size());
+        pool.for_each_chunk(tokens.size(), num_chunks, [&](size_t c, size_t begin, size_t end) {
+            auto out = offsets[c];
+            for (size_t i = begin; i < end; ++i) {
+                if (tokens.lexemes[i] != this->lexeme)
+                    continue;
+
+                auto text = input.substr(tokens.begins[i], tokens.ends[i] - tokens.begins[i]);
+                auto number = parse_number(text);
+                if (!number.has_value()) {
+                    errors[c] = std::min(errors[c], i);
+                    number = ParsedNumber{std::numeric_limits<double>::quiet_NaN(), 0, false};
+                }
+
+                column.tokens[out] = i;
+                column.values[out] = number->value;
+                column.integers[out] = number->integer;
+                column.is_integer[out] = number->is_integer;
+                ++out;
+            }
+        });
+
+        auto first_error = *std::min_element(errors.begin(), errors.end());
+        if (first_error != tokens.size())
+            column.first_error = first_error;
+
+        return column;
+    }
+}
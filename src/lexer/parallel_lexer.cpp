@@ -5,6 +5,8 @@
 
 #include <algorithm>
 #include <unordered_map>
+#include <chrono>
+#include <limits>
 #include <queue>
 #include <cassert>
 #include <iostream>
@@ -77,6 +79,13 @@ namespace lexer {
         while (new_capacity < new_num_states)
             new_capacity *= GROW_FACTOR;
 
+        this->reallocate(new_capacity);
+        this->num_states = new_num_states;
+    }
+
+    void ParallelLexer::MergeTable::reallocate(size_t new_capacity) {
+        assert(new_capacity >= this->num_states);
+
         auto new_ptr = std::make_unique<Transition[]>(new_capacity * new_capacity);
         for (size_t second = 0; second < this->num_states; ++second) {
             for (size_t first = 0; first < this->num_states; ++first) {
@@ -84,7 +93,6 @@ namespace lexer {
             }
         }
 
-        this->num_states = new_num_states;
         this->capacity = new_capacity;
         this->merge_table = std::move(new_ptr);
     }
@@ -107,14 +115,30 @@ namespace lexer {
         return this->num_states;
     }
 
-    ParallelLexer::ParallelLexer(const LexicalGrammar* g) {
-        auto dfa = FiniteStateAutomaton::build_lexer_dfa(g);
+    size_t ParallelLexer::MergeTable::bytes() const {
+        return this->capacity * this->capacity * sizeof(Transition);
+    }
+
+    ParallelLexer::ParallelLexer(const LexicalGrammar* g):
+        ParallelLexer(FiniteStateAutomaton::build_lexer_dfa(g)) {}
+
+    ParallelLexer::ParallelLexer(const FiniteStateAutomaton& dfa, GenerationStats* stats) {
+        auto phase_start = std::chrono::steady_clock::now();
+        auto end_phase = [&](double& seconds) {
+            auto now = std::chrono::steady_clock::now();
+            seconds = std::chrono::duration<double>(now - phase_start).count();
+            phase_start = now;
+        };
 
         auto seen = std::unordered_map<ParallelState, StateIndex, ParallelState::Hash>();
         auto states = std::vector<ParallelState>();
         auto transitions = std::vector<Transition>();
 
         auto enqueue = [&](ParallelState&& ps) {
+            // The states are numbered with StateIndex, so there cannot be more than it can represent.
+            if (states.size() > std::numeric_limits<StateIndex>::max())
+                throw TooManyParallelStatesError();
+
             auto [it, inserted] = seen.insert({std::move(ps), states.size()});
             if (inserted) {
                 states.push_back(it->first);
@@ -129,14 +153,14 @@ namespace lexer {
             auto initial_states = std::vector<ParallelState>(FiniteStateAutomaton::MAX_SYM + 1, ParallelState(dfa.num_states()));
             // std::cout << dfa.num_states() << std::endl;
             for (size_t src = 0; src < dfa.num_states(); ++src) {
-                // std::cout << "src: " << src << ": " << dfa[src].transitions.size() << std::endl;
-                // if (dfa[src].lexeme) {
-                //     std::cout << dfa[src].lexeme->name << std::endl;
+                // std::cout << "src: " << src << ": " << dfa.transitions(src).size() << std::endl;
+                // if (dfa.lexemes[src]) {
+                //     std::cout << dfa.lexemes[src]->name << std::endl;
                 // }
-                for (const auto [sym, dst, produces_lexeme] : dfa[src].transitions) {
-                    assert(sym.has_value()); // Not a DFA
-                    initial_states[sym.value()].transitions[src].result_state = dst;
-                    initial_states[sym.value()].transitions[src].produces_lexeme = produces_lexeme;
+                for (const auto [sym, dst, produces_lexeme] : dfa.transitions(src)) {
+                    assert(sym != FiniteStateAutomaton::EPSILON); // Not a DFA
+                    initial_states[sym].transitions[src].result_state = dst;
+                    initial_states[sym].transitions[src].produces_lexeme = produces_lexeme;
                 }
             }
 
@@ -161,6 +185,13 @@ namespace lexer {
             }
             this->identity_state_index = enqueue(std::move(identity));
         }
+
+        if (stats) {
+            stats->initial_parallel_states = states.size();
+            end_phase(stats->parallel_states_seconds);
+            if (stats->on_parallel_states_done)
+                stats->on_parallel_states_done();
+        }
         // std::cout << "identity_state_index: " << this->identity_state_index << std::endl;
 
         auto merge = [&](StateIndex i, StateIndex j) {
@@ -184,9 +215,9 @@ namespace lexer {
 
         // Repeatedly perform the merges until no new merge is added
         for (StateIndex i = 0; i < states.size(); ++i) {
-            if (i % 20) {
-                std::cout << "\rGenerating Merge Table" << std::string((i / 20) % 4, '.');
-                std::cout.flush();
+            if (i % 20 == 0) {
+                std::cerr << "\rGenerating Merge Table" << std::string((i / 20) % 4, '.');
+                std::cerr.flush();
             }
             auto first = states[i];
             for (StateIndex j = 0; j < states.size(); ++j) {
@@ -194,7 +225,7 @@ namespace lexer {
                 merge(j, i);
             }
         }
-        std::cout << "\rDone!                    \n";
+        std::cerr << "\rDone!                    \n";
 
 
         // std::cout << states.size() << std::endl;
@@ -209,7 +240,13 @@ namespace lexer {
         // Compute the final state mapping
         this->final_states.resize(seen.size(), nullptr);
         for (const auto& [ps, i] : seen) {
-            this->final_states[i] = dfa[ps.transitions[START].result_state].lexeme;
+            this->final_states[i] = dfa.lexemes[ps.transitions[START].result_state];
+        }
+
+        if (stats) {
+            stats->parallel_states = states.size();
+            stats->merge_table_bytes = this->merge_table.states() * this->merge_table.states() * sizeof(Transition);
+            end_phase(stats->merge_table_seconds);
         }
     }
 
@@ -218,4 +255,73 @@ namespace lexer {
         printf("Merge table: %lu² elements = %lu elements\n", this->merge_table.states(), this->merge_table.states() * this->merge_table.states());
         printf("Final states table: %lu elements\n", this->final_states.size());
     }
+
+    std::vector<size_t> ParallelLexer::state_frequencies(const std::vector<std::string_view>& samples) const {
+        auto frequencies = std::vector<size_t>(this->merge_table.states());
+
+        for (auto sample : samples) {
+            if (sample.empty())
+                continue;
+
+            auto state = this->initial_states[static_cast<uint8_t>(sample[0])].result_state;
+            for (size_t i = 1; i < sample.size(); ++i) {
+                auto next = this->initial_states[static_cast<uint8_t>(sample[i])].result_state;
+                ++frequencies[state];
+                ++frequencies[next];
+                state = this->merge_table(state, next).result_state;
+            }
+            ++frequencies[state];
+        }
+
+        return frequencies;
+    }
+
+    void ParallelLexer::renumber(const std::vector<StateIndex>& order) {
+        auto num_states = this->merge_table.states();
+        assert(order.size() == num_states);
+
+        auto new_index = std::vector<StateIndex>(num_states);
+        for (size_t i = 0; i < num_states; ++i)
+            new_index[order[i]] = i;
+
+        for (auto& initial : this->initial_states)
+            initial.result_state = new_index[initial.result_state];
+
+        auto merge_table = MergeTable();
+        merge_table.reallocate(num_states);
+        merge_table.resize(num_states);
+        for (size_t i = 0; i < num_states; ++i) {
+            for (size_t j = 0; j < num_states; ++j) {
+                auto transition = this->merge_table(order[i], order[j]);
+                merge_table(i, j) = {new_index[transition.result_state], transition.produces_lexeme};
+            }
+        }
+        this->merge_table = std::move(merge_table);
+
+        auto final_states = std::vector<const Lexeme*>(num_states);
+        for (size_t i = 0; i < num_states; ++i)
+            final_states[i] = this->final_states[order[i]];
+        this->final_states = std::move(final_states);
+
+        this->identity_state_index = new_index[this->identity_state_index];
+    }
+
+    void ParallelLexer::optimize_layout(const std::vector<std::string_view>& samples) {
+        auto frequencies = this->state_frequencies(samples);
+
+        auto order = std::vector<StateIndex>(frequencies.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](auto lhs, auto rhs) {
+            return frequencies[lhs] > frequencies[rhs];
+        });
+
+        this->renumber(order);
+    }
+
+    size_t ParallelLexer::memory_bytes() const {
+        return this->initial_states.size() * sizeof(Transition)
+            + this->merge_table.bytes()
+            + this->final_states.size() * sizeof(const Lexeme*);
+    }
 };
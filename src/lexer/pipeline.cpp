@@ -0,0 +1,163 @@
+#include "lexer/pipeline.hpp"
+#include "utf8.hpp"
+
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Bytes of the block before and after the one that is lexed, which the buffer of a block also
+    // holds for LexerInterpreter::lex_block.
+    constexpr const size_t CONTEXT_SIZE = 2 * UTF8_BLOCK_SIZE;
+    constexpr const size_t LOOKAHEAD_SIZE = UTF8_BLOCK_SIZE;
+
+    double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+}
+
+namespace lexer {
+    LexPipeline::LexPipeline(const LexerInterpreter* interpreter, const Options& options):
+        interpreter(interpreter), options(options) {
+        auto block_size = std::max(options.block_size, UTF8_BLOCK_SIZE);
+        this->options.block_size = (block_size + UTF8_BLOCK_SIZE - 1) / UTF8_BLOCK_SIZE * UTF8_BLOCK_SIZE;
+        this->options.buffers = std::max(options.buffers, size_t{2});
+    }
+
+    LexPipeline::Result LexPipeline::run(const std::string& path, const Emit& emit) const {
+        auto in = std::ifstream(path, std::ios::binary);
+        if (!in)
+            throw PipelineError("Failed to open input file '" + path + "'");
+
+        auto block_size = this->options.block_size;
+        auto buffers = this->options.buffers;
+
+        // Blocks go around from the reader to the lexer to the emitter, and back to the reader.
+        auto blocks = std::vector<std::unique_ptr<Block>>();
+        auto free_blocks = BoundedQueue<Block*>(buffers);
+        auto read_blocks = BoundedQueue<Block*>(buffers);
+        auto lexed_blocks = BoundedQueue<Block*>(buffers);
+        for (size_t i = 0; i < buffers; ++i) {
+            auto block = std::make_unique<Block>();
+            block->data = std::make_unique<char[]>(CONTEXT_SIZE + block_size + LOOKAHEAD_SIZE);
+            free_blocks.push(block.get());
+            blocks.push_back(std::move(block));
+        }
+
+        // The first failure of any stage stops all of them.
+        std::mutex failure_mutex;
+        std::exception_ptr failure;
+        auto fail = [&](std::exception_ptr e) {
+            auto lock = std::unique_lock(failure_mutex);
+            if (!failure)
+                failure = e;
+            free_blocks.close();
+            read_blocks.close();
+            lexed_blocks.close();
+        };
+
+        auto result = Result();
+        double read_busy = 0;
+        double lex_busy = 0;
+        double emit_busy = 0;
+        auto start = Clock::now();
+
+        auto reader = std::thread([&] {
+            try {
+                // The end of the last block which the next one starts with: its context, and the
+                // bytes that were read past its end.
+                char tail[CONTEXT_SIZE + LOOKAHEAD_SIZE];
+                size_t tail_size = 0;
+                size_t context = 0;
+
+                while (auto popped = free_blocks.pop()) {
+                    auto* block = popped.value();
+                    auto busy = Clock::now();
+
+                    std::memcpy(block->data.get(), tail, tail_size);
+                    auto wanted = context + block_size + LOOKAHEAD_SIZE;
+                    in.read(block->data.get() + tail_size, wanted - tail_size);
+                    if (in.bad())
+                        throw PipelineError("Failed to read input file '" + path + "'");
+
+                    block->size = tail_size + in.gcount();
+                    block->begin = context;
+                    block->end = std::min(block->size, context + block_size);
+                    block->last = block->end == block->size;
+
+                    context = std::min(CONTEXT_SIZE, block->end);
+                    tail_size = block->size - (block->end - context);
+                    std::memcpy(tail, block->data.get() + block->end - context, tail_size);
+
+                    result.bytes += block->end - block->begin;
+                    read_busy += seconds_since(busy);
+
+                    if (!read_blocks.push(block) || block->last)
+                        break;
+                }
+                read_blocks.close();
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        });
+
+        auto emitter = std::thread([&] {
+            try {
+                while (auto popped = lexed_blocks.pop()) {
+                    auto* block = popped.value();
+                    auto busy = Clock::now();
+                    emit(block->tokens);
+                    emit_busy += seconds_since(busy);
+
+                    if (!free_blocks.push(block))
+                        break;
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        });
+
+        try {
+            auto carry = LexerInterpreter::Carry();
+            while (auto popped = read_blocks.pop()) {
+                auto* block = popped.value();
+                auto busy = Clock::now();
+
+                block->tokens.clear();
+                this->interpreter->lex_block(carry, std::string_view(block->data.get(), block->size), block->begin, block->end, block->tokens);
+                if (block->last)
+                    this->interpreter->finish(carry, block->tokens);
+
+                // Blocks are lexed in order, so the first error at the lowest offset wins as in lex.
+                const auto& error = block->tokens.error;
+                if (error.has_value() && (!result.error.has_value() || error->offset < result.error->offset))
+                    result.error = error;
+                result.tokens += block->tokens.size();
+                lex_busy += seconds_since(busy);
+
+                if (!lexed_blocks.push(block))
+                    break;
+            }
+            lexed_blocks.close();
+        } catch (...) {
+            fail(std::current_exception());
+        }
+
+        reader.join();
+        emitter.join();
+        if (failure)
+            std::rethrow_exception(failure);
+
+        result.seconds = seconds_since(start);
+        for (auto [stage, busy] : {std::pair{"read", read_busy}, std::pair{"lex", lex_busy}, std::pair{"emit", emit_busy}})
+            result.stages.push_back({stage, busy, result.seconds > 0 ? busy / result.seconds : 0});
+
+        return result;
+    }
+}
@@ -25,10 +25,10 @@ namespace {
 }
 
 namespace lexer {
-    RegexParser::RegexParser(Parser* parser):
-        parser(parser) {}
+    RegexParser::RegexParser(Parser* parser, Arena* arena):
+        parser(parser), arena(arena) {}
 
-    UniqueRegexNode RegexParser::parse() {
+    RegexNodePtr RegexParser::parse() {
         if (!this->parser->expect('/'))
             throw RegexParseError();
         auto regex = this->alternation();
@@ -38,39 +38,39 @@ namespace lexer {
         return regex;
     }
 
-    UniqueRegexNode RegexParser::alternation() {
+    RegexNodePtr RegexParser::alternation() {
         auto first = this->sequence();
         if (!this->parser->test('|'))
             return first;
 
-        auto children = std::vector<UniqueRegexNode>();
-        children.push_back(std::move(first));
+        auto children = std::vector<RegexNodePtr>();
+        children.push_back(first);
 
         while (this->parser->eat('|')) {
             children.push_back(this->sequence());
         }
 
-        return std::make_unique<AlternationNode>(std::move(children));
+        return this->arena->make<AlternationNode>(ArenaSpan(*this->arena, children));
     }
 
-    UniqueRegexNode RegexParser::sequence() {
+    RegexNodePtr RegexParser::sequence() {
         // If the first repeat matches nothing, then return an emopty sequence.
         auto first = this->maybe_repeat();
         if (!first)
-            return std::make_unique<EmptyNode>();
+            return this->arena->make<EmptyNode>();
 
-        auto children = std::vector<UniqueRegexNode>();
-        children.push_back(std::move(first));
+        auto children = std::vector<RegexNodePtr>();
+        children.push_back(first);
 
         // Repeat while matching something.
         while (auto child = this->maybe_repeat()) {
-            children.push_back(std::move(child));
+            children.push_back(child);
         }
 
-        return std::make_unique<SequenceNode>(std::move(children));
+        return this->arena->make<SequenceNode>(ArenaSpan(*this->arena, children));
     }
 
-    UniqueRegexNode RegexParser::maybe_repeat() {
+    RegexNodePtr RegexParser::maybe_repeat() {
         auto child = this->maybe_atom();
 
         bool star = this->parser->test('*');
@@ -86,17 +86,17 @@ namespace lexer {
             throw RegexParseError();
         }
 
-        return std::make_unique<RepeatNode>(
+        return this->arena->make<RepeatNode>(
             ques ? RepeatType::ZERO_OR_ONE : star ? RepeatType::ZERO_OR_MORE : RepeatType::ONE_OR_MORE,
-            std::move(child)
+            child
         );
     }
 
-    UniqueRegexNode RegexParser::maybe_atom() {
+    RegexNodePtr RegexParser::maybe_atom() {
         auto c = this->parser->peek();
 
-        if (c == '.') {
-            return std::make_unique<CharSetNode>(std::vector<CharRange>(), true);
+        if (this->parser->eat('.')) {
+            return this->arena->make<CharSetNode>(ArenaSpan<CharRange>(), true);
         } else if (c == '[') {
             return this->group();
         } else if (this->parser->eat('(')) {
@@ -105,7 +105,7 @@ namespace lexer {
                 throw RegexParseError();
             return child;
         } else if (c == '\\') {
-            return std::make_unique<CharNode>(this->escaped_char());
+            return this->arena->make<CharNode>(this->escaped_char());
         } else if (!c.has_value() || is_control_char(c.value())) {
             return nullptr; // nullptr used as optional here
         } else if (!std::isprint(c.value())) {
@@ -113,10 +113,10 @@ namespace lexer {
         }
 
         this->parser->consume();
-        return std::make_unique<CharNode>(c.value());
+        return this->arena->make<CharNode>(c.value());
     }
 
-    UniqueRegexNode RegexParser::group() {
+    RegexNodePtr RegexParser::group() {
         auto parse_char = [&] {
             auto c = this->parser->peek();
             if (!c.has_value()) {
@@ -166,7 +166,7 @@ namespace lexer {
             insert_range({min, max});
         }
 
-        return std::make_unique<CharSetNode>(std::move(ranges), inverted);
+        return this->arena->make<CharSetNode>(ArenaSpan(*this->arena, ranges), inverted);
     }
 
     uint8_t RegexParser::escaped_char() {
@@ -0,0 +1,696 @@
+#include "lexer/server.hpp"
+#include "lexer/interpreter.hpp"
+
+#include <bit>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little, "The protocol is little-endian");
+
+namespace
+{
+    using lexer::SocketError;
+
+    void close_fd(int fd)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    sockaddr_un socket_address(const std::string &path)
+    {
+        auto address = sockaddr_un();
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            throw SocketError("Socket path '" + path + "' is too long");
+
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    // Returns false on end of stream before any byte was read, throws on a partial read.
+    bool read_full(int fd, void *data, size_t size)
+    {
+        auto *bytes = static_cast<char *>(data);
+        size_t done = 0;
+        while (done < size)
+        {
+            auto n = read(fd, bytes + done, size - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw SocketError(std::string("Failed to read from socket: ") + std::strerror(errno));
+            if (n == 0)
+            {
+                if (done == 0)
+                    return false;
+                throw SocketError("Connection closed in the middle of a frame");
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    void write_full(int fd, const void *data, size_t size)
+    {
+        const auto *bytes = static_cast<const char *>(data);
+        size_t done = 0;
+        while (done < size)
+        {
+            // MSG_NOSIGNAL, so that a client which went away does not kill the process with SIGPIPE.
+            auto n = ::send(fd, bytes + done, size - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                throw SocketError(std::string("Failed to write to socket: ") + std::strerror(errno));
+            done += n;
+        }
+    }
+
+    template <typename T>
+    void append_raw(std::string &out, T value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void append_array(std::string &out, const std::vector<T> &values)
+    {
+        out.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    std::string frame(uint32_t magic, uint32_t type, std::string_view payload)
+    {
+        auto result = std::string();
+        result.reserve(lexer::FRAME_HEADER_SIZE + payload.size());
+        append_raw(result, magic);
+        append_raw(result, type);
+        append_raw(result, static_cast<uint64_t>(payload.size()));
+        result += payload;
+        return result;
+    }
+
+    struct FrameHeader
+    {
+        uint32_t magic;
+        uint32_t type;
+        uint64_t length;
+    };
+
+    static_assert(sizeof(FrameHeader) == lexer::FRAME_HEADER_SIZE);
+
+    // Payload prefix of requests which name their grammar.
+    std::string grammar_prefix(std::string_view grammar)
+    {
+        auto prefix = std::string();
+        if (!grammar.empty())
+        {
+            append_raw(prefix, static_cast<uint32_t>(grammar.size()));
+            prefix += grammar;
+        }
+        return prefix;
+    }
+
+    // Reads a response frame, and throws for any status other than OK.
+    std::string receive_payload(int fd)
+    {
+        auto header = FrameHeader();
+        if (!read_full(fd, &header, sizeof(header)))
+            throw SocketError("Connection closed by server");
+        if (header.magic != lexer::RESPONSE_MAGIC)
+            throw SocketError("Invalid response");
+
+        auto payload = std::string(header.length, '\0');
+        if (header.length > 0)
+            read_full(fd, payload.data(), payload.size());
+
+        switch (static_cast<lexer::ResponseStatus>(header.type))
+        {
+        case lexer::ResponseStatus::OK:
+            return payload;
+        case lexer::ResponseStatus::TOO_LARGE:
+            throw SocketError("Input too large for server");
+        case lexer::ResponseStatus::UNKNOWN_GRAMMAR:
+            throw SocketError("Unknown grammar");
+        case lexer::ResponseStatus::GRAMMAR_ERROR:
+            throw SocketError("Server failed to compile grammar");
+        default:
+            throw SocketError("Server rejected request");
+        }
+    }
+
+    // The responses of one connection which wait to be written, in order, with the number of
+    // requests that each answers.
+    struct ResponseQueue
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::pair<std::string, size_t>> responses;
+        size_t jobs = 0;
+        // No more responses follow.
+        bool closed = false;
+        // Writing to the client failed.
+        bool failed = false;
+    };
+
+    // Reads little-endian values from a response payload.
+    class PayloadReader
+    {
+        std::string_view data;
+        size_t offset = 0;
+
+    public:
+        PayloadReader(std::string_view data) : data(data) {}
+
+        template <typename T>
+        void read(T *values, size_t n)
+        {
+            if (n > (this->data.size() - this->offset) / sizeof(T))
+                throw SocketError("Truncated response");
+            std::memcpy(values, this->data.data() + this->offset, n * sizeof(T));
+            this->offset += n * sizeof(T);
+        }
+
+        template <typename T>
+        T read()
+        {
+            T value;
+            this->read(&value, 1);
+            return value;
+        }
+
+        std::string read_string(size_t n)
+        {
+            auto result = std::string(n, '\0');
+            this->read(result.data(), n);
+            return result;
+        }
+    };
+}
+
+namespace lexer
+{
+    SocketError::SocketError(const std::string &what) : std::runtime_error(what) {}
+
+    LexServer::LexServer(GrammarRegistry *registry, std::string default_grammar, bool utf8_validation, const Options &options) :
+        registry(registry), default_grammar(std::move(default_grammar)), utf8_validation(utf8_validation), options(options), listen_fd(-1), stopping(false),
+        pool(std::max(size_t{1}, options.threads) - 1), queued_jobs(0)
+    {
+        auto address = socket_address(options.socket_path);
+
+        this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->listen_fd < 0)
+            throw SocketError(std::string("Failed to create socket: ") + std::strerror(errno));
+
+        // A socket file left behind by a previous instance would make bind fail. Anything else at
+        // that path is left alone, and bind reports it.
+        struct stat st;
+        if (stat(options.socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(options.socket_path.c_str());
+        if (bind(this->listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(this->listen_fd, SOMAXCONN) < 0)
+        {
+            auto error = std::string(std::strerror(errno));
+            close_fd(this->listen_fd);
+            throw SocketError("Failed to listen on '" + options.socket_path + "': " + error);
+        }
+
+        this->dispatcher = std::thread([this]
+                                       { this->dispatch_loop(); });
+    }
+
+    LexServer::~LexServer()
+    {
+        this->stop();
+
+        // Connections take the lock when they finish, so they are joined without holding it.
+        auto remaining = std::list<Connection>();
+        {
+            auto lock = std::unique_lock(this->connections_mutex);
+            remaining.splice(remaining.end(), this->connections);
+        }
+        for (auto &connection : remaining)
+            connection.thread.join();
+
+        this->dispatcher.join();
+        close_fd(this->listen_fd);
+        unlink(this->options.socket_path.c_str());
+    }
+
+    void LexServer::run()
+    {
+        while (!this->stopping)
+        {
+            this->reap_connections();
+
+            {
+                auto lock = std::unique_lock(this->connections_mutex);
+                this->connections_cv.wait(lock, [this]
+                                          { return this->stopping || this->active_connections() < this->options.max_connections; });
+            }
+
+            int fd = accept(this->listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if (this->stopping)
+                    break;
+                throw SocketError(std::string("Failed to accept connection: ") + std::strerror(errno));
+            }
+
+            auto lock = std::unique_lock(this->connections_mutex);
+            if (this->stopping)
+            {
+                close_fd(fd);
+                break;
+            }
+
+            auto &connection = this->connections.emplace_back();
+            connection.fd = fd;
+            connection.thread = std::thread([this, &connection]
+                                            { this->serve_connection(&connection); });
+        }
+    }
+
+    void LexServer::stop()
+    {
+        if (this->stopping.exchange(true))
+            return;
+
+        // Wakes up accept and all reads of connections, which then wind down on their own.
+        shutdown(this->listen_fd, SHUT_RDWR);
+        {
+            auto lock = std::unique_lock(this->connections_mutex);
+            for (auto &connection : this->connections)
+                shutdown(connection.fd, SHUT_RDWR);
+        }
+        this->connections_cv.notify_all();
+
+        {
+            auto lock = std::unique_lock(this->queue_mutex);
+        }
+        this->queue_cv.notify_all();
+        this->done_cv.notify_all();
+    }
+
+    size_t LexServer::active_connections() const
+    {
+        return std::count_if(this->connections.begin(), this->connections.end(), [](const Connection &connection)
+                             { return !connection.finished; });
+    }
+
+    void LexServer::reap_connections()
+    {
+        auto lock = std::unique_lock(this->connections_mutex);
+        for (auto it = this->connections.begin(); it != this->connections.end();)
+        {
+            if (it->finished)
+            {
+                it->thread.join();
+                it = this->connections.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    void LexServer::serve_connection(Connection *connection)
+    {
+        int fd = connection->fd;
+
+        // Responses are written by a thread of their own, so that requests are still read while
+        // the client takes its time to read the responses, with up to max_batch of them waiting.
+        // Otherwise a client which writes its next request before reading would never finish.
+        auto output = ResponseQueue();
+        auto writer = std::thread([&]
+                                  {
+            try
+            {
+                while (true)
+                {
+                    auto response = std::pair<std::string, size_t>();
+                    {
+                        auto lock = std::unique_lock(output.mutex);
+                        output.cv.wait(lock, [&]
+                                       { return output.closed || !output.responses.empty(); });
+                        if (output.responses.empty())
+                            return;
+                        response = std::move(output.responses.front());
+                        output.responses.pop_front();
+                    }
+
+                    write_full(fd, response.first.data(), response.first.size());
+
+                    {
+                        auto lock = std::unique_lock(output.mutex);
+                        output.jobs -= response.second;
+                    }
+                    output.cv.notify_all();
+                }
+            }
+            catch (const SocketError &e)
+            {
+                if (!this->stopping)
+                    fprintf(stderr, "Connection error: %s\n", e.what());
+
+                // Wakes up the reader, which stops taking requests.
+                {
+                    auto lock = std::unique_lock(output.mutex);
+                    output.failed = true;
+                }
+                output.cv.notify_all();
+                shutdown(fd, SHUT_RD);
+            } });
+
+        try
+        {
+            while (!this->stopping)
+            {
+                // Block for one request, then take whatever else the client has pipelined already,
+                // so that all of it is lexed in one round.
+                auto batch = Batch();
+                if (!this->read_request(fd, batch))
+                    break;
+
+                while (batch.jobs.size() < this->options.max_batch && batch.jobs.back().response.empty())
+                {
+                    auto pfd = pollfd{fd, POLLIN, 0};
+                    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN) || !this->read_request(fd, batch))
+                        break;
+                }
+
+                // A rejected request already has its response, and is the last one of the connection.
+                bool rejected = !batch.jobs.back().response.empty();
+                if (!rejected || batch.jobs.size() > 1)
+                    this->submit_and_wait(batch);
+
+                auto out = std::string();
+                for (const auto &job : batch.jobs)
+                    out += job.response;
+
+                {
+                    auto lock = std::unique_lock(output.mutex);
+                    output.cv.wait(lock, [&]
+                                   { return output.failed || output.jobs < this->options.max_batch; });
+                    if (output.failed)
+                        break;
+                    output.responses.emplace_back(std::move(out), batch.jobs.size());
+                    output.jobs += batch.jobs.size();
+                }
+                output.cv.notify_all();
+
+                if (rejected)
+                    break;
+            }
+        }
+        catch (const SocketError &e)
+        {
+            if (!this->stopping)
+                fprintf(stderr, "Connection error: %s\n", e.what());
+        }
+
+        // The responses which are already lexed are still written.
+        {
+            auto lock = std::unique_lock(output.mutex);
+            output.closed = true;
+        }
+        output.cv.notify_all();
+        writer.join();
+
+        {
+            auto lock = std::unique_lock(this->connections_mutex);
+            close_fd(fd);
+            connection->fd = -1;
+            connection->finished = true;
+        }
+        this->connections_cv.notify_all();
+    }
+
+    bool LexServer::read_request(int fd, Batch &batch)
+    {
+        auto header = FrameHeader();
+        if (!read_full(fd, &header, sizeof(header)))
+            return false;
+
+        auto &job = batch.jobs.emplace_back();
+        job.type = static_cast<RequestType>(header.type);
+
+        bool names_grammar = job.type == RequestType::LEX_GRAMMAR || job.type == RequestType::LEXEMES_GRAMMAR;
+        auto status = ResponseStatus::OK;
+        if (header.magic != REQUEST_MAGIC || (job.type != RequestType::LEX && job.type != RequestType::LEXEMES && !names_grammar))
+            status = ResponseStatus::BAD_REQUEST;
+        else if (header.length > this->options.max_request_bytes)
+            status = ResponseStatus::TOO_LARGE;
+
+        // The stream cannot be trusted after a bad header, so the error response is the last one.
+        if (status != ResponseStatus::OK)
+        {
+            job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(status), {});
+            return true;
+        }
+
+        job.payload.resize(header.length);
+        if (header.length > 0 && !read_full(fd, job.payload.data(), header.length))
+            throw SocketError("Connection closed in the middle of a frame");
+
+        if (names_grammar)
+        {
+            uint32_t name_length = 0;
+            if (job.payload.size() >= sizeof(name_length))
+                std::memcpy(&name_length, job.payload.data(), sizeof(name_length));
+
+            if (job.payload.size() < sizeof(name_length) || name_length > job.payload.size() - sizeof(name_length))
+            {
+                job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(ResponseStatus::BAD_REQUEST), {});
+                return true;
+            }
+
+            job.grammar = job.payload.substr(sizeof(name_length), name_length);
+            job.input_offset = sizeof(name_length) + name_length;
+        }
+
+        return true;
+    }
+
+    void LexServer::submit_and_wait(Batch &batch)
+    {
+        auto lock = std::unique_lock(this->queue_mutex);
+
+        // Bounds the memory held by requests which are waiting to be lexed.
+        this->done_cv.wait(lock, [&]
+                           { return this->stopping || this->queued_jobs < 4 * this->options.max_batch; });
+        if (this->stopping)
+            throw SocketError("Server is stopping");
+
+        this->queue.push_back(&batch);
+        this->queued_jobs += batch.jobs.size();
+        this->queue_cv.notify_one();
+
+        this->done_cv.wait(lock, [&]
+                           { return batch.done; });
+    }
+
+    void LexServer::dispatch_loop()
+    {
+        while (true)
+        {
+            auto batches = std::vector<Batch *>();
+            auto jobs = std::vector<Job *>();
+            {
+                auto lock = std::unique_lock(this->queue_mutex);
+                this->queue_cv.wait(lock, [this]
+                                    { return this->stopping || !this->queue.empty(); });
+                if (this->queue.empty())
+                    return;
+
+                // Combine the requests of as many connections as fit in one round.
+                while (!this->queue.empty() && (jobs.empty() || jobs.size() + this->queue.front()->jobs.size() <= this->options.max_batch))
+                {
+                    auto *batch = this->queue.front();
+                    this->queue.pop_front();
+                    batches.push_back(batch);
+                    for (auto &job : batch->jobs)
+                        jobs.push_back(&job);
+                }
+            }
+
+            this->pool.parallel_for(jobs.size(), [&](size_t i)
+                                    { this->lex_job(*jobs[i]); });
+
+            {
+                auto lock = std::unique_lock(this->queue_mutex);
+                for (auto *batch : batches)
+                {
+                    batch->done = true;
+                    this->queued_jobs -= batch->jobs.size();
+                }
+            }
+            this->done_cv.notify_all();
+        }
+    }
+
+    void LexServer::lex_job(Job &job)
+    {
+        if (!job.response.empty())
+            return;
+
+        // Held until the response is built, so an eviction cannot free the lexer in the meantime.
+        std::shared_ptr<const CompiledLexer> compiled;
+        try
+        {
+            compiled = this->registry->get(job.grammar.empty() ? this->default_grammar : job.grammar);
+        }
+        catch (const UnknownGrammarError &)
+        {
+            job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(ResponseStatus::UNKNOWN_GRAMMAR), {});
+            return;
+        }
+        catch (const std::exception &e)
+        {
+            fprintf(stderr, "Failed to compile grammar '%s': %s\n", job.grammar.c_str(), e.what());
+            job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(ResponseStatus::GRAMMAR_ERROR), {});
+            return;
+        }
+
+        const auto &grammar = compiled->grammar;
+        auto payload = std::string();
+
+        if (job.type == RequestType::LEXEMES || job.type == RequestType::LEXEMES_GRAMMAR)
+        {
+            append_raw(payload, static_cast<uint32_t>(grammar.lexemes.size()));
+            for (const auto &lexeme : grammar.lexemes)
+            {
+                append_raw(payload, static_cast<uint32_t>(lexeme.name.size()));
+                payload += lexeme.name;
+            }
+
+            job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(ResponseStatus::OK), payload);
+            return;
+        }
+
+        // Reused by the requests lexed on this thread.
+        thread_local auto tokens = TokenStream();
+        thread_local auto ids = std::vector<uint32_t>();
+        thread_local auto offsets = std::vector<uint64_t>();
+        tokens.clear();
+        auto interpreter = compiled->interpreter(this->utf8_validation);
+        interpreter.lex(std::string_view(job.payload).substr(job.input_offset), tokens);
+
+        size_t n = tokens.size();
+        uint32_t error_type = 0;
+        if (tokens.error.has_value())
+            error_type = tokens.error->type == LexError::Type::REJECTED ? 1 : 2;
+
+        ids.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            ids[i] = tokens.lexemes[i] ? grammar.lexeme_id(tokens.lexemes[i]) : UINT32_MAX;
+
+        payload.reserve(24 + n * 20 + 4);
+        append_raw(payload, static_cast<uint64_t>(n));
+        append_raw(payload, error_type);
+        append_raw(payload, uint32_t{0});
+        append_raw(payload, static_cast<uint64_t>(tokens.error.has_value() ? tokens.error->offset : UINT64_MAX));
+        append_array(payload, ids);
+        if (n % 2 == 1)
+            append_raw(payload, uint32_t{0});
+
+        offsets.assign(tokens.begins.begin(), tokens.begins.end());
+        append_array(payload, offsets);
+        offsets.assign(tokens.ends.begin(), tokens.ends.end());
+        append_array(payload, offsets);
+
+        job.payload = std::string();
+        job.response = frame(RESPONSE_MAGIC, static_cast<uint32_t>(ResponseStatus::OK), payload);
+    }
+
+    LexClient::LexClient(const std::string &socket_path)
+    {
+        auto address = socket_address(socket_path);
+
+        this->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (this->fd < 0)
+            throw SocketError(std::string("Failed to create socket: ") + std::strerror(errno));
+
+        if (connect(this->fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+        {
+            auto error = std::string(std::strerror(errno));
+            close_fd(this->fd);
+            throw SocketError("Failed to connect to '" + socket_path + "': " + error);
+        }
+    }
+
+    LexClient::~LexClient()
+    {
+        close_fd(this->fd);
+    }
+
+    std::vector<std::string> LexClient::lexemes(std::string_view grammar)
+    {
+        auto type = grammar.empty() ? RequestType::LEXEMES : RequestType::LEXEMES_GRAMMAR;
+        auto request = frame(REQUEST_MAGIC, static_cast<uint32_t>(type), grammar_prefix(grammar));
+        write_full(this->fd, request.data(), request.size());
+
+        auto payload = receive_payload(this->fd);
+
+        auto reader = PayloadReader(payload);
+        auto names = std::vector<std::string>(reader.read<uint32_t>());
+        for (auto &name : names)
+            name = reader.read_string(reader.read<uint32_t>());
+
+        return names;
+    }
+
+    void LexClient::send(std::string_view input, std::string_view grammar)
+    {
+        auto type = grammar.empty() ? RequestType::LEX : RequestType::LEX_GRAMMAR;
+        auto prefix = grammar_prefix(grammar);
+        auto header = FrameHeader{REQUEST_MAGIC, static_cast<uint32_t>(type), prefix.size() + input.size()};
+        write_full(this->fd, &header, sizeof(header));
+        write_full(this->fd, prefix.data(), prefix.size());
+        write_full(this->fd, input.data(), input.size());
+    }
+
+    LexClient::Response LexClient::receive()
+    {
+        auto payload = receive_payload(this->fd);
+
+        auto reader = PayloadReader(payload);
+        auto n = reader.read<uint64_t>();
+        auto error_type = reader.read<uint32_t>();
+        reader.read<uint32_t>();
+        auto error_offset = reader.read<uint64_t>();
+
+        // Checked against the payload size before allocating, so a bad count cannot exhaust memory.
+        if (n > payload.size() / 20)
+            throw SocketError("Truncated response");
+
+        auto response = Response();
+        response.lexeme_ids.resize(n);
+        response.begins.resize(n);
+        response.ends.resize(n);
+        reader.read(response.lexeme_ids.data(), n);
+        if (n % 2 == 1)
+            reader.read<uint32_t>();
+        reader.read(response.begins.data(), n);
+        reader.read(response.ends.data(), n);
+
+        if (error_type != 0)
+            response.error = LexError{error_type == 1 ? LexError::Type::REJECTED : LexError::Type::INVALID_UTF8, error_offset};
+
+        return response;
+    }
+
+    LexClient::Response LexClient::lex(std::string_view input, std::string_view grammar)
+    {
+        this->send(input, grammar);
+        return this->receive();
+    }
+}
@@ -0,0 +1,228 @@
+#include "lexer/shuffle_lexer.hpp"
+#include "utf8.hpp"
+#include "parallel_scan.hpp"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHUFFLE_HAVE_X86
+#endif
+
+namespace {
+    using lexer::StateVector;
+    using lexer::ShuffleTable;
+
+    // Bytes of a state vector which PSHUFB shuffles at once.
+    constexpr const size_t CHUNK_SIZE = 16;
+
+    void apply_scalar(const ShuffleTable& table, StateVector& v, const uint8_t* input, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            const auto& t = table.transitions[input[i]];
+            for (size_t s = 0; s < table.num_states; ++s)
+                v.states[s] = t.states[v.states[s]];
+        }
+    }
+
+#ifdef SHUFFLE_HAVE_X86
+    // The vector is split in CHUNKS registers of 16 states, and so is the transition vector of every
+    // byte. PSHUFB looks up the low 4 bits of every state in one chunk of the transition vector; for
+    // more than one chunk the lookups in every chunk are masked by the high bits of the state.
+    template <size_t CHUNKS>
+    __attribute__((target("ssse3"))) void apply_ssse3(const ShuffleTable& table, StateVector& v, const uint8_t* input, size_t n) {
+        __m128i states[CHUNKS];
+        __m128i chunk_of[CHUNKS];
+        for (size_t j = 0; j < CHUNKS; ++j) {
+            states[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(v.states + j * CHUNK_SIZE));
+            chunk_of[j] = _mm_set1_epi8(static_cast<char>(j * CHUNK_SIZE));
+        }
+        auto high_bits = _mm_set1_epi8(static_cast<char>(~(CHUNK_SIZE - 1)));
+
+        for (size_t i = 0; i < n; ++i) {
+            const auto* t = reinterpret_cast<const __m128i*>(table.transitions[input[i]].states);
+            __m128i chunks[CHUNKS];
+            for (size_t k = 0; k < CHUNKS; ++k)
+                chunks[k] = _mm_load_si128(t + k);
+
+            for (size_t j = 0; j < CHUNKS; ++j) {
+                if constexpr (CHUNKS == 1) {
+                    states[j] = _mm_shuffle_epi8(chunks[0], states[j]);
+                } else {
+                    auto high = _mm_and_si128(states[j], high_bits);
+                    auto result = _mm_setzero_si128();
+                    for (size_t k = 0; k < CHUNKS; ++k) {
+                        auto lookup = _mm_shuffle_epi8(chunks[k], states[j]);
+                        result = _mm_or_si128(result, _mm_and_si128(lookup, _mm_cmpeq_epi8(high, chunk_of[k])));
+                    }
+                    states[j] = result;
+                }
+            }
+        }
+
+        for (size_t j = 0; j < CHUNKS; ++j)
+            _mm_store_si128(reinterpret_cast<__m128i*>(v.states + j * CHUNK_SIZE), states[j]);
+    }
+
+    // VPERMB looks up all 64 states in the whole transition vector at once. The masked form is the
+    // same instruction, but keeps GCC from warning about the undefined source of the unmasked one.
+    __attribute__((target("avx512f,avx512bw,avx512vbmi"))) void apply_vbmi(const ShuffleTable& table, StateVector& v, const uint8_t* input, size_t n) {
+        auto states = _mm512_load_si512(v.states);
+        for (size_t i = 0; i < n; ++i)
+            states = _mm512_maskz_permutexvar_epi8(~__mmask64{0}, states, _mm512_load_si512(table.transitions[input[i]].states));
+        _mm512_store_si512(v.states, states);
+    }
+#endif
+
+    using ApplyFn = void (*)(const ShuffleTable&, StateVector&, const uint8_t*, size_t);
+
+    // The SSSE3 implementations only shuffle the chunks which hold states, so the choice depends on
+    // the table as well as on the processor.
+    ApplyFn select_implementation(size_t num_states) {
+#ifdef SHUFFLE_HAVE_X86
+        static const bool have_vbmi = __builtin_cpu_supports("avx512vbmi");
+        static const bool have_ssse3 = __builtin_cpu_supports("ssse3");
+        if (have_vbmi)
+            return apply_vbmi;
+        if (have_ssse3) {
+            switch ((num_states + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+                case 1: return apply_ssse3<1>;
+                case 2: return apply_ssse3<2>;
+                case 3: return apply_ssse3<3>;
+                case 4: return apply_ssse3<4>;
+            }
+        }
+#endif
+        return apply_scalar;
+    }
+}
+
+namespace lexer {
+    StateVector StateVector::identity() {
+        auto v = StateVector();
+        for (size_t s = 0; s < MAX_STATES; ++s)
+            v.states[s] = s;
+        return v;
+    }
+
+    ShuffleTable::ShuffleTable(const FiniteStateAutomaton& dfa):
+        num_states(dfa.num_states()), lexemes(dfa.lexemes) {
+        if (!fits(dfa))
+            throw TooManyDfaStatesError();
+
+        // Missing transitions go to REJECT, and so do the states past the last one, so that every
+        // lane of a state vector stays a valid index.
+        for (size_t sym = 0; sym <= FiniteStateAutomaton::MAX_SYM; ++sym) {
+            std::fill(std::begin(this->transitions[sym].states), std::end(this->transitions[sym].states), FiniteStateAutomaton::REJECT);
+            this->produces_lexeme[sym] = 0;
+        }
+
+        for (size_t src = 0; src < dfa.num_states(); ++src) {
+            for (const auto [sym, dst, produces_lexeme] : dfa.transitions(src)) {
+                this->transitions[sym].states[src] = dst;
+                if (produces_lexeme)
+                    this->produces_lexeme[sym] |= uint64_t{1} << src;
+            }
+        }
+    }
+
+    bool ShuffleTable::fits(const FiniteStateAutomaton& dfa) {
+        return dfa.num_states() <= StateVector::MAX_STATES;
+    }
+
+    void ShuffleTable::apply(StateVector& v, std::string_view input) const {
+        auto apply = select_implementation(this->num_states);
+        apply(*this, v, reinterpret_cast<const uint8_t*>(input.data()), input.size());
+    }
+
+    void ShuffleTable::compose(StateVector& first, const StateVector& second) const {
+        for (size_t s = 0; s < this->num_states; ++s)
+            first.states[s] = second.states[first.states[s]];
+    }
+
+    size_t ShuffleTable::memory_bytes() const {
+        return sizeof(ShuffleTable) + this->lexemes.capacity() * sizeof(const Lexeme*);
+    }
+
+    ShuffleLexer::ShuffleLexer(const ShuffleTable* table, bool utf8_validation, ThreadPool& pool):
+        table(table), utf8_validation(utf8_validation), pool(&pool), tiles(pool) {}
+
+    const char* ShuffleLexer::name() const {
+        return "shuffle";
+    }
+
+    void ShuffleLexer::reserve(size_t input_length) {
+        this->aggregates.reserve(this->tiles.count(input_length));
+        this->tiles.reserve(input_length);
+    }
+
+    void ShuffleLexer::release() {
+        this->aggregates = std::vector<StateVector>();
+        this->tiles.release();
+    }
+
+    void ShuffleLexer::map(std::string_view input) {
+        StageTimer timer(&this->profile, "map", input.size());
+
+        this->input = input;
+        this->error.reset();
+
+        this->tiles.split(input.size());
+        this->aggregates.resize(this->tiles.size());
+
+        this->pool->parallel_for(this->tiles.size(), [&](size_t t) {
+            auto begin = this->tiles.begin(t);
+            auto end = this->tiles.end(t);
+
+            auto& aggregate = this->aggregates[t];
+            aggregate = StateVector::identity();
+            this->table->apply(aggregate, input.substr(begin, end - begin));
+
+            if (this->utf8_validation)
+                this->tiles[t].first_invalid = find_utf8_error(input, begin, end);
+        });
+
+        if (this->utf8_validation)
+            this->error = this->tiles.first_utf8_error();
+    }
+
+    void ShuffleLexer::scan() {
+        StageTimer timer(&this->profile, "scan", this->input.size());
+
+        parallel_inclusive_scan(*this->pool, this->aggregates.data(), this->aggregates.size(),
+            [&](const StateVector& a, const StateVector& b) {
+                auto result = a;
+                this->table->compose(result, b);
+                return result;
+            });
+    }
+
+    void ShuffleLexer::extract(TokenStream& tokens) {
+        auto input = this->input;
+        StageTimer timer(&this->profile, "extract", input.size());
+
+        const auto& transitions = this->table->transitions;
+        const auto& produces_lexeme = this->table->produces_lexeme;
+        const auto& lexemes = this->table->lexemes;
+        constexpr auto START = FiniteStateAutomaton::START;
+
+        // The DFA itself, started in every tile from the state that all tiles before it end in.
+        this->pool->parallel_for(this->tiles.size(), [&](size_t t) {
+            auto& tile = this->tiles[t];
+            tile.clear_tokens();
+
+            auto begin = this->tiles.begin(t);
+            auto end = this->tiles.end(t);
+
+            size_t state = t == 0 ? transitions[static_cast<uint8_t>(input[0])].states[START] : this->aggregates[t - 1].states[START];
+            for (size_t i = std::max(begin, size_t{1}); i < end; ++i) {
+                auto c = static_cast<uint8_t>(input[i]);
+                if ((produces_lexeme[c] >> state) & 1)
+                    tile.add_token(i, lexemes[state]);
+                state = transitions[c].states[state];
+            }
+        });
+
+        const auto* last = lexemes[this->aggregates.back().states[START]];
+        timer.add_count(this->tiles.copy_tokens(tokens, last, this->error));
+    }
+}
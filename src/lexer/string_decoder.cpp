@@ -0,0 +1,243 @@
+#include "lexer/string_decoder.hpp"
+#include "utf8.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+    constexpr const size_t MIN_CHUNK_SIZE = 1 << 14;
+
+    struct ScanResult {
+        size_t first_escape;
+        bool ascii;
+    };
+
+    // Finds the first backslash in text, and checks whether everything before it is ASCII.
+    // Strings without escapes are the common case, so this single pass is all they need.
+    ScanResult scan(std::string_view text) {
+        auto p = reinterpret_cast<const uint8_t*>(text.data());
+        auto end = p + text.size();
+        auto begin = p;
+        uint8_t high_bits = 0;
+
+#ifdef __SSE2__
+        auto backslash = _mm_set1_epi8('\\');
+        int high_mask = 0;
+        while (end - p >= 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            auto escape_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash));
+            auto v_high_mask = _mm_movemask_epi8(v);
+            if (escape_mask != 0) {
+                auto offset = __builtin_ctz(escape_mask);
+                high_mask |= v_high_mask & ((1 << offset) - 1);
+                return {static_cast<size_t>(p - begin + offset), high_mask == 0};
+            }
+
+            high_mask |= v_high_mask;
+            p += 16;
+        }
+        high_bits = high_mask != 0 ? 0x80 : 0;
+#endif
+
+        for (; p != end; ++p) {
+            if (*p == '\\')
+                break;
+            high_bits |= *p;
+        }
+
+        return {static_cast<size_t>(p - begin), (high_bits & 0x80) == 0};
+    }
+
+    int hex_value(char c) {
+        if ('0' <= c && c <= '9')
+            return c - '0';
+        else if ('a' <= c && c <= 'f')
+            return c - 'a' + 10;
+        else if ('A' <= c && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Parses the 4 hex digits of a \u escape starting at p.
+    std::optional<uint32_t> parse_hex4(const char* p, const char* end) {
+        if (end - p < 4)
+            return std::nullopt;
+
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            auto digit = hex_value(p[i]);
+            if (digit < 0)
+                return std::nullopt;
+            value = value * 16 + digit;
+        }
+        return value;
+    }
+
+    char* encode_utf8(uint32_t code_point, char* out) {
+        if (code_point < 0x80) {
+            *out++ = code_point;
+        } else if (code_point < 0x800) {
+            *out++ = 0xC0 | (code_point >> 6);
+            *out++ = 0x80 | (code_point & 0x3F);
+        } else if (code_point < 0x10000) {
+            *out++ = 0xE0 | (code_point >> 12);
+            *out++ = 0x80 | ((code_point >> 6) & 0x3F);
+            *out++ = 0x80 | (code_point & 0x3F);
+        } else {
+            *out++ = 0xF0 | (code_point >> 18);
+            *out++ = 0x80 | ((code_point >> 12) & 0x3F);
+            *out++ = 0x80 | ((code_point >> 6) & 0x3F);
+            *out++ = 0x80 | (code_point & 0x3F);
+        }
+        return out;
+    }
+
+    // Decodes body, which starts with an escape sequence at offset first_escape, into out.
+    // Returns the end of the decoded output. The output is never longer than the input.
+    char* unescape(std::string_view body, size_t first_escape, char* out) {
+        const char* p = body.data();
+        const char* end = p + body.size();
+
+        std::memcpy(out, p, first_escape);
+        out += first_escape;
+        p += first_escape;
+
+        while (p != end) {
+            auto* next_escape = static_cast<const char*>(std::memchr(p, '\\', end - p));
+            if (!next_escape)
+                next_escape = end;
+
+            std::memcpy(out, p, next_escape - p);
+            out += next_escape - p;
+            p = next_escape;
+            if (p == end)
+                break;
+
+            if (++p == end)
+                return nullptr;
+
+            switch (*p++) {
+                case '"': *out++ = '"'; break;
+                case '\\': *out++ = '\\'; break;
+                case '/': *out++ = '/'; break;
+                case 'b': *out++ = '\b'; break;
+                case 'f': *out++ = '\f'; break;
+                case 'n': *out++ = '\n'; break;
+                case 'r': *out++ = '\r'; break;
+                case 't': *out++ = '\t'; break;
+                case 'u': {
+                    auto code_point = parse_hex4(p, end);
+                    if (!code_point.has_value())
+                        return nullptr;
+                    p += 4;
+
+                    // Characters outside of the basic multilingual plane are written as a surrogate pair.
+                    if (code_point.value() >= 0xD800 && code_point.value() <= 0xDBFF) {
+                        if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                            return nullptr;
+
+                        auto low = parse_hex4(p + 2, end);
+                        if (!low.has_value() || low.value() < 0xDC00 || low.value() > 0xDFFF)
+                            return nullptr;
+                        p += 6;
+
+                        code_point = 0x10000 + ((code_point.value() - 0xD800) << 10) + (low.value() - 0xDC00);
+                    } else if (code_point.value() >= 0xDC00 && code_point.value() <= 0xDFFF) {
+                        return nullptr;
+                    }
+
+                    out = encode_utf8(code_point.value(), out);
+                    break;
+                }
+                default:
+                    return nullptr;
+            }
+        }
+
+        return out;
+    }
+}
+
+namespace lexer {
+    std::optional<std::string_view> decode_string(std::string_view literal, Arena& arena) {
+        if (literal.size() < 2 || literal.front() != '"' || literal.back() != '"')
+            return std::nullopt;
+
+        auto body = literal.substr(1, literal.size() - 2);
+        auto [first_escape, ascii] = scan(body);
+
+        if (first_escape == body.size()) {
+            if (!ascii && validate_utf8(body).has_value())
+                return std::nullopt;
+            return body;
+        }
+
+        // Escape sequences are pure ASCII, so validating the raw contents validates the decoded string.
+        if (validate_utf8(ascii ? body.substr(first_escape) : body).has_value())
+            return std::nullopt;
+
+        auto* out = arena.allocate_array<char>(body.size());
+        auto* out_end = unescape(body, first_escape, out);
+        if (!out_end)
+            return std::nullopt;
+
+        return std::string_view(out, out_end - out);
+    }
+
+    size_t StringColumn::size() const {
+        return this->tokens.size();
+    }
+
+    StringDecoder::StringDecoder(const LexicalGrammar* g, std::string_view lexeme_name):
+        lexeme(g->find_lexeme(lexeme_name)) {
+        if (!this->lexeme)
+            throw UnknownLexemeError(lexeme_name);
+    }
+
+    StringColumn StringDecoder::decode(std::string_view input, const TokenStream& tokens, ThreadPool& pool) const {
+        auto num_chunks = pool.chunk_count(tokens.size(), MIN_CHUNK_SIZE);
+
+        // First count the strings in every chunk, so that each chunk knows where to write its values.
+        auto offsets = std::vector<size_t>(num_chunks + 1, 0);
+        pool.for_each_chunk(tokens.size(), num_chunks, [&](size_t c, size_t begin, size_t end) {
+            offsets[c + 1] = std::count(tokens.lexemes.begin() + begin, tokens.lexemes.begin() + end, this->lexeme);
+        });
+
+        for (size_t c = 0; c < num_chunks; ++c)
+            offsets[c + 1] += offsets[c];
+
+        auto column = StringColumn();
+        column.tokens.resize(offsets[num_chunks]);
+        column.values.resize(offsets[num_chunks]);
+        column.arenas.resize(num_chunks);
+
+        auto errors = std::vector<size_t>(num_chunks, tokens.size());
+        pool.for_each_chunk(tokens.size(), num_chunks, [&](size_t c, size_t begin, size_t end) {
+            auto out = offsets[c];
+            for (size_t i = begin; i < end; ++i) {
+                if (tokens.lexemes[i] != this->lexeme)
+                    continue;
+
+                auto literal = input.substr(tokens.begins[i], tokens.ends[i] - tokens.begins[i]);
+                auto value = decode_string(literal, column.arenas[c]);
+                if (!value.has_value())
+                    errors[c] = std::min(errors[c], i);
+
+                column.tokens[out] = i;
+                column.values[out] = value.value_or(std::string_view());
+                ++out;
+            }
+        });
+
+        auto first_error = *std::min_element(errors.begin(), errors.end());
+        if (first_error != tokens.size())
+            column.first_error = first_error;
+
+        return column;
+    }
+}
@@ -0,0 +1,125 @@
+#include "lexer/tile_set.hpp"
+#include "utf8.hpp"
+
+#include <algorithm>
+
+namespace {
+    constexpr const size_t MIN_TILE_SIZE = 1 << 16;
+}
+
+namespace lexer {
+    void TileSet::Tile::clear_tokens() {
+        this->ends.clear();
+        this->lexemes.clear();
+        this->first_rejected.reset();
+    }
+
+    void TileSet::Tile::add_token(size_t end, const Lexeme* lexeme) {
+        if (!lexeme && !this->first_rejected.has_value())
+            this->first_rejected = this->ends.size();
+        this->ends.push_back(end);
+        this->lexemes.push_back(lexeme);
+    }
+
+    TileSet::TileSet(ThreadPool& pool):
+        pool(&pool), input_length(0), tile_size(0), num_tiles(0) {}
+
+    size_t TileSet::count(size_t input_length) const {
+        return this->pool->chunk_count(input_length, MIN_TILE_SIZE);
+    }
+
+    void TileSet::reserve(size_t input_length) {
+        auto num_tiles = this->count(input_length);
+        if (this->tiles.size() < num_tiles)
+            this->tiles.resize(num_tiles);
+    }
+
+    void TileSet::release() {
+        this->tiles = std::vector<Tile>();
+    }
+
+    void TileSet::split(size_t n) {
+        auto wanted_tiles = this->count(n);
+        this->input_length = n;
+        this->tile_size = (n + wanted_tiles - 1) / wanted_tiles;
+        this->tile_size = (this->tile_size + UTF8_BLOCK_SIZE - 1) / UTF8_BLOCK_SIZE * UTF8_BLOCK_SIZE;
+        this->num_tiles = (n + this->tile_size - 1) / this->tile_size;
+        if (this->tiles.size() < this->num_tiles)
+            this->tiles.resize(this->num_tiles);
+    }
+
+    size_t TileSet::size() const {
+        return this->num_tiles;
+    }
+
+    size_t TileSet::begin(size_t t) const {
+        return t * this->tile_size;
+    }
+
+    size_t TileSet::end(size_t t) const {
+        return std::min(this->input_length, this->begin(t) + this->tile_size);
+    }
+
+    TileSet::Tile& TileSet::operator[](size_t t) {
+        return this->tiles[t];
+    }
+
+    std::optional<LexError> TileSet::first_utf8_error() const {
+        std::optional<LexError> error;
+        for (size_t t = 0; t < this->num_tiles; ++t) {
+            const auto& offset = this->tiles[t].first_invalid;
+            if (offset.has_value() && (!error.has_value() || offset.value() < error->offset))
+                error = LexError{LexError::Type::INVALID_UTF8, offset.value()};
+        }
+        return error;
+    }
+
+    size_t TileSet::copy_tokens(TokenStream& tokens, const Lexeme* last, const std::optional<LexError>& error) {
+        // The first token of every tile begins where the last token of the tiles before it ends.
+        auto base = tokens.size();
+        size_t total = 0;
+        size_t last_end = 0;
+        std::optional<size_t> first_rejected;
+        for (size_t t = 0; t < this->num_tiles; ++t) {
+            auto& tile = this->tiles[t];
+            tile.offset = base + total;
+            tile.first_begin = last_end;
+            if (!first_rejected.has_value() && tile.first_rejected.has_value()) {
+                auto k = tile.first_rejected.value();
+                first_rejected = k == 0 ? last_end : tile.ends[k - 1];
+            }
+            total += tile.ends.size();
+            if (!tile.ends.empty())
+                last_end = tile.ends.back();
+        }
+
+        tokens.begins.resize(base + total + 1);
+        tokens.ends.resize(base + total + 1);
+        tokens.lexemes.resize(base + total + 1);
+
+        this->pool->parallel_for(this->num_tiles, [&](size_t t) {
+            const auto& tile = this->tiles[t];
+            auto out = tile.offset;
+            auto token_begin = tile.first_begin;
+            for (size_t k = 0; k < tile.ends.size(); ++k, ++out) {
+                tokens.begins[out] = token_begin;
+                tokens.ends[out] = tile.ends[k];
+                tokens.lexemes[out] = tile.lexemes[k];
+                token_begin = tile.ends[k];
+            }
+        });
+
+        tokens.begins[base + total] = last_end;
+        tokens.ends[base + total] = this->input_length;
+        tokens.lexemes[base + total] = last;
+
+        if (error.has_value())
+            tokens.report_error(error->type, error->offset);
+        if (first_rejected.has_value())
+            tokens.report_error(LexError::Type::REJECTED, first_rejected.value());
+        if (!last)
+            tokens.report_error(LexError::Type::REJECTED, last_end);
+
+        return total + 1;
+    }
+}
@@ -0,0 +1,529 @@
+#include "lexer/token_file.hpp"
+
+#include <istream>
+#include <ostream>
+#include <bit>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static_assert(std::endian::native == std::endian::little, "The token file format is little-endian");
+
+namespace
+{
+    using lexer::TokenFormatError;
+
+    constexpr const uint32_t CONTIGUOUS = 1;
+    constexpr const size_t BLOCK_HEADER_SIZE = 24;
+    constexpr const size_t TRAILER_SIZE = 12;
+
+    template <typename T>
+    void append_raw(std::string &out, T value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void append_varint(std::string &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    void append_string(std::string &out, std::string_view s)
+    {
+        append_varint(out, s.size());
+        out += s;
+    }
+
+    // Reads the encoded values from a buffer, checking every read against its end.
+    class Cursor
+    {
+        std::string_view data;
+        size_t offset = 0;
+
+    public:
+        Cursor(std::string_view data) : data(data) {}
+
+        size_t remaining() const
+        {
+            return this->data.size() - this->offset;
+        }
+
+        std::string_view take(size_t n)
+        {
+            if (n > this->remaining())
+                throw TokenFormatError("Truncated token stream");
+            auto result = this->data.substr(this->offset, n);
+            this->offset += n;
+            return result;
+        }
+
+        template <typename T>
+        T read()
+        {
+            T value;
+            std::memcpy(&value, this->take(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        uint64_t read_varint()
+        {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7)
+            {
+                auto byte = this->read<uint8_t>();
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw TokenFormatError("Invalid varint in token stream");
+        }
+
+        std::string read_string()
+        {
+            return std::string(this->take(this->read_varint()));
+        }
+    };
+
+    uint32_t id_width_for(size_t lexemes)
+    {
+        // The largest id of the width is reserved for rejected input.
+        if (lexemes < UINT8_MAX)
+            return 1;
+        if (lexemes < UINT16_MAX)
+            return 2;
+        return 4;
+    }
+
+    uint32_t rejected_id(uint32_t id_width)
+    {
+        return id_width == 4 ? UINT32_MAX : (uint32_t{1} << (8 * id_width)) - 1;
+    }
+
+    lexer::TokenFileHeader parse_header(Cursor &cursor)
+    {
+        if (cursor.read<uint32_t>() != lexer::TOKEN_FILE_MAGIC)
+            throw TokenFormatError("Not a token stream");
+        if (cursor.read<uint16_t>() != lexer::TOKEN_FILE_VERSION)
+            throw TokenFormatError("Unsupported token stream version");
+
+        auto header = lexer::TokenFileHeader();
+        header.id_width = cursor.read<uint8_t>();
+        cursor.read<uint8_t>();
+        header.block_tokens = cursor.read<uint32_t>();
+        if (header.id_width != 1 && header.id_width != 2 && header.id_width != 4)
+            throw TokenFormatError("Invalid lexeme id width in token stream");
+
+        header.lexemes.resize(cursor.read<uint32_t>());
+        for (auto &name : header.lexemes)
+            name = cursor.read_string();
+        header.source = cursor.read_string();
+
+        return header;
+    }
+
+    struct BlockHeader
+    {
+        uint32_t tokens;
+        uint32_t flags;
+        uint32_t payload_size;
+        uint32_t reserved;
+        uint64_t first_begin;
+    };
+
+    static_assert(sizeof(BlockHeader) == BLOCK_HEADER_SIZE);
+
+    void decode_block(const BlockHeader &header, std::string_view payload, uint32_t id_width, lexer::TokenBlock &block)
+    {
+        size_t n = header.tokens;
+        auto cursor = Cursor(payload);
+
+        // Taken before resizing, so that a corrupt count fails instead of allocating.
+        auto ids = cursor.take(n * id_width);
+        block.lexeme_ids.resize(n);
+        block.begins.resize(n);
+        block.ends.resize(n);
+
+        auto rejected = rejected_id(id_width);
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint32_t id = 0;
+            std::memcpy(&id, ids.data() + i * id_width, id_width);
+            block.lexeme_ids[i] = id == rejected ? lexer::TokenBlock::REJECTED_ID : id;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+            block.ends[i] = cursor.read_varint();
+
+        // Lengths were read into ends, which become offsets here.
+        uint64_t begin = header.first_begin;
+        bool contiguous = header.flags & CONTIGUOUS;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (i > 0 && !contiguous)
+                begin += cursor.read_varint();
+            block.begins[i] = begin;
+            block.ends[i] += begin;
+            begin = block.ends[i];
+        }
+
+        if (cursor.remaining() != 0)
+            throw TokenFormatError("Trailing bytes in token block");
+    }
+
+    struct Footer
+    {
+        uint64_t total_tokens;
+        std::optional<lexer::LexError> error;
+        std::vector<uint64_t> block_offsets;
+    };
+
+    // The footer after the end marker, without its trailer.
+    Footer parse_footer(Cursor &cursor)
+    {
+        auto footer = Footer();
+        footer.total_tokens = cursor.read<uint64_t>();
+        auto error_type = cursor.read<uint32_t>();
+        auto error_offset = cursor.read<uint64_t>();
+        if (error_type != 0)
+            footer.error = lexer::LexError{error_type == 1 ? lexer::LexError::Type::REJECTED : lexer::LexError::Type::INVALID_UTF8, error_offset};
+
+        auto blocks = cursor.read<uint32_t>();
+        if (blocks > cursor.remaining() / sizeof(uint64_t))
+            throw TokenFormatError("Truncated token stream");
+        footer.block_offsets.resize(blocks);
+        for (auto &offset : footer.block_offsets)
+            offset = cursor.read<uint64_t>();
+
+        return footer;
+    }
+
+    void read_exact(std::istream &in, char *data, size_t n)
+    {
+        if (!in.read(data, n))
+            throw TokenFormatError("Truncated token stream");
+    }
+
+    std::string read_exact(std::istream &in, size_t n)
+    {
+        auto result = std::string(n, '\0');
+        read_exact(in, result.data(), n);
+        return result;
+    }
+}
+
+namespace lexer
+{
+    size_t TokenBlock::size() const
+    {
+        return this->lexeme_ids.size();
+    }
+
+    void TokenBlock::clear()
+    {
+        this->lexeme_ids.clear();
+        this->begins.clear();
+        this->ends.clear();
+    }
+
+    TokenStreamWriter::TokenStreamWriter(std::ostream &out, const LexicalGrammar *grammar, std::string_view source, uint32_t block_tokens) :
+        out(&out), grammar(grammar), id_width(id_width_for(grammar->lexemes.size())), block_tokens(std::max(uint32_t{1}, block_tokens)),
+        offset(0), total_tokens(0), last_end(0), finished(false)
+    {
+        auto header = std::string();
+        append_raw(header, TOKEN_FILE_MAGIC);
+        append_raw(header, TOKEN_FILE_VERSION);
+        append_raw(header, static_cast<uint8_t>(this->id_width));
+        append_raw(header, uint8_t{0});
+        append_raw(header, this->block_tokens);
+        append_raw(header, static_cast<uint32_t>(grammar->lexemes.size()));
+        for (const auto &lexeme : grammar->lexemes)
+            append_string(header, lexeme.name);
+        append_string(header, source);
+
+        this->write_bytes(header);
+    }
+
+    void TokenStreamWriter::write_bytes(std::string_view bytes)
+    {
+        this->out->write(bytes.data(), bytes.size());
+        this->offset += bytes.size();
+    }
+
+    void TokenStreamWriter::push_back(const Lexeme *lexeme, uint64_t begin, uint64_t end)
+    {
+        if (this->finished)
+            throw TokenFormatError("Token stream is already finished");
+        if (begin < this->last_end || end < begin)
+            throw TokenFormatError("Token offsets must be nondecreasing");
+
+        this->pending.lexeme_ids.push_back(lexeme ? this->grammar->lexeme_id(lexeme) : rejected_id(this->id_width));
+        this->pending.begins.push_back(begin);
+        this->pending.ends.push_back(end);
+        this->last_end = end;
+
+        if (this->pending.size() == this->block_tokens)
+            this->flush_block();
+    }
+
+    void TokenStreamWriter::write(const TokenStream &tokens)
+    {
+        for (size_t i = 0; i < tokens.size(); ++i)
+            this->push_back(tokens.lexemes[i], tokens.begins[i], tokens.ends[i]);
+    }
+
+    void TokenStreamWriter::flush_block()
+    {
+        size_t n = this->pending.size();
+        if (n == 0)
+            return;
+
+        auto &payload = this->buffer;
+        payload.clear();
+        for (auto id : this->pending.lexeme_ids)
+            payload.append(reinterpret_cast<const char *>(&id), this->id_width);
+
+        bool contiguous = true;
+        for (size_t i = 0; i < n; ++i)
+        {
+            append_varint(payload, this->pending.ends[i] - this->pending.begins[i]);
+            contiguous &= i == 0 || this->pending.begins[i] == this->pending.ends[i - 1];
+        }
+
+        if (!contiguous)
+        {
+            for (size_t i = 1; i < n; ++i)
+                append_varint(payload, this->pending.begins[i] - this->pending.ends[i - 1]);
+        }
+
+        auto header = BlockHeader{static_cast<uint32_t>(n), contiguous ? CONTIGUOUS : 0, static_cast<uint32_t>(payload.size()), 0, this->pending.begins[0]};
+        this->block_offsets.push_back(this->offset);
+        this->write_bytes(std::string_view(reinterpret_cast<const char *>(&header), sizeof(header)));
+        this->write_bytes(payload);
+
+        this->total_tokens += n;
+        this->pending.clear();
+    }
+
+    void TokenStreamWriter::finish(std::optional<LexError> error)
+    {
+        if (this->finished)
+            throw TokenFormatError("Token stream is already finished");
+
+        this->flush_block();
+        this->finished = true;
+
+        auto footer = std::string();
+        uint64_t footer_offset = this->offset;
+        append_raw(footer, uint32_t{0});
+        append_raw(footer, this->total_tokens);
+        append_raw(footer, static_cast<uint32_t>(!error.has_value() ? 0 : error->type == LexError::Type::REJECTED ? 1 : 2));
+        append_raw(footer, static_cast<uint64_t>(error.has_value() ? error->offset : 0));
+        append_raw(footer, static_cast<uint32_t>(this->block_offsets.size()));
+        for (auto block_offset : this->block_offsets)
+            append_raw(footer, block_offset);
+        append_raw(footer, footer_offset);
+        append_raw(footer, TOKEN_FILE_END_MAGIC);
+
+        this->write_bytes(footer);
+        this->out->flush();
+    }
+
+    TokenStreamReader::TokenStreamReader(std::istream &in) : in(&in), at_end(false), total_tokens(0)
+    {
+        // The header has a fixed part followed by the varint prefixed names, which are read one by one.
+        auto header = read_exact(in, 16);
+        uint32_t lexemes;
+        std::memcpy(&lexemes, header.data() + 12, sizeof(lexemes));
+
+        auto read_string = [&]
+        {
+            uint64_t length = 0;
+            for (unsigned shift = 0;; shift += 7)
+            {
+                char byte;
+                read_exact(in, &byte, 1);
+                header += byte;
+                length |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    break;
+                if (shift >= 63)
+                    throw TokenFormatError("Invalid varint in token stream");
+            }
+            header += read_exact(in, length);
+        };
+
+        uint32_t magic;
+        std::memcpy(&magic, header.data(), sizeof(magic));
+        if (magic != TOKEN_FILE_MAGIC)
+            throw TokenFormatError("Not a token stream");
+        for (uint32_t i = 0; i <= lexemes; ++i)
+            read_string();
+
+        auto cursor = Cursor(header);
+        this->file_header = parse_header(cursor);
+    }
+
+    const TokenFileHeader &TokenStreamReader::header() const
+    {
+        return this->file_header;
+    }
+
+    bool TokenStreamReader::next_block(TokenBlock &block)
+    {
+        if (this->at_end)
+            return false;
+
+        uint32_t tokens;
+        read_exact(*this->in, reinterpret_cast<char *>(&tokens), sizeof(tokens));
+        if (tokens == 0)
+        {
+            // Footer: fixed fields, the block index and the trailer.
+            auto fixed = read_exact(*this->in, 24);
+            uint32_t blocks;
+            std::memcpy(&blocks, fixed.data() + 20, sizeof(blocks));
+            auto rest = read_exact(*this->in, size_t{blocks} * sizeof(uint64_t));
+            auto trailer = read_exact(*this->in, TRAILER_SIZE);
+            uint32_t end_magic;
+            std::memcpy(&end_magic, trailer.data() + 8, sizeof(end_magic));
+            if (end_magic != TOKEN_FILE_END_MAGIC)
+                throw TokenFormatError("Invalid token stream footer");
+
+            auto data = fixed + rest;
+            auto cursor = Cursor(data);
+            auto footer = parse_footer(cursor);
+            this->total_tokens = footer.total_tokens;
+            this->stream_error = footer.error;
+            this->at_end = true;
+
+            block.clear();
+            return false;
+        }
+
+        auto header = BlockHeader();
+        header.tokens = tokens;
+        read_exact(*this->in, reinterpret_cast<char *>(&header) + sizeof(tokens), sizeof(header) - sizeof(tokens));
+
+        this->buffer.resize(header.payload_size);
+        read_exact(*this->in, this->buffer.data(), header.payload_size);
+        decode_block(header, this->buffer, this->file_header.id_width, block);
+        return true;
+    }
+
+    uint64_t TokenStreamReader::token_count() const
+    {
+        return this->total_tokens;
+    }
+
+    std::optional<LexError> TokenStreamReader::error() const
+    {
+        return this->stream_error;
+    }
+
+    TokenFileReader::TokenFileReader(const std::string &path)
+    {
+        this->fd = open(path.c_str(), O_RDONLY);
+        if (this->fd < 0)
+            throw TokenFormatError("Failed to open '" + path + "': " + std::strerror(errno));
+
+        try
+        {
+            struct stat st;
+            if (fstat(this->fd, &st) < 0 || static_cast<uint64_t>(st.st_size) < TRAILER_SIZE)
+                throw TokenFormatError("Not a token stream");
+            uint64_t size = st.st_size;
+
+            auto trailer = this->read_range(size - TRAILER_SIZE, size);
+            auto trailer_cursor = Cursor(trailer);
+            this->footer_offset = trailer_cursor.read<uint64_t>();
+            if (trailer_cursor.read<uint32_t>() != TOKEN_FILE_END_MAGIC || this->footer_offset >= size - TRAILER_SIZE)
+                throw TokenFormatError("Not a single token stream");
+
+            auto footer_data = this->read_range(this->footer_offset, size - TRAILER_SIZE);
+            auto footer_cursor = Cursor(footer_data);
+            if (footer_cursor.read<uint32_t>() != 0)
+                throw TokenFormatError("Invalid token stream footer");
+            auto footer = parse_footer(footer_cursor);
+            this->block_offsets = std::move(footer.block_offsets);
+            this->total_tokens = footer.total_tokens;
+            this->file_error = footer.error;
+
+            auto header_end = this->block_offsets.empty() ? this->footer_offset : this->block_offsets.front();
+            auto header_data = this->read_range(0, header_end);
+            auto header_cursor = Cursor(header_data);
+            this->file_header = parse_header(header_cursor);
+        }
+        catch (...)
+        {
+            close(this->fd);
+            throw;
+        }
+    }
+
+    TokenFileReader::~TokenFileReader()
+    {
+        close(this->fd);
+    }
+
+    std::string TokenFileReader::read_range(uint64_t begin, uint64_t end) const
+    {
+        if (end < begin)
+            throw TokenFormatError("Invalid offsets in token stream");
+
+        auto result = std::string(end - begin, '\0');
+        size_t done = 0;
+        while (done < result.size())
+        {
+            auto n = pread(this->fd, result.data() + done, result.size() - done, begin + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw TokenFormatError("Truncated token stream");
+            done += n;
+        }
+        return result;
+    }
+
+    const TokenFileHeader &TokenFileReader::header() const
+    {
+        return this->file_header;
+    }
+
+    size_t TokenFileReader::block_count() const
+    {
+        return this->block_offsets.size();
+    }
+
+    uint64_t TokenFileReader::token_count() const
+    {
+        return this->total_tokens;
+    }
+
+    std::optional<LexError> TokenFileReader::error() const
+    {
+        return this->file_error;
+    }
+
+    void TokenFileReader::read_block(size_t index, TokenBlock &block) const
+    {
+        auto begin = this->block_offsets.at(index);
+        auto end = index + 1 < this->block_offsets.size() ? this->block_offsets[index + 1] : this->footer_offset;
+        auto data = this->read_range(begin, end);
+
+        auto cursor = Cursor(data);
+        auto header = BlockHeader();
+        std::memcpy(&header, cursor.take(sizeof(header)).data(), sizeof(header));
+        if (header.tokens == 0 || header.payload_size != cursor.remaining())
+            throw TokenFormatError("Invalid token block");
+
+        decode_block(header, cursor.take(header.payload_size), this->file_header.id_width, block);
+    }
+}
@@ -0,0 +1,27 @@
+#include "lexer/token_stream.hpp"
+
+namespace lexer {
+    size_t TokenStream::size() const {
+        return this->lexemes.size();
+    }
+
+    void TokenStream::clear() {
+        this->begins.clear();
+        this->ends.clear();
+        this->lexemes.clear();
+        this->error.reset();
+    }
+
+    void TokenStream::push_back(const Lexeme* lexeme, size_t begin, size_t end) {
+        this->begins.push_back(begin);
+        this->ends.push_back(end);
+        this->lexemes.push_back(lexeme);
+        if (!lexeme)
+            this->report_error(LexError::Type::REJECTED, begin);
+    }
+
+    void TokenStream::report_error(LexError::Type type, size_t offset) {
+        if (!this->error.has_value() || offset < this->error->offset)
+            this->error = {type, offset};
+    }
+}
@@ -1,100 +1,740 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string_view>
 #include <string>
 #include <iterator>
 #include <stdexcept>
 #include <optional>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <cstdio>
 #include <cstdlib>
-#include <cassert>
+#include <cstring>
+#include <filesystem>
 
-#include "parser.hpp"
-#include "token_mapping.hpp"
-#include "lexer/lexer_parser.hpp"
-#include "lexer/parallel_lexer.hpp"
+#include "thread_pool.hpp"
+#include "lexer/grammar_registry.hpp"
 #include "lexer/interpreter.hpp"
+#include "lexer/token_stream.hpp"
+#include "lexer/token_sink.hpp"
+#include "lexer/server.hpp"
+#include "lexer/token_file.hpp"
+#include "lexer/pipeline.hpp"
+
+#ifdef LEXER_CUDA
 #include "lexer.cuh"
+#endif
+
+#include <signal.h>
+
+// Lexes any number of files with the given grammar and writes the results to stdout or a file.
+//
+// Usage: cuda_lexer [-g [name=]grammar.lex] [-e interpreter|host|nfa|direct|jit|cuda] [-j threads] [-m counts|tokens|binary]
+//                   [-l file-list] [-o output] [--utf8] [--lazy] [--merge-cache size] [--layout-sample file]...
+//                   [--block-size size] [file...]
+//        cuda_lexer [-g [name=]grammar.lex]... [-j threads] [--max-batch n] [--memory-budget size] [--utf8]
+//                   [--lazy] [--merge-cache size] [--layout-sample file]... --serve socket
+//
+// Files are lexed concurrently, but their results are written in the order they were given.
+// A file list holds one path per line, "-" reads it from stdin. With --serve the lexer stays
+// resident and serves requests on a Unix domain socket until interrupted, see lexer/server.hpp.
+// A server may be given several grammars, which requests select by name; a grammar is named after
+// its file without the extension unless a name is given. The first grammar is the default, the
+// others are compiled when first requested and kept within the memory budget (suffixes K, M, G).
+// With --lazy the merge table is not generated; merges are computed as the input needs them and
+// kept in a cache of the given size, which allows grammars whose merge table would be too large.
+// With --layout-sample the states of the merge table are ordered by how often they are used on the
+// sample files, which should resemble the input. Files larger than --block-size are not read into
+// memory at once, but read, lexed and written in blocks of that size by a pipeline which overlaps
+// the three, see lexer/pipeline.hpp. The nfa engine simulates the NFA of the grammar with bit masks
+// instead of generating the DFA and merge table, see lexer/nfa_lexer.hpp. The direct engine runs the
+// lexer which was generated as C++ from the same grammar source at build time, see
+// lexer/direct_lexer.hpp. The jit engine compiles the DFA to machine code when the grammar is loaded,
+// see lexer/jit_lexer.hpp, and is the interpreter on processors that it does not support.
 
-std::optional<std::string> read_input(const char *filename)
+namespace
 {
-    auto in = std::ifstream(filename, std::ios::binary);
-    if (!in)
+    enum class OutputMode
+    {
+        // Per file its size, token count and first error, followed by the total count of every lexeme.
+        COUNTS,
+        // Per file a header line, then a line "lexeme begin end" for every token.
+        TOKENS,
+        // Per file a token stream, see lexer/token_file.hpp.
+        BINARY
+    };
+
+    struct Options
     {
-        printf("Error: Failed to open input file '%s'\n", filename);
-        return std::nullopt;
+        // Pairs of name and path, the first is the default grammar.
+        std::vector<std::pair<std::string, std::string>> grammars;
+        std::string engine = "interpreter";
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        OutputMode mode = OutputMode::COUNTS;
+        std::string output = "-";
+        bool utf8_validation = false;
+        std::string serve;
+        size_t max_batch = 64;
+        size_t memory_budget = std::numeric_limits<size_t>::max();
+        lexer::CompileOptions compile_options;
+        std::optional<size_t> block_size;
+        std::vector<std::string> files;
+    };
+
+    void print_usage()
+    {
+        fprintf(stderr, "Usage: cuda_lexer [-g [name=]grammar.lex] [-e interpreter|host|nfa|direct|jit|cuda] [-j threads] [-m counts|tokens|binary]\n"
+                        "                  [-l file-list] [-o output] [--utf8] [--lazy] [--merge-cache size] [--layout-sample file]...\n"
+                        "                  [--block-size size] [file...]\n"
+                        "       cuda_lexer [-g [name=]grammar.lex]... [-j threads] [--max-batch n] [--memory-budget size] [--utf8]\n"
+                        "                  [--lazy] [--merge-cache size] [--layout-sample file]... --serve socket\n");
     }
 
-    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
-}
+    // "name=path", or a path which is named after its file name without the extension.
+    std::pair<std::string, std::string> parse_grammar_arg(std::string_view arg)
+    {
+        auto eq = arg.find('=');
+        if (eq != std::string_view::npos)
+            return {std::string(arg.substr(0, eq)), std::string(arg.substr(eq + 1))};
 
-struct LexerGeneration
-{
-    lexer::LexicalGrammar grammar;
-    lexer::ParallelLexer parallel_lexer;
-};
+        auto stem = arg;
+        if (auto slash = stem.rfind('/'); slash != std::string_view::npos)
+            stem.remove_prefix(slash + 1);
+        if (auto dot = stem.rfind('.'); dot != std::string_view::npos && dot > 0)
+            stem = stem.substr(0, dot);
+        return {std::string(stem), std::string(arg)};
+    }
 
-std::optional<LexerGeneration> generate_lexer(TokenMapping &tm, const char *lexer_src)
-{
-    std::string input;
-    if (auto maybe_input = read_input(lexer_src))
+    std::optional<size_t> parse_size(const char *arg)
+    {
+        char *end;
+        auto size = std::strtoull(arg, &end, 10);
+        if (end == arg)
+            return std::nullopt;
+
+        switch (*end)
+        {
+        case 'G': case 'g':
+            size <<= 10;
+            [[fallthrough]];
+        case 'M': case 'm':
+            size <<= 10;
+            [[fallthrough]];
+        case 'K': case 'k':
+            size <<= 10;
+            ++end;
+            break;
+        }
+
+        if (*end != '\0')
+            return std::nullopt;
+        return size;
+    }
+
+    std::optional<std::string> read_input(const char *filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+            return std::nullopt;
+        }
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    bool read_file_list(const char *filename, std::vector<std::string> &files)
+    {
+        auto file = std::ifstream();
+        if (std::strcmp(filename, "-") != 0)
+        {
+            file.open(filename);
+            if (!file)
+            {
+                fprintf(stderr, "Error: Failed to open file list '%s'\n", filename);
+                return false;
+            }
+        }
+
+        auto &in = std::strcmp(filename, "-") == 0 ? std::cin : file;
+        for (std::string line; std::getline(in, line);)
+        {
+            if (!line.empty())
+                files.push_back(std::move(line));
+        }
+
+        return true;
+    }
+
+    std::optional<Options> parse_options(int argc, char *argv[])
+    {
+        auto options = Options();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto arg = std::string_view(argv[i]);
+            bool has_value = i + 1 < argc;
+
+            if (arg == "-g" && has_value)
+                options.grammars.push_back(parse_grammar_arg(argv[++i]));
+            else if (arg == "-e" && has_value)
+                options.engine = argv[++i];
+            else if (arg == "-j" && has_value)
+                options.threads = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "-o" && has_value)
+                options.output = argv[++i];
+            else if (arg == "-l" && has_value)
+            {
+                if (!read_file_list(argv[++i], options.files))
+                    return std::nullopt;
+            }
+            else if (arg == "-m" && has_value)
+            {
+                auto mode = std::string_view(argv[++i]);
+                if (mode == "counts")
+                    options.mode = OutputMode::COUNTS;
+                else if (mode == "tokens")
+                    options.mode = OutputMode::TOKENS;
+                else if (mode == "binary")
+                    options.mode = OutputMode::BINARY;
+                else
+                {
+                    fprintf(stderr, "Error: Unknown output mode '%s'\n", argv[i]);
+                    return std::nullopt;
+                }
+            }
+            else if (arg == "--utf8")
+                options.utf8_validation = true;
+            else if (arg == "--serve" && has_value)
+                options.serve = argv[++i];
+            else if (arg == "--max-batch" && has_value)
+                options.max_batch = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "--memory-budget" && has_value)
+            {
+                auto size = parse_size(argv[++i]);
+                if (!size.has_value())
+                {
+                    fprintf(stderr, "Error: Invalid memory budget '%s'\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.memory_budget = size.value();
+            }
+            else if (arg == "--lazy")
+                options.compile_options.lazy = true;
+            else if (arg == "--merge-cache" && has_value)
+            {
+                auto size = parse_size(argv[++i]);
+                if (!size.has_value())
+                {
+                    fprintf(stderr, "Error: Invalid merge cache size '%s'\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.compile_options.merge_cache_bytes = size.value();
+            }
+            else if (arg == "--block-size" && has_value)
+            {
+                auto size = parse_size(argv[++i]);
+                if (!size.has_value() || size.value() == 0)
+                {
+                    fprintf(stderr, "Error: Invalid block size '%s'\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.block_size = size.value();
+            }
+            else if (arg == "--layout-sample" && has_value)
+            {
+                auto sample = read_input(argv[++i]);
+                if (!sample.has_value())
+                    return std::nullopt;
+                options.compile_options.layout_samples.push_back(std::move(sample.value()));
+            }
+            else if (arg == "-h" || arg == "--help")
+            {
+                print_usage();
+                return std::nullopt;
+            }
+            else if (arg.size() > 0 && arg[0] == '-')
+            {
+                fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+                print_usage();
+                return std::nullopt;
+            }
+            else
+                options.files.push_back(argv[i]);
+        }
+
+        if (options.grammars.empty())
+            options.grammars.push_back(parse_grammar_arg("json.lex"));
+
+        if (options.serve.empty() && options.grammars.size() > 1)
+        {
+            fprintf(stderr, "Error: Only a server can use several grammars\n");
+            return std::nullopt;
+        }
+
+        if (options.engine != "interpreter" && options.engine != "host" && options.engine != "nfa" && options.engine != "direct" &&
+            options.engine != "jit" && options.engine != "cuda")
+        {
+            fprintf(stderr, "Error: Unknown engine '%s'\n", options.engine.c_str());
+            return std::nullopt;
+        }
+
+#ifndef LEXER_CUDA
+        if (options.engine == "cuda")
+        {
+            fprintf(stderr, "Error: Built without CUDA\n");
+            return std::nullopt;
+        }
+#endif
+
+        if (options.compile_options.lazy && options.engine != "interpreter")
+        {
+            fprintf(stderr, "Error: Only the interpreter engine can compute merges lazily\n");
+            return std::nullopt;
+        }
+
+        if (options.block_size.has_value() && options.engine != "interpreter")
+        {
+            fprintf(stderr, "Error: Only the interpreter engine can lex in blocks\n");
+            return std::nullopt;
+        }
+
+        if (!options.serve.empty() && options.engine != "interpreter")
+        {
+            fprintf(stderr, "Error: Only the interpreter engine can serve requests\n");
+            return std::nullopt;
+        }
+
+        options.compile_options.nfa = options.engine == "nfa";
+        options.compile_options.direct = options.engine == "direct";
+        options.compile_options.jit = options.engine == "jit";
+        options.compile_options.host = options.engine == "host";
+
+        return options;
+    }
+
+    // Registers the grammars of the options, and compiles the default one.
+    std::shared_ptr<const lexer::CompiledLexer> generate_lexers(const Options &options, lexer::GrammarRegistry &registry)
+    {
+        try
+        {
+            for (const auto &[name, path] : options.grammars)
+                registry.add_file(name, path);
+
+            return registry.get(options.grammars.front().first);
+        }
+        catch (const std::runtime_error &e)
+        {
+            fprintf(stderr, "Failed to generate lexer: %s\n", e.what());
+            return nullptr;
+        }
+    }
+
+    const char *error_name(lexer::LexError::Type type)
+    {
+        return type == lexer::LexError::Type::INVALID_UTF8 ? "invalid_utf8" : "rejected";
+    }
+
+    void write_counts(std::string &out, const std::string &path, size_t bytes, size_t tokens, std::optional<lexer::LexError> error)
+    {
+        out += path;
+        out += '\t' + std::to_string(bytes) + '\t' + std::to_string(tokens);
+        if (error.has_value())
+            out += '\t' + std::string(error_name(error->type)) + '@' + std::to_string(error->offset);
+        out += '\n';
+    }
+
+    void count_lexemes(std::vector<size_t> &counts, const lexer::LexicalGrammar &g, const lexer::TokenStream &tokens)
+    {
+        for (const auto *lexeme : tokens.lexemes)
+        {
+            if (lexeme)
+                ++counts[g.lexeme_id(lexeme)];
+        }
+    }
+
+    // The line of every token, as "lexeme begin end".
+    void write_token_lines(std::string &out, const lexer::TokenStream &tokens)
     {
-        input = std::move(maybe_input.value());
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            out += tokens.lexemes[i] ? tokens.lexemes[i]->name : "(rejected)";
+            out += ' ' + std::to_string(tokens.begins[i]) + ' ' + std::to_string(tokens.ends[i]) + '\n';
+        }
     }
-    else
+
+    void write_tokens_error(std::string &out, std::optional<lexer::LexError> error)
     {
-        return std::nullopt;
+        if (error.has_value())
+            out += "# error " + std::string(error_name(error->type)) + ' ' + std::to_string(error->offset) + '\n';
     }
 
-    try
+    // Appends the token lines of write_token_lines as the tokens are produced.
+    struct TokenLineSink : lexer::ErrorSink
     {
-        auto parser = Parser(input);
-        auto lexer_parser = lexer::LexerParser(&parser);
+        std::string *out;
 
-        auto g = lexer_parser.parse();
-        g.validate();
+        TokenLineSink(std::string *out) : out(out) {}
+
+        void on_token(const lexer::Lexeme *lexeme, size_t begin, size_t end)
+        {
+            if (lexeme)
+                *this->out += lexeme->name;
+            else
+                *this->out += "(rejected)";
+            *this->out += ' ' + std::to_string(begin) + ' ' + std::to_string(end) + '\n';
+            lexer::ErrorSink::on_token(lexeme, begin, end);
+        }
+    };
+
+    void write_binary(std::string &out, const std::string &path, const lexer::LexicalGrammar &g, const lexer::TokenStream &tokens)
+    {
+        auto stream = std::ostringstream();
+        auto writer = lexer::TokenStreamWriter(stream, &g, path);
+        writer.write(tokens);
+        writer.finish(tokens.error);
+        out += stream.str();
+    }
+
+    // Collects the output of files which finish in any order, and writes it in the order of the files.
+    class OrderedWriter
+    {
+        FILE *out;
+        std::mutex mutex;
+        std::map<size_t, std::string> finished;
+        size_t next;
+
+    public:
+        OrderedWriter(FILE *out) : out(out), next(0) {}
+
+        void write(size_t index, std::string data)
+        {
+            auto lock = std::unique_lock(this->mutex);
+            this->finished.emplace(index, std::move(data));
+
+            for (auto it = this->finished.begin(); it != this->finished.end() && it->first == this->next; it = this->finished.erase(it))
+            {
+                fwrite(it->second.data(), 1, it->second.size(), this->out);
+                ++this->next;
+            }
+        }
+    };
+
+    // Lexes a file in blocks with a LexPipeline, writing its output as the blocks are lexed, and
+    // reports how busy each stage was on stderr. Returns false if the file could not be read.
+    bool stream_file(const Options &options, const lexer::LexerInterpreter &interpreter, const lexer::LexicalGrammar &g,
+                     const std::string &path, FILE *out, std::vector<size_t> &counts)
+    {
+        auto pipeline_options = lexer::LexPipeline::Options();
+        pipeline_options.block_size = options.block_size.value();
+        auto pipeline = lexer::LexPipeline(&interpreter, pipeline_options);
 
-        auto parallel_lexer = lexer::ParallelLexer(&g);
+        // Used by the emitter thread only, until the pipeline returns. Nothing is written before the
+        // file was opened.
+        auto chunk = std::string();
+        bool started = false;
+        auto binary = std::ostringstream();
+        auto binary_writer = lexer::TokenStreamWriter(binary, &g, path);
 
-        g.add_tokens(tm);
+        auto flush_binary = [&]
+        {
+            auto data = binary.str();
+            fwrite(data.data(), 1, data.size(), out);
+            binary.str("");
+        };
 
-        return {{std::move(g), std::move(parallel_lexer)}};
+        auto emit = [&](const lexer::TokenStream &tokens)
+        {
+            chunk.clear();
+            switch (options.mode)
+            {
+            case OutputMode::COUNTS:
+                count_lexemes(counts, g, tokens);
+                break;
+            case OutputMode::TOKENS:
+                if (!started)
+                    chunk += "# " + path + '\n';
+                write_token_lines(chunk, tokens);
+                break;
+            case OutputMode::BINARY:
+                binary_writer.write(tokens);
+                flush_binary();
+                break;
+            }
+            fwrite(chunk.data(), 1, chunk.size(), out);
+            started = true;
+        };
+
+        auto result = lexer::LexPipeline::Result();
+        try
+        {
+            result = pipeline.run(path, emit);
+        }
+        catch (const lexer::PipelineError &e)
+        {
+            fprintf(stderr, "Error: %s\n", e.what());
+            return false;
+        }
+
+        chunk.clear();
+        switch (options.mode)
+        {
+        case OutputMode::COUNTS:
+            write_counts(chunk, path, result.bytes, result.tokens, result.error);
+            break;
+        case OutputMode::TOKENS:
+            write_tokens_error(chunk, result.error);
+            break;
+        case OutputMode::BINARY:
+            binary_writer.finish(result.error);
+            flush_binary();
+            break;
+        }
+        fwrite(chunk.data(), 1, chunk.size(), out);
+
+        fprintf(stderr, "%s: %.3f s", path.c_str(), result.seconds);
+        for (const auto &stage : result.stages)
+            fprintf(stderr, ", %s %.0f%%", stage.stage, stage.utilization * 100);
+        fprintf(stderr, "\n");
+
+        return true;
     }
-    catch (const std::runtime_error &e)
+
+    int serve(const Options &options, lexer::GrammarRegistry &registry)
     {
-        printf("Failed to generate lexer: %s\n", e.what());
-        return std::nullopt;
+        // Signals are handled by a dedicated thread, which is the only one they are not blocked in.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        try
+        {
+            auto server_options = lexer::LexServer::Options();
+            server_options.socket_path = options.serve;
+            server_options.threads = options.threads;
+            server_options.max_batch = options.max_batch;
+
+            auto server = lexer::LexServer(&registry, options.grammars.front().first, options.utf8_validation, server_options);
+
+            std::thread([&server, signals] {
+                int signal;
+                sigwait(&signals, &signal);
+                server.stop();
+            }).detach();
+
+            fprintf(stderr, "Serving on %s\n", options.serve.c_str());
+            server.run();
+        }
+        catch (const lexer::SocketError &e)
+        {
+            fprintf(stderr, "Error: %s\n", e.what());
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
     }
 }
 
-int main() {
-    auto tm = TokenMapping();
+int main(int argc, char *argv[])
+{
+    auto options = parse_options(argc, argv);
+    if (!options.has_value())
+        return EXIT_FAILURE;
 
-    char lexer_src[] = "json.lex";
+    auto registry = lexer::GrammarRegistry(options->memory_budget, options->compile_options);
 
-    auto lexer = generate_lexer(tm, lexer_src);
+    if (!options->serve.empty())
+    {
+        if (!generate_lexers(options.value(), registry))
+            return EXIT_FAILURE;
+        return serve(options.value(), registry);
+    }
+
+    if (options->files.empty())
+    {
+        fprintf(stderr, "Error: No input files\n");
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    auto lexer = generate_lexers(options.value(), registry);
+    if (!lexer)
+        return EXIT_FAILURE;
+
+    const auto &g = lexer->grammar;
+    // The NFA, direct and JIT engines have no tables to interpret, nor has the host engine if the
+    // DFA fits in state vectors.
+    std::optional<lexer::LexerInterpreter> interpreter;
+    if (lexer->parallel_lexer || lexer->lazy_lexer)
+        interpreter = lexer->interpreter(options->utf8_validation);
+
+#ifdef LEXER_CUDA
+    // There is one device, so the CUDA lexer handles one file at a time and the pool only overlaps
+    // reading files and formatting output with it.
+    std::unique_ptr<CudaLexer> cuda_lexer;
+    std::mutex cuda_mutex;
+    if (options->engine == "cuda")
+        cuda_lexer = std::make_unique<CudaLexer>(lexer->parallel_lexer.value(), options->utf8_validation);
+#endif
+
+    FILE *out = stdout;
+    if (options->output != "-")
+    {
+        out = fopen(options->output.c_str(), options->mode == OutputMode::BINARY ? "wb" : "w");
+        if (!out)
+        {
+            fprintf(stderr, "Error: Failed to open output file '%s'\n", options->output.c_str());
+            return EXIT_FAILURE;
+        }
+    }
 
-    std::string input;
+    auto writer = OrderedWriter(out);
+    auto counts = std::vector<size_t>(g.lexemes.size());
+    std::mutex counts_mutex;
+    std::atomic<bool> ok = true;
 
-    if (lexer.has_value()) {
-        lexer->parallel_lexer.dump_sizes(std::cout);
+    // The calling thread takes part in the work, so it counts as one of the threads.
+    auto pool = ThreadPool(options->threads - 1);
+    // Lexes a whole input into the token stream with the selected engine.
+    auto lex_tokens = [&](std::string_view input, lexer::TokenStream &tokens) {
+        if (options->engine == "host")
+        {
+            // The phases of every file are split across the same pool, so that a few large files
+            // keep all threads busy as well. Small DFAs are lexed with state vectors instead of the merge table.
+            thread_local auto host_lexer = lexer->host_backend(options->utf8_validation, pool);
+            host_lexer->lex(input, tokens);
+        }
+#ifdef LEXER_CUDA
+        else if (cuda_lexer)
+        {
+            auto lock = std::unique_lock(cuda_mutex);
+            cuda_lexer->lex(input, tokens);
+        }
+#endif
+        else if (options->engine == "nfa")
+        {
+            lexer->nfa_lexer->lex(input, tokens, options->utf8_validation);
+        }
+        else if (options->engine == "direct")
+        {
+            lexer->direct_lexer->lex(input, g, tokens, options->utf8_validation);
+        }
+        else if (lexer->jit_lexer)
+        {
+            lexer->jit_lexer->lex(input, tokens, options->utf8_validation);
+        }
+        else
+        {
+            interpreter->lex(input, tokens);
+        }
+    };
 
-        auto cuda_lexer = new CudaLexer(lexer->parallel_lexer);
-        lexer::LexerInterpreter *interpreter = new lexer::LexerInterpreter(&lexer->parallel_lexer);
-        
-        while (true) {
-            printf("Please input your filename: ");
-            char filename[256];
-            scanf("%255s", filename);
+    auto lex_file = [&](size_t i) {
+        // Reused across the files lexed by this thread, to avoid reallocating it for every small file.
+        thread_local auto tokens = lexer::TokenStream();
+        tokens.clear();
 
-            if (auto maybe_input = read_input(filename)) {
-                input = std::move(maybe_input.value());
-                printf("--------------------------------------------------\n");
-                printf("Lexing %s (%.2fkb) using cuda and cpu\n", filename, input.length() / 1024.0);
-                printf("--------------------------------------------------\n");
+        const auto &path = options->files[i];
+        auto input = read_input(path.c_str());
+        if (!input.has_value())
+        {
+            ok = false;
+            writer.write(i, "");
+            return;
+        }
 
-                cuda_lexer->lex_cuda(input);
-                interpreter->lex_linear(input);
+        // The interpreter and NFA engines pass the tokens to the output as they are produced, the
+        // others fill the token stream first.
+        auto lex_to = [&](auto &sink) {
+            if (options->engine == "interpreter")
+                interpreter->lex(input.value(), sink);
+            else if (options->engine == "nfa")
+                lexer->nfa_lexer->lex(input.value(), sink, options->utf8_validation);
+            else
+            {
+                lex_tokens(input.value(), tokens);
+                lexer::pass_tokens(tokens, sink);
             }
+        };
+
+        auto result = std::string();
+        switch (options->mode)
+        {
+        case OutputMode::COUNTS:
+        {
+            auto sink = lexer::CountingSink(&g);
+            lex_to(sink);
+            write_counts(result, path, input->size(), sink.tokens, sink.error);
+
+            auto lock = std::unique_lock(counts_mutex);
+            for (size_t j = 0; j < counts.size(); ++j)
+                counts[j] += sink.counts[j];
+            break;
+        }
+        case OutputMode::TOKENS:
+        {
+            result += "# " + path + '\n';
+            auto sink = TokenLineSink(&result);
+            lex_to(sink);
+            write_tokens_error(result, sink.error);
+            break;
+        }
+        case OutputMode::BINARY:
+            lex_tokens(input.value(), tokens);
+            write_binary(result, path, g, tokens);
+            break;
+        }
+
+        writer.write(i, std::move(result));
+    };
+
+    // Files larger than the block size are streamed one at a time, the files between them are
+    // lexed in parallel.
+    auto streamed = std::vector<bool>(options->files.size());
+    for (size_t i = 0; i < options->files.size() && options->block_size.has_value(); ++i)
+    {
+        auto error = std::error_code();
+        auto size = std::filesystem::file_size(options->files[i], error);
+        streamed[i] = !error && size > options->block_size.value();
+    }
+
+    for (size_t i = 0; i < options->files.size();)
+    {
+        if (streamed[i])
+        {
+            if (!stream_file(options.value(), interpreter.value(), g, options->files[i], out, counts))
+                ok = false;
+            writer.write(i, "");
+            ++i;
+            continue;
         }
+
+        auto end = i + 1;
+        while (end < options->files.size() && !streamed[end])
+            ++end;
+        pool.parallel_for(end - i, [&, begin = i](size_t k) { lex_file(begin + k); });
+        i = end;
     }
-}
\ No newline at end of file
+
+    if (options->mode == OutputMode::COUNTS)
+    {
+        fprintf(out, "lexeme\t\tcount\n");
+        for (size_t i = 0; i < counts.size(); ++i)
+            fprintf(out, "%-20s\t%5zu\n", g.lexemes[i].name.c_str(), counts[i]);
+    }
+
+    if (out != stdout)
+        fclose(out);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
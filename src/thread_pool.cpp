@@ -0,0 +1,211 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+    // The pool the current thread is a worker of, and its index in that pool.
+    thread_local const ThreadPool *current_pool = nullptr;
+    thread_local size_t current_index = 0;
+}
+
+ThreadPool::ThreadPool(size_t num_threads) : pending(0), next_queue(0), stopping(false)
+{
+    for (size_t i = 0; i < num_threads; ++i)
+        this->queues.push_back(std::make_unique<Queue>());
+
+    for (size_t i = 0; i < num_threads; ++i)
+        this->workers.emplace_back([this, i]
+                                   { this->worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        auto lock = std::unique_lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+
+    for (auto &worker : this->workers)
+        worker.join();
+}
+
+size_t ThreadPool::size() const
+{
+    return this->workers.size();
+}
+
+size_t ThreadPool::chunk_count(size_t n, size_t min_chunk_size) const
+{
+    size_t max_chunks = (n + min_chunk_size - 1) / min_chunk_size;
+    size_t wanted = (this->size() + 1) * 4;
+    return std::max(size_t{1}, std::min(max_chunks, wanted));
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+    current_pool = this;
+    current_index = index;
+
+    while (true)
+    {
+        std::function<void()> task;
+        if (this->try_pop(index, task))
+        {
+            task();
+            continue;
+        }
+
+        // Queued tasks are counted before they are pushed, so a worker may wake up shortly before
+        // the task is visible and has to retry; it never sleeps while one is queued.
+        auto lock = std::unique_lock(this->mutex);
+        this->cv.wait(lock, [this]
+                      { return this->stopping || this->pending.load() > 0; });
+        if (this->stopping && this->pending.load() == 0)
+            return;
+    }
+}
+
+bool ThreadPool::try_pop(size_t index, std::function<void()> &task)
+{
+    // Own queue from the back, which holds the most recently spawned and so cache-warm work.
+    {
+        auto &own = *this->queues[index];
+        auto lock = std::unique_lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --this->pending;
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another queue.
+    for (size_t i = 1; i < this->queues.size(); ++i)
+    {
+        auto &victim = *this->queues[(index + i) % this->queues.size()];
+        auto lock = std::unique_lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --this->pending;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    size_t index = current_pool == this
+                       ? current_index
+                       : this->next_queue.fetch_add(1) % this->queues.size();
+
+    ++this->pending;
+    {
+        auto &queue = *this->queues[index];
+        auto lock = std::unique_lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    // Taking the lock orders this notification after a worker has either seen the pending
+    // task or started waiting, so it cannot be lost.
+    {
+        auto lock = std::unique_lock(this->mutex);
+    }
+    this->cv.notify_one();
+}
+
+void ThreadPool::run_batch(size_t n, const std::function<void(size_t)> &f)
+{
+    if (n == 0)
+        return;
+
+    if (n == 1 || this->workers.empty())
+    {
+        for (size_t i = 0; i < n; ++i)
+            f(i);
+        return;
+    }
+
+    // Helpers may only get to run after the batch has completed, so everything they touch
+    // is kept alive by the shared state rather than the stack frame of this call.
+    struct Batch
+    {
+        const std::function<void(size_t)> *f;
+        size_t n;
+        std::atomic<size_t> next;
+        std::atomic<size_t> done;
+        std::mutex mutex;
+        std::condition_variable cv;
+        // The first exception thrown by f, guarded by mutex.
+        std::exception_ptr error;
+
+        // Returns true when this call finished the last item. After an exception the items which
+        // have not been started are skipped, and count as finished by the thread that threw.
+        bool work()
+        {
+            size_t finished = 0;
+            for (size_t i; (i = this->next.fetch_add(1)) < this->n;)
+            {
+                ++finished;
+                try
+                {
+                    (*this->f)(i);
+                }
+                catch (...)
+                {
+                    {
+                        auto lock = std::unique_lock(this->mutex);
+                        if (!this->error)
+                            this->error = std::current_exception();
+                    }
+
+                    size_t skipped = this->next.exchange(this->n);
+                    if (skipped < this->n)
+                        finished += this->n - skipped;
+                    break;
+                }
+            }
+            return finished > 0 && this->done.fetch_add(finished) + finished == this->n;
+        }
+    };
+
+    auto batch = std::make_shared<Batch>();
+    batch->f = &f;
+    batch->n = n;
+    batch->next = 0;
+    batch->done = 0;
+
+    size_t helpers = std::min(this->workers.size(), n - 1);
+    for (size_t i = 0; i < helpers; ++i)
+    {
+        this->submit([batch]
+                     {
+            if (batch->work()) {
+                auto lock = std::unique_lock(batch->mutex);
+                batch->cv.notify_all();
+            } });
+    }
+
+    batch->work();
+
+    auto lock = std::unique_lock(batch->mutex);
+    batch->cv.wait(lock, [&]
+                   { return batch->done.load() == n; });
+
+    if (batch->error)
+        std::rethrow_exception(batch->error);
+}
+
+ThreadPool &ThreadPool::global()
+{
+    // The calling thread also participates, so one less worker than there are hardware threads.
+    static auto pool = ThreadPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
@@ -0,0 +1,266 @@
+#include "utf8.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_HAVE_SSSE3
+#endif
+
+namespace
+{
+    bool is_continuation(uint8_t c)
+    {
+        return (c & 0xC0) == 0x80;
+    }
+
+    // Length of the well-formed multi-byte sequence starting at p, or 0 if it is ill-formed.
+    size_t sequence_length(const uint8_t *p, const uint8_t *end)
+    {
+        auto available = end - p;
+        auto lead = p[0];
+
+        // Allowed range of the second byte depends on the lead byte, to exclude overlong
+        // encodings, surrogates and values above U+10FFFF.
+        size_t length;
+        uint8_t min = 0x80, max = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length = 3;
+            if (lead == 0xE0)
+                min = 0xA0;
+            else if (lead == 0xED)
+                max = 0x9F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length = 4;
+            if (lead == 0xF0)
+                min = 0x90;
+            else if (lead == 0xF4)
+                max = 0x8F;
+        }
+        else
+            return 0;
+
+        if (available < static_cast<ptrdiff_t>(length) || p[1] < min || p[1] > max)
+            return 0;
+
+        for (size_t i = 2; i < length; ++i)
+        {
+            if (!is_continuation(p[i]))
+                return 0;
+        }
+
+        return length;
+    }
+
+    // Finds the start of the sequence containing offset, assuming that the input before it is valid.
+    // If offset is preceded by more continuation bytes than any sequence can have, offset itself is
+    // an error and is returned.
+    size_t sequence_start(const uint8_t *data, size_t offset)
+    {
+        for (size_t back = 0; back <= 3 && back <= offset; ++back)
+        {
+            if (!is_continuation(data[offset - back]))
+                return offset - back;
+        }
+        return offset;
+    }
+
+    std::optional<size_t> find_error_scalar(const uint8_t *data, size_t size, size_t begin, size_t end)
+    {
+        auto p = data + sequence_start(data, begin);
+        auto input_end = data + size;
+        auto range_end = data + end;
+
+        while (p < range_end)
+        {
+            if (*p < 0x80)
+            {
+                ++p;
+                continue;
+            }
+
+            auto length = sequence_length(p, input_end);
+            if (length == 0)
+                return p - data;
+            p += length;
+        }
+
+        return std::nullopt;
+    }
+
+#ifdef UTF8_HAVE_SSSE3
+    // Vectorized validation after Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+    // Every byte is classified by three table lookups on the high and low nibble of the previous byte
+    // and the high nibble of the current byte. The AND of those lookups is nonzero exactly for the
+    // two-byte combinations which are ill-formed; the remaining errors are missing or superfluous
+    // continuation bytes, which are found by comparing against the lead bytes 2 and 3 positions back.
+    constexpr const uint8_t TOO_SHORT = 1 << 0;
+    constexpr const uint8_t TOO_LONG = 1 << 1;
+    constexpr const uint8_t OVERLONG_3 = 1 << 2;
+    constexpr const uint8_t TOO_LARGE = 1 << 3;
+    constexpr const uint8_t SURROGATE = 1 << 4;
+    constexpr const uint8_t OVERLONG_2 = 1 << 5;
+    constexpr const uint8_t TOO_LARGE_1000 = 1 << 6;
+    constexpr const uint8_t OVERLONG_4 = 1 << 6;
+    constexpr const uint8_t TWO_CONTS = 1 << 7;
+    constexpr const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    __attribute__((target("ssse3"))) __m128i high_nibbles(__m128i v)
+    {
+        return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    }
+
+    __attribute__((target("ssse3"))) __m128i check_special_cases(__m128i input, __m128i prev1)
+    {
+        const auto byte_1_high_table = _mm_setr_epi8(
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2,
+            TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+
+        const auto byte_1_low_table = _mm_setr_epi8(
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            CARRY | OVERLONG_2,
+            CARRY,
+            CARRY,
+            CARRY | TOO_LARGE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000);
+
+        const auto byte_2_high_table = _mm_setr_epi8(
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+        auto byte_1_high = _mm_shuffle_epi8(byte_1_high_table, high_nibbles(prev1));
+        auto byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+        auto byte_2_high = _mm_shuffle_epi8(byte_2_high_table, high_nibbles(input));
+        return _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+    }
+
+    __attribute__((target("ssse3"))) __m128i check_block(__m128i input, __m128i prev_input)
+    {
+        auto prev1 = _mm_alignr_epi8(input, prev_input, 16 - 1);
+        auto prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+        auto prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+
+        auto special_cases = check_special_cases(input, prev1);
+
+        // Only 111_____ two back or 1111____ three back end up with the high bit set.
+        auto is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        auto is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        auto must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte), _mm_set1_epi8(static_cast<char>(0x80)));
+        return _mm_xor_si128(must_be_continuation, special_cases);
+    }
+
+    // Nonzero if the block ends in the middle of a multi-byte sequence.
+    __attribute__((target("ssse3"))) __m128i is_incomplete(__m128i input)
+    {
+        const auto max_value = _mm_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+        return _mm_subs_epu8(input, max_value);
+    }
+
+    __attribute__((target("ssse3"))) __m128i load_partial(const uint8_t *p, size_t n)
+    {
+        alignas(16) uint8_t buffer[16] = {};
+        std::memcpy(buffer, p, n);
+        return _mm_load_si128(reinterpret_cast<const __m128i *>(buffer));
+    }
+
+    __attribute__((target("ssse3"))) std::optional<size_t> find_error_ssse3(const uint8_t *data, size_t size, size_t begin, size_t end)
+    {
+        // Context for the first block. Zero bytes are ASCII, so they are neutral at the start of the input.
+        __m128i prev_input;
+        if (begin >= 16)
+        {
+            prev_input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + begin - 16));
+        }
+        else
+        {
+            alignas(16) uint8_t buffer[16] = {};
+            std::memcpy(buffer + 16 - begin, data, begin);
+            prev_input = _mm_load_si128(reinterpret_cast<const __m128i *>(buffer));
+        }
+        auto prev_incomplete = is_incomplete(prev_input);
+
+        for (size_t offset = begin; offset < end; offset += 16)
+        {
+            // The final block is padded with zeros, which flags any sequence cut off by the end of the input.
+            auto input = end - offset >= 16
+                             ? _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset))
+                             : load_partial(data + offset, end - offset);
+
+            __m128i error;
+            if (_mm_movemask_epi8(input) == 0)
+            {
+                error = prev_incomplete;
+                prev_incomplete = _mm_setzero_si128();
+            }
+            else
+            {
+                error = check_block(input, prev_input);
+                prev_incomplete = is_incomplete(input);
+            }
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF)
+            {
+                // The error lies in this block or is a sequence started in the previous one. Everything
+                // before that was fine, so the exact offset is found by a short scalar scan from there.
+                auto rescan = offset >= 16 ? offset - 16 : 0;
+                return find_error_scalar(data, size, rescan, size);
+            }
+
+            prev_input = input;
+        }
+
+        if (end == size && _mm_movemask_epi8(_mm_cmpeq_epi8(prev_incomplete, _mm_setzero_si128())) != 0xFFFF)
+            return find_error_scalar(data, size, end >= 16 ? end - 16 : 0, size);
+
+        return std::nullopt;
+    }
+#endif
+
+    using FindErrorFn = std::optional<size_t> (*)(const uint8_t *, size_t, size_t, size_t);
+
+    FindErrorFn select_implementation()
+    {
+#ifdef UTF8_HAVE_SSSE3
+        if (__builtin_cpu_supports("ssse3"))
+            return find_error_ssse3;
+#endif
+        return find_error_scalar;
+    }
+}
+
+std::optional<size_t> validate_utf8(std::string_view text)
+{
+    return find_utf8_error(text, 0, text.size());
+}
+
+std::optional<size_t> find_utf8_error(std::string_view input, size_t begin, size_t end)
+{
+    static const auto implementation = select_implementation();
+    return implementation(reinterpret_cast<const uint8_t *>(input.data()), input.size(), begin, end);
+}
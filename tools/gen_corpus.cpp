@@ -0,0 +1,571 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <deque>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+
+#include "parser.hpp"
+#include "lexer/lexer_parser.hpp"
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/fsa.hpp"
+
+// Generates synthetic input for a grammar by a random walk over its lexer DFA, so that inputs
+// of any size can be produced for scaling benchmarks. Every token is generated by picking a
+// target lexeme by weight and walking towards an accepting state of it; the transitions which
+// end a token are the ones of the lexer loop, so the output lexes back without errors unless
+// invalid bytes are injected. The output only depends on the grammar, the options and the seed.
+//
+// Usage: gen_corpus [-g grammar.lex] [-n size] [-o output] [-s seed] [-l mean_token_length]
+//                   [--mix <lexeme>-heavy] [-w lexeme=weight]... [--invalid rate] [--bytes]
+//
+// Sizes take a K, M or G suffix. --invalid is the probability per token of injecting a byte
+// which is neither valid UTF-8 nor part of any token in ordinary grammars, after which the
+// walk restarts from the start state. By default only printable ASCII and whitespace are
+// generated where the grammar allows it; --bytes allows every byte.
+
+namespace
+{
+    using FSA = lexer::FiniteStateAutomaton;
+    using StateIndex = FSA::StateIndex;
+
+    constexpr const uint32_t UNREACHABLE = std::numeric_limits<uint32_t>::max();
+    constexpr const size_t BUFFER_SIZE = 1 << 20;
+    constexpr const uint8_t INVALID_BYTE = 0xFF;
+    constexpr const double HEAVY_WEIGHT = 8;
+
+    struct Options
+    {
+        std::string grammar = "json.lex";
+        size_t size = 1 << 20;
+        std::string output = "-";
+        uint64_t seed = 0;
+        double mean_length = 8;
+        double invalid_rate = 0;
+        bool any_bytes = false;
+        std::vector<std::pair<std::string, double>> weights;
+    };
+
+    // SplitMix64, used instead of the standard distributions whose output differs between
+    // standard library implementations.
+    class Random
+    {
+        uint64_t state;
+
+    public:
+        Random(uint64_t seed) : state(seed) {}
+
+        uint64_t next()
+        {
+            uint64_t z = (this->state += 0x9E3779B97F4A7C15);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            return z ^ (z >> 31);
+        }
+
+        size_t below(size_t n)
+        {
+            return static_cast<size_t>((static_cast<unsigned __int128>(this->next()) * n) >> 64);
+        }
+
+        double unit()
+        {
+            return (this->next() >> 11) * 0x1.0p-53;
+        }
+
+        bool chance(double p)
+        {
+            return this->unit() < p;
+        }
+    };
+
+    struct Move
+    {
+        uint16_t sym;
+        StateIndex dst;
+    };
+
+    using Moves = std::vector<Move>;
+
+    // Symbols which continue the current token towards some lexeme.
+    struct Choices
+    {
+        Moves any;
+        // Only those on a shortest path to an accepting state.
+        Moves shortest;
+    };
+
+    // Lexemes which can follow an accepting state, and the symbols which start each of them.
+    struct Ending
+    {
+        std::vector<size_t> lexemes;
+        std::vector<double> cumulative_weights;
+        double total_weight = 0;
+        std::vector<Moves> moves;
+    };
+
+    class Generator
+    {
+        const lexer::LexicalGrammar *g;
+        const FSA &dfa;
+        const Options &options;
+        std::vector<double> weights;
+        Random random;
+
+        // dist[l][s] is the number of symbols on the shortest path from state s to an accepting
+        // state of lexeme l, without ending the token on the way.
+        std::vector<std::vector<uint32_t>> dist;
+
+        // The candidate moves are only computed for the states and lexemes the walk visits.
+        std::vector<std::optional<Choices>> continue_cache;
+        std::vector<std::optional<Ending>> end_cache;
+
+        FILE *out;
+        std::string buffer;
+        size_t written = 0;
+
+    public:
+        std::vector<size_t> token_counts;
+        size_t invalid_bytes = 0;
+
+        Generator(const lexer::LexicalGrammar *g, const FSA &dfa, const Options &options, std::vector<double> weights, FILE *out) :
+            g(g), dfa(dfa), options(options), weights(std::move(weights)), random(options.seed),
+            continue_cache(dfa.num_states() * g->lexemes.size()), end_cache(dfa.num_states()), out(out), token_counts(g->lexemes.size(), 0)
+        {
+            this->compute_distances();
+        }
+
+        void generate()
+        {
+            auto state = FSA::START;
+            auto target = this->pick_target(state);
+            bool finishing = false;
+
+            while (true)
+            {
+                if (!target.has_value())
+                {
+                    // Nothing can be lexed from here, which only happens for grammars that cannot lex
+                    // anything at all.
+                    fprintf(stderr, "Error: The grammar does not accept any input\n");
+                    return;
+                }
+
+                auto l = target.value();
+                bool at_end = this->written + this->buffer.size() >= this->options.size;
+                finishing |= at_end || this->random.chance(1.0 / this->options.mean_length);
+
+                if (finishing && this->dfa.lexemes[state] && this->dist[l][state] == 0)
+                {
+                    this->token_counts[this->g->lexeme_id(this->dfa.lexemes[state])]++;
+                    if (at_end)
+                        break;
+
+                    if (this->random.chance(this->options.invalid_rate))
+                    {
+                        this->emit(INVALID_BYTE);
+                        ++this->invalid_bytes;
+                        state = FSA::START;
+                        target = this->pick_target(state);
+                        finishing = false;
+                        continue;
+                    }
+
+                    auto next = this->end_token(state);
+                    if (!next.has_value())
+                    {
+                        fprintf(stderr, "Error: No lexeme can follow '%s'\n", this->dfa.lexemes[state]->name.c_str());
+                        break;
+                    }
+
+                    state = next->first;
+                    target = next->second;
+                    finishing = false;
+                    continue;
+                }
+
+                auto next = this->continue_token(state, l, finishing);
+                if (!next.has_value())
+                {
+                    // The target cannot be reached from here anymore, pick another one.
+                    target = this->pick_target(state);
+                    finishing = true;
+                    continue;
+                }
+
+                state = next.value();
+            }
+
+            this->flush();
+        }
+
+    private:
+        void compute_distances()
+        {
+            auto predecessors = std::vector<std::vector<StateIndex>>(this->dfa.num_states());
+            for (size_t src = 0; src < this->dfa.num_states(); ++src)
+            {
+                for (const auto &t : this->dfa.transitions(src))
+                {
+                    if (!t.produces_lexeme)
+                        predecessors[t.dst].push_back(src);
+                }
+            }
+
+            this->dist.resize(this->g->lexemes.size());
+            for (size_t l = 0; l < this->g->lexemes.size(); ++l)
+            {
+                auto &dist = this->dist[l];
+                dist.assign(this->dfa.num_states(), UNREACHABLE);
+
+                auto queue = std::deque<StateIndex>();
+                for (size_t s = 0; s < this->dfa.num_states(); ++s)
+                {
+                    if (this->dfa.lexemes[s] == &this->g->lexemes[l])
+                    {
+                        dist[s] = 0;
+                        queue.push_back(s);
+                    }
+                }
+
+                while (!queue.empty())
+                {
+                    auto s = queue.front();
+                    queue.pop_front();
+                    for (auto pred : predecessors[s])
+                    {
+                        if (dist[pred] == UNREACHABLE)
+                        {
+                            dist[pred] = dist[s] + 1;
+                            queue.push_back(pred);
+                        }
+                    }
+                }
+            }
+        }
+
+        bool preferred(uint16_t sym) const
+        {
+            return this->options.any_bytes || (sym >= 0x20 && sym < 0x7F) || sym == '\t' || sym == '\n' || sym == '\r';
+        }
+
+        // Keeps only the moves on preferred symbols, unless there are none.
+        Moves filter_preferred(Moves &&moves) const
+        {
+            auto filtered = Moves();
+            for (const auto &move : moves)
+            {
+                if (this->preferred(move.sym))
+                    filtered.push_back(move);
+            }
+            return filtered.empty() ? std::move(moves) : filtered;
+        }
+
+        std::optional<size_t> pick_lexeme(const std::vector<bool> &reachable)
+        {
+            double total = 0;
+            for (size_t l = 0; l < reachable.size(); ++l)
+                total += reachable[l] ? this->weights[l] : 0;
+
+            if (total <= 0)
+                return std::nullopt;
+
+            auto x = this->random.unit() * total;
+            std::optional<size_t> last;
+            for (size_t l = 0; l < reachable.size(); ++l)
+            {
+                if (!reachable[l] || this->weights[l] <= 0)
+                    continue;
+                last = l;
+                x -= this->weights[l];
+                if (x < 0)
+                    break;
+            }
+            return last;
+        }
+
+        std::optional<size_t> pick_target(StateIndex state)
+        {
+            auto reachable = std::vector<bool>(this->g->lexemes.size());
+            for (size_t l = 0; l < reachable.size(); ++l)
+                reachable[l] = this->dist[l][state] != UNREACHABLE;
+            return this->pick_lexeme(reachable);
+        }
+
+        const Choices &continue_choices(StateIndex state, size_t l)
+        {
+            auto &cached = this->continue_cache[state * this->g->lexemes.size() + l];
+            if (cached.has_value())
+                return cached.value();
+
+            auto any = Moves();
+            auto shortest = Moves();
+            auto best = UNREACHABLE;
+            for (const auto &t : this->dfa.transitions(state))
+            {
+                auto d = this->dist[l][t.dst];
+                if (t.produces_lexeme || d == UNREACHABLE)
+                    continue;
+
+                any.push_back({t.sym, t.dst});
+                if (d < best)
+                {
+                    best = d;
+                    shortest.clear();
+                }
+                if (d == best)
+                    shortest.push_back({t.sym, t.dst});
+            }
+
+            cached = Choices{this->filter_preferred(std::move(any)), this->filter_preferred(std::move(shortest))};
+            return cached.value();
+        }
+
+        const Ending &ending(StateIndex state)
+        {
+            auto &cached = this->end_cache[state];
+            if (cached.has_value())
+                return cached.value();
+
+            auto reachable = std::vector<bool>(this->g->lexemes.size(), false);
+            for (const auto &t : this->dfa.transitions(state))
+            {
+                if (!t.produces_lexeme || t.dst == FSA::REJECT)
+                    continue;
+
+                for (size_t l = 0; l < reachable.size(); ++l)
+                    reachable[l] = reachable[l] || this->dist[l][t.dst] != UNREACHABLE;
+            }
+
+            auto result = Ending();
+            result.moves.resize(this->g->lexemes.size());
+            for (size_t l = 0; l < reachable.size(); ++l)
+            {
+                if (!reachable[l] || this->weights[l] <= 0)
+                    continue;
+
+                for (const auto &t : this->dfa.transitions(state))
+                {
+                    if (t.produces_lexeme && t.dst != FSA::REJECT && this->dist[l][t.dst] != UNREACHABLE)
+                        result.moves[l].push_back({t.sym, t.dst});
+                }
+                result.moves[l] = this->filter_preferred(std::move(result.moves[l]));
+
+                result.total_weight += this->weights[l];
+                result.lexemes.push_back(l);
+                result.cumulative_weights.push_back(result.total_weight);
+            }
+
+            cached = std::move(result);
+            return cached.value();
+        }
+
+        // Takes one symbol towards an accepting state of l without ending the token. When finishing,
+        // only symbols on a shortest path are taken.
+        std::optional<StateIndex> continue_token(StateIndex state, size_t l, bool finishing)
+        {
+            const auto &choices = this->continue_choices(state, l);
+            const auto &moves = finishing ? choices.shortest : choices.any;
+            if (moves.empty())
+                return std::nullopt;
+
+            const auto &move = moves[this->random.below(moves.size())];
+            this->emit(move.sym);
+            return move.dst;
+        }
+
+        // Ends the token in accepting state `state` by taking a transition of the lexer loop, which
+        // is the first symbol of the next token. Returns the new state and the next target.
+        std::optional<std::pair<StateIndex, size_t>> end_token(StateIndex state)
+        {
+            const auto &ending = this->ending(state);
+            if (ending.lexemes.empty())
+                return std::nullopt;
+
+            auto x = this->random.unit() * ending.total_weight;
+            auto i = std::upper_bound(ending.cumulative_weights.begin(), ending.cumulative_weights.end(), x) - ending.cumulative_weights.begin();
+            auto l = ending.lexemes[std::min<size_t>(i, ending.lexemes.size() - 1)];
+
+            const auto &moves = ending.moves[l];
+            const auto &move = moves[this->random.below(moves.size())];
+            this->emit(move.sym);
+            return std::make_pair(move.dst, l);
+        }
+
+        void emit(uint16_t sym)
+        {
+            this->buffer.push_back(static_cast<char>(sym));
+            if (this->buffer.size() >= BUFFER_SIZE)
+                this->flush();
+        }
+
+        void flush()
+        {
+            fwrite(this->buffer.data(), 1, this->buffer.size(), this->out);
+            this->written += this->buffer.size();
+            this->buffer.clear();
+        }
+    };
+
+    std::optional<std::string> read_input(const char *filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+            return std::nullopt;
+        }
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::optional<size_t> parse_size(std::string_view arg)
+    {
+        char *end;
+        auto value = std::strtod(std::string(arg).c_str(), &end);
+        auto suffix = std::string_view(end);
+
+        if (suffix == "K" || suffix == "k")
+            value *= 1024.0;
+        else if (suffix == "M" || suffix == "m")
+            value *= 1024.0 * 1024.0;
+        else if (suffix == "G" || suffix == "g")
+            value *= 1024.0 * 1024.0 * 1024.0;
+        else if (!suffix.empty())
+            return std::nullopt;
+
+        if (value < 0)
+            return std::nullopt;
+        return static_cast<size_t>(value);
+    }
+
+    std::optional<Options> parse_options(int argc, char *argv[])
+    {
+        auto options = Options();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto arg = std::string_view(argv[i]);
+            bool has_value = i + 1 < argc;
+
+            if (arg == "-g" && has_value)
+                options.grammar = argv[++i];
+            else if (arg == "-n" && has_value)
+            {
+                auto size = parse_size(argv[++i]);
+                if (!size.has_value())
+                {
+                    fprintf(stderr, "Error: Invalid size '%s'\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.size = size.value();
+            }
+            else if (arg == "-o" && has_value)
+                options.output = argv[++i];
+            else if (arg == "-s" && has_value)
+                options.seed = std::strtoull(argv[++i], nullptr, 10);
+            else if (arg == "-l" && has_value)
+                options.mean_length = std::max(1.0, std::strtod(argv[++i], nullptr));
+            else if (arg == "--invalid" && has_value)
+                options.invalid_rate = std::strtod(argv[++i], nullptr);
+            else if (arg == "--bytes")
+                options.any_bytes = true;
+            else if (arg == "--mix" && has_value)
+            {
+                auto mix = std::string_view(argv[++i]);
+                auto suffix = std::string_view("-heavy");
+                if (mix.size() <= suffix.size() || mix.substr(mix.size() - suffix.size()) != suffix)
+                {
+                    fprintf(stderr, "Error: Invalid mix '%s', expected <lexeme>-heavy\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.weights.push_back({std::string(mix.substr(0, mix.size() - suffix.size())), HEAVY_WEIGHT});
+            }
+            else if (arg == "-w" && has_value)
+            {
+                auto weight = std::string_view(argv[++i]);
+                auto eq = weight.find('=');
+                if (eq == std::string_view::npos)
+                {
+                    fprintf(stderr, "Error: Invalid weight '%s', expected <lexeme>=<weight>\n", argv[i]);
+                    return std::nullopt;
+                }
+                options.weights.push_back({std::string(weight.substr(0, eq)), std::strtod(argv[i] + eq + 1, nullptr)});
+            }
+            else
+            {
+                fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+                return std::nullopt;
+            }
+        }
+
+        return options;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = parse_options(argc, argv);
+    if (!options.has_value())
+        return EXIT_FAILURE;
+
+    auto grammar_src = read_input(options->grammar.c_str());
+    if (!grammar_src.has_value())
+        return EXIT_FAILURE;
+
+    lexer::LexicalGrammar g;
+    FSA dfa;
+    auto weights = std::vector<double>();
+    try
+    {
+        auto parser = Parser(grammar_src.value());
+        g = lexer::LexerParser(&parser).parse();
+        g.validate();
+        dfa = FSA::build_lexer_dfa(&g);
+
+        weights.assign(g.lexemes.size(), 1.0);
+        for (const auto &[name, weight] : options->weights)
+        {
+            const auto *lexeme = g.find_lexeme(name);
+            if (!lexeme)
+                throw lexer::UnknownLexemeError(name);
+            weights[g.lexeme_id(lexeme)] = weight;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "Failed to generate lexer: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = stdout;
+    if (options->output != "-")
+    {
+        out = fopen(options->output.c_str(), "wb");
+        if (!out)
+        {
+            fprintf(stderr, "Error: Failed to open output file '%s'\n", options->output.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto generator = Generator(&g, dfa, options.value(), std::move(weights), out);
+    generator.generate();
+
+    if (out != stdout)
+        fclose(out);
+
+    fprintf(stderr, "lexeme\t\tcount\n");
+    for (size_t l = 0; l < g.lexemes.size(); ++l)
+        fprintf(stderr, "%-20s\t%5zu\n", g.lexemes[l].name.c_str(), generator.token_counts[l]);
+    fprintf(stderr, "%-20s\t%5zu\n", "(invalid bytes)", generator.invalid_bytes);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+
+#include "parser.hpp"
+#include "lexer/lexer_parser.hpp"
+#include "lexer/lexical_grammar.hpp"
+#include "lexer/grammar_registry.hpp"
+#include "lexer/direct_lexer.hpp"
+
+// Generates the C++ source of a direct-coded lexer for a grammar, see lexer/direct_lexer.hpp. The
+// build runs it for the grammars in DIRECT_GRAMMARS and links the results into cuda_lexer and the
+// benchmarks, which use them for the grammars with the same source. The lexer is named after the
+// grammar file without the extension unless -n is given.
+//
+// Usage: gen_direct_lexer [-n name] grammar.lex output.cpp
+
+namespace
+{
+    std::string stem(std::string_view path)
+    {
+        if (auto slash = path.rfind('/'); slash != std::string_view::npos)
+            path.remove_prefix(slash + 1);
+        if (auto dot = path.rfind('.'); dot != std::string_view::npos && dot > 0)
+            path = path.substr(0, dot);
+        return std::string(path);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string name;
+    std::string grammar_path;
+    std::string output_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string_view(argv[i]);
+        if (arg == "-n" && i + 1 < argc)
+            name = argv[++i];
+        else if (arg.size() > 0 && arg[0] == '-')
+        {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        else if (grammar_path.empty())
+            grammar_path = argv[i];
+        else
+            output_path = argv[i];
+    }
+
+    if (grammar_path.empty() || output_path.empty())
+    {
+        fprintf(stderr, "Usage: gen_direct_lexer [-n name] grammar.lex output.cpp\n");
+        return EXIT_FAILURE;
+    }
+
+    if (name.empty())
+        name = stem(grammar_path);
+
+    auto in = std::ifstream(grammar_path, std::ios::binary);
+    if (!in)
+    {
+        fprintf(stderr, "Error: Failed to open grammar file '%s'\n", grammar_path.c_str());
+        return EXIT_FAILURE;
+    }
+    auto source = std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+    try
+    {
+        auto parser = Parser(source);
+        auto g = lexer::LexerParser(&parser).parse();
+        g.validate();
+
+        // Written to a temporary file first, so that a failed run leaves no output for make to trust.
+        auto temporary_path = output_path + ".tmp";
+        auto out = std::ofstream(temporary_path);
+        lexer::generate_direct_lexer(out, &g, lexer::content_hash(source), name);
+        out.close();
+        if (!out || std::rename(temporary_path.c_str(), output_path.c_str()) != 0)
+        {
+            fprintf(stderr, "Error: Failed to write '%s'\n", output_path.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "Failed to generate lexer: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
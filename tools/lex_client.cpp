@@ -0,0 +1,196 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <iterator>
+#include <optional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "lexer/server.hpp"
+
+// Client for a lexer started with `cuda_lexer --serve`. Sends every file as a request, keeping up
+// to `depth` requests in flight on the connection, and prints the path, size and token count of
+// every file and the first error if there is one, in the same format as `cuda_lexer -m counts`.
+// Responses are read on a thread of their own while requests are still being written, see the
+// protocol in lexer/server.hpp.
+// With -g the files are lexed with the named grammar instead of the default grammar of the server.
+//
+// Usage: lex_client -s socket [-g grammar] [-d depth] file...
+
+namespace
+{
+    struct Options
+    {
+        std::string socket;
+        std::string grammar;
+        size_t depth = 16;
+        std::vector<std::string> files;
+    };
+
+    std::optional<std::string> read_input(const char *filename)
+    {
+        auto in = std::ifstream(filename, std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+            return std::nullopt;
+        }
+
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::optional<Options> parse_options(int argc, char *argv[])
+    {
+        auto options = Options();
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto arg = std::string_view(argv[i]);
+            bool has_value = i + 1 < argc;
+
+            if (arg == "-s" && has_value)
+                options.socket = argv[++i];
+            else if (arg == "-g" && has_value)
+                options.grammar = argv[++i];
+            else if (arg == "-d" && has_value)
+                options.depth = std::max(1UL, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg.size() > 0 && arg[0] == '-')
+            {
+                fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+                return std::nullopt;
+            }
+            else
+                options.files.push_back(argv[i]);
+        }
+
+        if (options.socket.empty())
+        {
+            fprintf(stderr, "Usage: lex_client -s socket [-g grammar] [-d depth] file...\n");
+            return std::nullopt;
+        }
+
+        return options;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    auto options = parse_options(argc, argv);
+    if (!options.has_value())
+        return EXIT_FAILURE;
+
+    try
+    {
+        auto client = lexer::LexClient(options->socket);
+
+        // Path and size of every request in flight, and whether all requests have been sent.
+        auto in_flight = std::deque<std::pair<std::string, size_t>>();
+        bool sent_all = false;
+        std::exception_ptr receive_error;
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        auto receiver = std::thread([&]
+                                    {
+            while (true)
+            {
+                std::pair<std::string, size_t> request;
+                {
+                    auto lock = std::unique_lock(mutex);
+                    cv.wait(lock, [&]
+                            { return sent_all || !in_flight.empty(); });
+                    if (in_flight.empty())
+                        return;
+                    request = in_flight.front();
+                }
+
+                lexer::LexClient::Response response;
+                try
+                {
+                    response = client.receive();
+                }
+                catch (const lexer::SocketError &)
+                {
+                    auto lock = std::unique_lock(mutex);
+                    receive_error = std::current_exception();
+                    in_flight.clear();
+                    cv.notify_all();
+                    return;
+                }
+
+                printf("%s\t%zu\t%zu", request.first.c_str(), request.second, response.lexeme_ids.size());
+                if (response.error.has_value())
+                {
+                    const char *type = response.error->type == lexer::LexError::Type::INVALID_UTF8 ? "invalid_utf8" : "rejected";
+                    printf("\t%s@%zu", type, response.error->offset);
+                }
+                printf("\n");
+
+                {
+                    auto lock = std::unique_lock(mutex);
+                    in_flight.pop_front();
+                }
+                cv.notify_all();
+            } });
+
+        bool ok = true;
+        std::exception_ptr send_error;
+        try
+        {
+            for (const auto &path : options->files)
+            {
+                auto input = read_input(path.c_str());
+                if (!input.has_value())
+                {
+                    ok = false;
+                    continue;
+                }
+
+                {
+                    auto lock = std::unique_lock(mutex);
+                    cv.wait(lock, [&]
+                            { return receive_error || in_flight.size() < options->depth; });
+                    if (receive_error)
+                        break;
+                    // Queued before sending, so that the receiver expects the response in time.
+                    in_flight.emplace_back(path, input->size());
+                }
+                cv.notify_all();
+
+                client.send(input.value(), options->grammar);
+            }
+        }
+        catch (const lexer::SocketError &)
+        {
+            // The receiver usually fails on the same connection too, and its error is the one the
+            // server caused.
+            send_error = std::current_exception();
+        }
+
+        {
+            auto lock = std::unique_lock(mutex);
+            sent_all = true;
+        }
+        cv.notify_all();
+        receiver.join();
+
+        if (receive_error)
+            std::rethrow_exception(receive_error);
+        if (send_error)
+            std::rethrow_exception(send_error);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    catch (const lexer::SocketError &e)
+    {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
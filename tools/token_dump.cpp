@@ -0,0 +1,101 @@
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include "lexer/token_file.hpp"
+
+// Prints the token streams in a file written by `cuda_lexer -m binary` or lexer::TokenStreamWriter,
+// in the same format as `cuda_lexer -m tokens`. With -c only the source, token count, block count
+// and first error of every stream are printed.
+//
+// Usage: token_dump [-c] file
+
+namespace
+{
+    const char *error_name(lexer::LexError::Type type)
+    {
+        return type == lexer::LexError::Type::INVALID_UTF8 ? "invalid_utf8" : "rejected";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool counts_only = false;
+    const char *filename = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        auto arg = std::string_view(argv[i]);
+        if (arg == "-c")
+            counts_only = true;
+        else if (arg.size() > 0 && arg[0] == '-')
+        {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        else
+            filename = argv[i];
+    }
+
+    if (!filename)
+    {
+        fprintf(stderr, "Usage: token_dump [-c] file\n");
+        return EXIT_FAILURE;
+    }
+
+    auto in = std::ifstream(filename, std::ios::binary);
+    if (!in)
+    {
+        fprintf(stderr, "Error: Failed to open input file '%s'\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        auto block = lexer::TokenBlock();
+        while (in.peek() != std::ifstream::traits_type::eof())
+        {
+            auto reader = lexer::TokenStreamReader(in);
+            const auto &header = reader.header();
+
+            if (!counts_only)
+                printf("# %s\n", header.source.c_str());
+
+            size_t blocks = 0;
+            while (reader.next_block(block))
+            {
+                ++blocks;
+                if (counts_only)
+                    continue;
+
+                for (size_t i = 0; i < block.size(); ++i)
+                {
+                    auto id = block.lexeme_ids[i];
+                    const char *name = id < header.lexemes.size() ? header.lexemes[id].c_str() : "(rejected)";
+                    printf("%s %zu %zu\n", name, static_cast<size_t>(block.begins[i]), static_cast<size_t>(block.ends[i]));
+                }
+            }
+
+            auto error = reader.error();
+            if (counts_only)
+            {
+                printf("%s\t%zu tokens\t%zu blocks", header.source.c_str(), static_cast<size_t>(reader.token_count()), blocks);
+                if (error.has_value())
+                    printf("\t%s@%zu", error_name(error->type), error->offset);
+                printf("\n");
+            }
+            else if (error.has_value())
+                printf("# error %s %zu\n", error_name(error->type), error->offset);
+        }
+    }
+    catch (const lexer::TokenFormatError &e)
+    {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}